@@ -1,18 +1,16 @@
-#include "main.h"
 #include "enqu.h"
-#include "enqu_x265.h"
 
-namespace enqu {
-
-/* input & output */
-format g_f, g_of;
-int g_nf = 0;
+#include <cmath>
 
-/* slider (io) */
-int g_si = 0;
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <sched.h>
+#endif
 
-/**/
-std::vector<int> g_sof;
+namespace enqu {
 
 const VSAPI* vsapi = 0;
 VSScript* se = 0;
@@ -23,13 +21,6 @@ char error_msg[1024];
 std::map<std::string, int> format::name2id;
 std::map<int, std::string> format::id2name;
 
-std::unique_ptr<video_buf_map> g_buf;
-std::unique_ptr<layout> g_layout;
-QSlider* g_slider;
-QGraphicsView* g_view;
-QGraphicsPixmapItem* g_pixmap;
-QLabel* g_stats;
-
 format::format(int id, int h, int w)
 	: id(id), h(h), w(w)
 {
@@ -53,29 +44,33 @@ struct video_buf
 	std::unique_ptr<uint8_t[]> buf;
 	uint8_t* ptr;
 	format f;
+	int nf;
 	int out_w, out_h;
-	video_buf(const format& f, VSNodeRef* node_)
+	video_buf(const format& f, int nf, VSNodeRef* node_)
 		: f(f)
-		, out_w(g_of.w)
-		, out_h(g_of.h)
+		, nf(nf)
+		, out_w(f.w)
+		, out_h(f.h)
 	{
 		if (!node_)
 			throw "";
-		size_t size = f.frame_size() * g_nf;
+		size_t size = f.frame_size() * nf;
 		ptr = new uint8_t[size];
 		if (!ptr)
 			sprintf(error_msg, ""), throw error_msg;
 		buf.reset(ptr);
-		node = invoke_raws_to_out(f, &ptr, out_h, out_w);
+		node = invoke_raws_to_out(f, nf, &ptr, out_h, out_w);
 		if (!node)
 			throw "";
-		inf.resize(g_nf);
-		for (int n = 0; n < g_nf; n++)
+		inf.resize(nf);
+		for (int n = 0; n < nf; n++)
 			inf[n] = ptr, node_get_frame(n, node_, &ptr);
 		vsapi->freeNode(node_);
+		metrics::input_bytes.add(size);
 	}
 	~video_buf()
 	{
+		metrics::input_bytes.add(-(int64_t)(f.frame_size() * nf));
 		vsapi->freeNode(node);
 	}
 	void out(int h, int w, uint8_t* src, uint8_t* out)
@@ -85,7 +80,7 @@ struct video_buf
 		{
 			out_w = w, out_h = h;
 			vsapi->freeNode(node);
-			node = invoke_raws_to_out(f, &ptr, h, w);
+			node = invoke_raws_to_out(f, nf, &ptr, h, w);
 			if (!node)
 				throw "";
 		}
@@ -100,7 +95,13 @@ struct video_buf
 
 struct video_buf_map_impl : video_buf_map
 {
-	std::map<int, std::unique_ptr<video_buf>> map;
+	struct entry
+	{
+		std::once_flag once;
+		std::unique_ptr<video_buf> buf;
+	};
+	std::mutex mutex; // map, shared by workers and gui
+	std::map<int, entry> map;
 	VSNodeRef* node; // input raws to node
 	std::unique_ptr<uint8_t[]> buf;
 	uint8_t* ptr;
@@ -108,24 +109,44 @@ struct video_buf_map_impl : video_buf_map
 	int out_w, out_h;
 	video_buf* at(const format& f)
 	{
-		if (!map.count(f.id))
-			map[f.id] = std::make_unique<video_buf>(f, invoke_node_to_src(f, node));
-		return map.at(f.id).get();
+		entry* e;
+		{
+			std::lock_guard lock(mutex);
+			e = &map[f.id];
+		}
+		// converted outside the map lock, only readers of this format wait for it
+		std::call_once(e->once, [&]
+			{
+				trace_span span("convert", f.id);
+				e->buf = std::make_unique<video_buf>(f, nf, invoke_node_to_src(f, node));
+			});
+		return e->buf.get();
 	}
-	video_buf_map_impl(VSNodeRef* node_)
-		: out_w(g_of.w)
-		, out_h(g_of.h)
+	video_buf_map_impl(VSNodeRef* node_, const format& f_, int nf_)
+		: out_w(f_.w)
+		, out_h(f_.h)
 	{
+		f = f_;
+		nf = nf_;
 		ptr = new uint8_t[(size_t)out_h * out_w * 4];
 		buf.reset(ptr);
-		input = new video_buf(g_f, node_);
-		map.emplace(g_f.id, input);
-		node = invoke_raws_to_node(*input);
+		metrics::preview_bytes.add((int64_t)out_h * out_w * 4);
+		entry& e = map[f.id];
+		std::call_once(e.once, [&] { e.buf.reset(input = new video_buf(f, nf, node_)); });
+		node = invoke_raws_to_node(f, nf, *input);
 	}
 	~video_buf_map_impl()
 	{
+		metrics::preview_bytes.add(-(int64_t)out_h * out_w * 4);
 		vsapi->freeNode(node);
 	}
+	void out_resize(int h, int w)
+	{
+		metrics::preview_bytes.add((int64_t)h * w * 4 - (int64_t)out_h * out_w * 4);
+		ptr = new uint8_t[(size_t)h * w * 4];
+		buf.reset(ptr);
+		out_w = w, out_h = h;
+	}
 	uint8_t** src(const format& f)
 	{
 		return *at(f);
@@ -133,29 +154,21 @@ struct video_buf_map_impl : video_buf_map
 	uint8_t* out(int n, int h, int w)
 	{
 		if (h != out_h || w != out_w)
-		{
-			ptr = new uint8_t[(size_t)h * w * 4];
-			buf.reset(ptr);
-			out_w = w, out_h = h;
-		}
+			out_resize(h, w);
 		input->out(n, h, w, ptr);
 		return ptr;
 	}
 	uint8_t* out(int h, int w, uint8_t* src, const format& f)
 	{
 		if (h != out_h || w != out_w)
-		{
-			ptr = new uint8_t[(size_t)h * w * 4];
-			buf.reset(ptr);
-			out_w = w, out_h = h;
-		}
+			out_resize(h, w);
 		at(f)->out(h, w, src, ptr);
 		return ptr;
 	}
 };
 
 // to input node
-VSNodeRef* invoke_raws_to_node(uint8_t** ptr)
+VSNodeRef* invoke_raws_to_node(const format& f, int nf, uint8_t** ptr)
 {
 	VSPlugin* vp_p = vsapi->getPluginById("xxx.xyz.vp", core);
 	if (!vp_p)
@@ -163,10 +176,10 @@ VSNodeRef* invoke_raws_to_node(uint8_t** ptr)
 	VSMap* args, * res;
 	args = vsapi->createMap();
 	vsapi->propSetInt(args, "ptr", (intptr_t)ptr, paReplace);
-	vsapi->propSetInt(args, "width", g_f.w, paReplace);
-	vsapi->propSetInt(args, "height", g_f.h, paReplace);
-	vsapi->propSetInt(args, "format_id", g_f.id, paReplace);
-	vsapi->propSetInt(args, "num_frames", g_nf, paReplace);
+	vsapi->propSetInt(args, "width", f.w, paReplace);
+	vsapi->propSetInt(args, "height", f.h, paReplace);
+	vsapi->propSetInt(args, "format_id", f.id, paReplace);
+	vsapi->propSetInt(args, "num_frames", nf, paReplace);
 	res = vsapi->invoke(vp_p, "raws", args);
 	vsapi->freeMap(args);
 	VSNodeRef* node;
@@ -200,7 +213,7 @@ VSNodeRef* invoke_node_to_src(const format& f, VSNodeRef* node)
 	return node;
 }
 
-VSNodeRef* invoke_raws_to_out(const format& f, uint8_t** ptr, int h, int w)
+VSNodeRef* invoke_raws_to_out(const format& f, int nf, uint8_t** ptr, int h, int w)
 {
 	VSPlugin* vp_p = vsapi->getPluginById("xxx.xyz.vp", core),
 		* resize_p = vsapi->getPluginById("com.vapoursynth.resize", core);
@@ -213,7 +226,7 @@ VSNodeRef* invoke_raws_to_out(const format& f, uint8_t** ptr, int h, int w)
 	vsapi->propSetInt(args, "width", f.w, paReplace);
 	vsapi->propSetInt(args, "height", f.h, paReplace);
 	vsapi->propSetInt(args, "format_id", f.id, paReplace);
-	vsapi->propSetInt(args, "num_frames", g_nf, paReplace);
+	vsapi->propSetInt(args, "num_frames", nf, paReplace);
 	res = vsapi->invoke(vp_p, "raws", args);
 	vsapi->freeMap(args);
 	VSNodeRef* node;
@@ -254,7 +267,11 @@ VSNodeRef* invoke_raws_to_out(const format& f, uint8_t** ptr, int h, int w)
 
 int node_get_frame(int n, VSNodeRef* node, uint8_t** ptr)
 {
-	const VSFrameRef* f = vsapi->getFrame(n, node, 0, 0);
+	const VSFrameRef* f;
+	{
+		trace_span span("getFrame", n);
+		f = vsapi->getFrame(n, node, 0, 0);
+	}
 	if (!f)
 		return -1;
 	const VSFormat* ff = vsapi->getFrameFormat(f);
@@ -275,223 +292,749 @@ int node_get_frame(int n, VSNodeRef* node, uint8_t** ptr)
 	return 0;
 }
 
-void res::resize(int id, std::pair<int, int> size, size_t of_count)
+std::shared_ptr<video_buf_map> make_video_buf_map(VSNodeRef* node)
 {
-	f = format(id, size.second, size.first);
-	if (!buf.empty())
-		free(buf[0]);
-	size_t frame_size = f.frame_size(), bytes = frame_size * of_count;
-	uint8_t* ptr = (uint8_t*)malloc(bytes);
-	if (!ptr)
-		return;
-	buf.resize(of_count);
-	for (int n = 0; n < of_count; n++)
+	const VSVideoInfo* vi = vsapi->getVideoInfo(node);
+	format f;
+	f.id = vi->format->id;
+	f.bit_depth = vi->format->bitsPerSample;
+	f.np = vi->format->numPlanes;
+	f.ssx = vi->format->subSamplingH;
+	f.h = vi->height;
+	f.w = vi->width;
+	if (vi->format->subSamplingW == f.ssx)
 	{
-		buf[n] = ptr;
-		ptr += frame_size;
+		try
+		{
+			auto _ = std::make_shared<video_buf_map_impl>(node, f, vi->numFrames);
+			if (vi->fpsNum > 0 && vi->fpsDen > 0)
+			{
+				_->fps_num = vi->fpsNum;
+				_->fps_den = vi->fpsDen;
+			}
+			return _;
+		}
+		catch (const char* error)
+		{
+		}
 	}
+	vsapi->freeNode(node);
+	return 0;
 }
 
-void close_input()
+struct video_buf_map_range : video_buf_map
 {
-	g_slider->setMaximum(0);
-	if (g_buf)
-		g_pixmap->setPixmap(QPixmap());
-	g_sof.clear();
-	g_buf.reset();
-}
+	std::shared_ptr<video_buf_map> in;
+	int first;
+	video_buf_map_range(std::shared_ptr<video_buf_map> in_, int first, int nf_)
+		: in(std::move(in_)), first(first)
+	{
+		f = in->f;
+		nf = nf_;
+		fps_num = in->fps_num;
+		fps_den = in->fps_den;
+	}
+	uint8_t** src(const format& of)
+	{
+		uint8_t** p = in->src(of);
+		return p ? p + first : 0;
+	}
+	uint8_t* out(int n, int h, int w) { return in->out(first + n, h, w); }
+	uint8_t* out(int h, int w, uint8_t* p, const format& of) { return in->out(h, w, p, of); }
+	int get_format(int id, format* of) { return in->get_format(id, of); }
+	int planes(const format& of, int n, uint8_t** p, int* stride)
+	{
+		return n >= 0 && n < nf ? in->planes(of, first + n, p, stride) : -1;
+	}
+};
 
-void out_changed()
+std::shared_ptr<video_buf_map> make_prefix_map(std::shared_ptr<video_buf_map> in, int nf)
 {
-	g_view->setSceneRect(0, 0, g_of.w, g_of.h);
-	if (g_of.w > 1280 || g_of.h > 720)
-		g_view->setDragMode(QGraphicsView::ScrollHandDrag);
-	else
-		g_view->setDragMode(QGraphicsView::NoDrag);
+	return make_range_map(std::move(in), 0, nf);
 }
 
-int pixmap_update(int si)
+std::shared_ptr<video_buf_map> make_range_map(std::shared_ptr<video_buf_map> in, int first, int nf)
 {
-	if (!g_buf)
-		return -1;
-	int w = g_of.w, h = g_of.h;
-	g_pixmap->setPixmap(QPixmap::fromImage(QImage((const uchar*)g_buf->out(si, h, w), w, h, QImage::Format_RGB32)));
-	return 0;
+	first = std::clamp(first, 0, in->nf);
+	nf = std::clamp(nf, 0, in->nf - first);
+	if (!first && nf == in->nf)
+		return in;
+	return std::make_shared<video_buf_map_range>(std::move(in), first, nf);
 }
 
-void open()
+struct video_buf_map_proxy : video_buf_map
 {
-	QString ret = QFileDialog::getOpenFileName(0, QObject::tr(""), QObject::tr(""), QObject::tr("(*.vpy *.mkv);;(*)"), 0, 0);
-	if (ret.isEmpty())
-		return;
-	close_input();
-	std::string path = ret.toStdString();
-	VSNodeRef* node = 0;
-	do
+	std::shared_ptr<video_buf_map> in;
+	std::vector<int> frames;
+	std::mutex mutex;
+	std::map<int, std::vector<uint8_t*>> map; // in's frame pointers reordered, per format
+	video_buf_map_proxy(std::shared_ptr<video_buf_map> in_, std::vector<int> frames_)
+		: in(std::move(in_)), frames(std::move(frames_))
 	{
-		if (path.ends_with(".vpy"))
-		{
-			if (vsscript_evaluateFile(&se, path.c_str(), efSetWorkingDir))
-				break;
-			node = vsscript_getOutput(se, 0);
-		}
-		if (!node)
-			break;
-		const VSVideoInfo* vi = vsapi->getVideoInfo(node);
-		g_f.id = vi->format->id;
-		g_f.bit_depth = vi->format->bitsPerSample;
-		g_f.np = vi->format->numPlanes;
-		g_f.ssx = vi->format->subSamplingH;
-		if (vi->format->subSamplingW != g_f.ssx)
-			break;
-		g_f.h = vi->height;
-		g_f.w = vi->width;
-		g_nf = vi->numFrames;
-		g_of = g_f;
-		try
+		f = in->f;
+		nf = (int)frames.size();
+		fps_num = in->fps_num;
+		fps_den = in->fps_den;
+	}
+	uint8_t** src(const format& of)
+	{
+		uint8_t** p = in->src(of);
+		if (!p)
+			return 0;
+		std::lock_guard lock(mutex);
+		auto it = map.find(of.id);
+		if (it == map.end())
 		{
-			g_buf.reset(new video_buf_map_impl(node));
+			std::vector<uint8_t*> _(nf);
+			for (int n = 0; n < nf; n++)
+				_[n] = p[frames[n]];
+			it = map.emplace(of.id, std::move(_)).first;
 		}
-		catch (const char* error)
+		return it->second.data();
+	}
+	uint8_t* out(int n, int h, int w) { return in->out(frames.at(n), h, w); }
+	uint8_t* out(int h, int w, uint8_t* p, const format& of) { return in->out(h, w, p, of); }
+	int get_format(int id, format* of) { return in->get_format(id, of); }
+	int planes(const format& of, int n, uint8_t** p, int* stride)
+	{
+		return n >= 0 && n < nf ? in->planes(of, frames[n], p, stride) : -1;
+	}
+};
+
+std::shared_ptr<video_buf_map> make_proxy_map(std::shared_ptr<video_buf_map> in, std::vector<int> frames)
+{
+	return std::make_shared<video_buf_map_proxy>(std::move(in), std::move(frames));
+}
+
+struct video_buf_map_crop : video_buf_map
+{
+	std::shared_ptr<video_buf_map> in;
+	int x, y;
+	std::mutex mutex;
+	std::vector<uint8_t> frame; // crop_out's, a whole frame
+	video_buf_map_crop(std::shared_ptr<video_buf_map> in_, int x, int y, int w, int h)
+		: in(std::move(in_)), x(x), y(y)
+	{
+		f = in->f;
+		f.w = w, f.h = h;
+		nf = in->nf;
+		fps_num = in->fps_num;
+		fps_den = in->fps_den;
+	}
+	format whole(const format& of) const
+	{
+		format _ = of;
+		_.w = in->f.w, _.h = in->f.h;
+		return _;
+	}
+	uint8_t** src(const format&) { return 0; }
+	uint8_t* out(int n, int h, int w) { return in->out(n, h, w); }
+	uint8_t* out(int h, int w, uint8_t* p, const format& of) { return in->out(h, w, p, of); }
+	int get_format(int id, format* of)
+	{
+		if (in->get_format(id, of))
+			return -1;
+		of->w = f.w, of->h = f.h;
+		return 0;
+	}
+	int planes(const format& of, int n, uint8_t** p, int* stride)
+	{
+		if (in->planes(whole(of), n, p, stride))
+			return -1;
+		int bps = (of.bit_depth + 7) >> 3;
+		for (int c = 0; c < of.np; c++)
+			p[c] += (size_t)stride[c] * (c ? y >> of.ssx : y) + (size_t)(c ? x >> of.ssx : x) * bps;
+		return 0;
+	}
+	uint8_t* out(int n, int h, int w, uint8_t* src, const format& of)
+	{
+		format wf = whole(of);
+		uint8_t* a[3], * b[3], * c[3];
+		int sa[3], sb[3], sc[3];
+		if (in->planes(wf, n, a, sa))
+			return 0;
+		std::lock_guard lock(mutex);
+		frame.resize(wf.frame_size());
+		wf.planes(frame.data(), b, sb);
+		of.planes(src, c, sc);
+		int bps = (of.bit_depth + 7) >> 3;
+		for (int p = 0; p < of.np; p++)
 		{
-			break;
+			int ss = p ? of.ssx : 0, ph = wf.h >> ss, py = y >> ss, px = x >> ss, cw = of.w >> ss, ch = of.h >> ss;
+			for (int i = 0; i < ph; i++)
+			{
+				uint8_t* row = b[p] + (size_t)sb[p] * i;
+				memcpy(row, a[p] + (size_t)sa[p] * i, sb[p]);
+				if (i >= py && i < py + ch)
+					memcpy(row + (size_t)px * bps, c[p] + (size_t)sc[p] * (i - py), (size_t)cw * bps);
+			}
 		}
-		for (int i = 0; i < g_nf; i++)
-			g_sof.push_back(i);
-		g_slider->setMaximum(g_sof.size() - 1);
-		if (g_layout)
-			g_layout->input_changed();
-		out_changed();
-		g_si = std::clamp(g_si, 0, g_nf);
-		pixmap_update(g_si);
-		return;
-	} while (0);
-	if (node)
-		vsapi->freeNode(node);
+		return in->out(h, w, frame.data(), wf);
+	}
+};
+
+std::shared_ptr<video_buf_map> make_crop_map(std::shared_ptr<video_buf_map> in, int x, int y, int w, int h)
+{
+	if (x < 0 || y < 0 || (x | y) & 1 || w <= 0 || h <= 0 || x + w > in->f.w || y + h > in->f.h)
+		return 0;
+	return std::make_shared<video_buf_map_crop>(std::move(in), x, y, w, h);
 }
 
-main_window::main_window()
+uint8_t* crop_out(video_buf_map* in, int n, int h, int w, uint8_t* p, const format& of)
 {
-	try
+	if (auto crop = dynamic_cast<video_buf_map_crop*>(in))
+		return crop->out(n, h, w, p, of);
+	return in->out(h, w, p, of);
+}
+
+// MemAvailable of /proc/meminfo, 0 where unknown
+static size_t mem_available()
+{
+	size_t kb = 0;
+	if (FILE* fp = fopen("/proc/meminfo", "r"))
 	{
-		if (!vsscript_init())
-			throw "!vsscript_init()";
-		vsapi = vsscript_getVSApi();
-		if (!vsapi)
-			throw "!vsapi";
-		if (vsscript_createScript(&se))
-			sprintf(error_msg, "%s", vsscript_getError(se)), throw error_msg;
-		core = vsscript_getCore(se);
-		if (!core)
-			throw "!core";
-		vsapi->setThreadCount(1, core);
+		char line[256];
+		while (fgets(line, sizeof(line), fp))
+			if (sscanf(line, "MemAvailable: %zu kB", &kb) == 1)
+				break;
+		fclose(fp);
 	}
-	catch (const char* msg)
+	return kb * 1024;
+}
+
+struct video_buf_map_numa : video_buf_map
+{
+	std::shared_ptr<video_buf_map> in;
+	std::mutex mutex;
+	std::map<std::pair<int, int>, std::vector<uint8_t*>> map; // by node, format; empty if over budget
+	std::vector<std::unique_ptr<uint8_t[]>> bufs;
+	size_t budget, used = 0;
+	video_buf_map_numa(std::shared_ptr<video_buf_map> in_)
+		: in(std::move(in_)), budget(mem_available() / 2)
 	{
-		if (vsapi)
+		f = in->f;
+		nf = in->nf;
+		fps_num = in->fps_num;
+		fps_den = in->fps_den;
+	}
+	~video_buf_map_numa()
+	{
+		metrics::input_bytes.add(-(int64_t)used);
+	}
+	uint8_t** src(const format& of)
+	{
+		uint8_t** p = in->src(of);
+		int node = numa::current();
+		if (!p || node < 0)
+			return p;
+		std::lock_guard lock(mutex);
+		auto it = map.find({ node, of.id });
+		if (it == map.end())
 		{
-			if (se)
-				vsscript_freeScript(se), se = 0;
-			vsapi = 0;
-			vsscript_finalize();
+			std::vector<uint8_t*> _;
+			size_t size = of.frame_size(), bytes = size * nf;
+			if (used + bytes <= budget)
+			{
+				// untouched until copied by this thread, so the pages land on its node
+				trace_span span("replicate", node);
+				uint8_t* buf = new uint8_t[bytes];
+				bufs.emplace_back(buf);
+				for (int n = 0; n < nf; n++)
+					_.push_back((uint8_t*)memcpy(buf + size * n, p[n], size));
+				used += bytes;
+				metrics::input_bytes.add(bytes);
+			}
+			it = map.emplace(std::make_pair(node, of.id), std::move(_)).first;
 		}
-		QMessageBox::warning(this, QObject::tr(""), msg);
-	}
-	resize(1800, 900);
-	QWidget* center = new QWidget;
-	setCentralWidget(center);
-	QVBoxLayout* box = new QVBoxLayout(center);
-	QTabWidget* tab = new QTabWidget;
-	QMenu* menu0 = menuBar()->addMenu(tr("&File"));
-	menu0->addAction(tr("..."), [] { open(); });
-	menu0->addSeparator();
-	QMenu* menu1 = menuBar()->addMenu(tr("&Tools"));
-	QActionGroup* group = new QActionGroup(this);
-	group->setExclusive(true);
-	{
-		QAction* _;
-		_ = menu1->addAction(tr("x265"), this, [=]
+		return it->second.empty() ? p : it->second.data();
+	}
+	uint8_t* out(int n, int h, int w) { return in->out(n, h, w); }
+	uint8_t* out(int h, int w, uint8_t* p, const format& of) { return in->out(h, w, p, of); }
+	int get_format(int id, format* of) { return in->get_format(id, of); }
+	int planes(const format& of, int n, uint8_t** p, int* stride)
+	{
+		uint8_t** frames = src(of);
+		if (!frames)
+			return in->planes(of, n, p, stride);
+		if (n < 0 || n >= nf)
+			return -1;
+		of.planes(frames[n], p, stride);
+		return 0;
+	}
+};
+
+std::shared_ptr<video_buf_map> make_numa_map(std::shared_ptr<video_buf_map> in)
+{
+	if (numa::nodes().size() < 2)
+		return in;
+	return std::make_shared<video_buf_map_numa>(std::move(in));
+}
+
+// mean luma of 16x16 blocks, every other row and column sampled
+static std::vector<float> thumbnail(video_buf_map* in, int n)
+{
+	const format& f = in->f;
+	uint8_t* p[3];
+	int stride[3];
+	std::vector<float> t;
+	if (in->planes(f, n, p, stride))
+		return t;
+	int bw = f.w / 16, bh = f.h / 16;
+	t.resize((size_t)bw * bh);
+	float scale = 1.f / ((1 << f.bit_depth) - 1) / 64;
+	for (int by = 0; by < bh; by++)
+		for (int bx = 0; bx < bw; bx++)
 		{
-			if (g_layout)
-				g_layout.reset();
-			g_layout = make_x265_layout(tab);
-		});
-		_->setCheckable(true);
-		group->addAction(_);
-	}
-	menu1->addSeparator();
-	g_slider = new QSlider(Qt::Orientation::Horizontal);
-	box->addWidget(g_slider);
-	g_slider->setTickPosition(QSlider::TickPosition::TicksBothSides);
-	g_slider->setFixedWidth(100);
-	g_slider->setRange(0, 0);
-	connect(g_slider, &QSlider::valueChanged,
-		[=](int n)
-	{
-		g_si = n;
-		if (g_layout)
-			g_layout->pixmap_update(n);
-		else
-			pixmap_update(n);
-	});
-	box->addWidget(tab);
-	QDockWidget* view_dock = new QDockWidget;
-	QGraphicsScene* scene = new QGraphicsScene(QRect(0, 0, 1280, 720));
-	g_pixmap = scene->addPixmap(QPixmap());
-	g_view = new QGraphicsView;
-	g_view->setAlignment(Qt::AlignLeft | Qt::AlignTop);
-	g_view->setInteractive(false);
-	g_view->setScene(scene);
-	view_dock->setWidget(g_view);
-	addDockWidget(Qt::RightDockWidgetArea, view_dock);
-	QDockWidget* stat_dock = new QDockWidget;
-	g_stats = new QLabel;
-	stat_dock->setWidget(g_stats);
-	addDockWidget(Qt::RightDockWidgetArea, stat_dock);
-	installEventFilter(this);
-}
-
-main_window::~main_window()
-{
-	g_layout.reset();
-	g_buf.reset();
-	if (vsapi)
+			uint32_t sum = 0;
+			for (int y = by * 16; y < by * 16 + 16; y += 2)
+			{
+				const uint8_t* row = p[0] + (size_t)stride[0] * y;
+				for (int x = bx * 16; x < bx * 16 + 16; x += 2)
+					sum += f.bit_depth > 8 ? ((const uint16_t*)row)[x] : row[x];
+			}
+			t[(size_t)by * bw + bx] = sum * scale;
+		}
+	return t;
+}
+
+std::vector<int> scene_cuts(video_buf_map* in)
+{
+	int nf = in->nf;
+	std::vector<int> cut = { 0 };
+	if (nf < 2 || in->f.w < 16 || in->f.h < 16)
 	{
-		if (se)
-			vsscript_freeScript(se);
-		vsscript_finalize();
+		cut.push_back(nf);
+		return cut;
+	}
+	// mean absolute change of the thumbnails, a cut where it is well above the usual
+	std::vector<float> d(nf), prev = thumbnail(in, 0), t;
+	for (int n = 1; n < nf; n++, prev.swap(t))
+	{
+		t = thumbnail(in, n);
+		double acc = 0;
+		for (size_t i = 0; i < t.size() && t.size() == prev.size(); i++)
+			acc += std::abs(t[i] - prev[i]);
+		d[n] = t.empty() ? 0.f : float(acc / t.size());
 	}
+	std::vector<float> sorted(d.begin() + 1, d.end());
+	std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+	float threshold = std::max(.08f, 4 * sorted[sorted.size() / 2]);
+	for (int n = 1; n < nf; n++)
+		if (d[n] > threshold)
+			cut.push_back(n);
+	cut.push_back(nf);
+	return cut;
 }
 
-bool main_window::eventFilter(QObject* obj, QEvent* event)
+std::vector<int> proxy_frames(video_buf_map* in, int ratio, int seg)
 {
-	switch (event->type())
+	int nf = in->nf;
+	int budget = std::max(seg, nf / std::max(1, ratio));
+	std::vector<int> frames;
+	if (nf <= budget || in->f.w < 16 || in->f.h < 16)
 	{
-	case QEvent::KeyPress:
+		for (int n = 0; n < nf; n++)
+			frames.push_back(n);
+		return frames;
+	}
+	std::vector<int> cut = scene_cuts(in);
+	// a run of seg frames around each of k evenly spaced points, kept inside its scene
+	int k = (budget + seg - 1) / seg, end = 0;
+	for (int i = 0; i < k; i++)
 	{
-		QKeyEvent* key_event = static_cast<QKeyEvent*>(event);
-		int key = key_event->key(), modifiers = key_event->modifiers();
-		switch (key)
-		{
-		case Qt::Key_Q:
-			QApplication::quit();
-			return 1;
-		case Qt::Key_Plus:
-			g_of.w = std::clamp(g_of.w * 2, 1280, g_f.w * 4);
-			g_of.h = std::clamp(g_of.h * 2, 720, g_f.h * 4);
-			out_changed();
-			return 1;
-		case Qt::Key_Minus:
-			g_of.w = std::clamp(g_of.w / 2, 1280, g_f.w * 4);
-			g_of.h = std::clamp(g_of.h / 2, 720, g_f.h * 4);
-			out_changed();
-			return 1;
-		}
+		int m = (int)(((int64_t)2 * i + 1) * nf / (2 * k));
+		size_t s = std::upper_bound(cut.begin(), cut.end(), m) - cut.begin() - 1;
+		int lo = std::max(cut[s], end), hi = cut[s + 1];
+		int start = std::clamp(m - seg / 2, lo, std::max(lo, hi - seg));
+		for (int n = start; n < std::min(hi, start + seg); n++)
+			frames.push_back(n);
+		end = std::max(end, std::min(hi, start + seg));
+	}
+	return frames;
+}
+
+std::vector<int> chunk_bounds(const std::vector<int>& cut, int nf, int n, int min_frames)
+{
+	min_frames = std::max(1, min_frames);
+	n = std::clamp(n, 1, std::max(1, nf / min_frames));
+	std::vector<int> bounds = { 0 };
+	for (int i = 1; i < n; i++)
+	{
+		int m = (int)((int64_t)i * nf / n), lo = bounds.back() + min_frames, hi = nf - min_frames;
+		if (lo > hi)
+			break;
+		// the nearest cut within half a chunk, else the even point
+		int best = std::clamp(m, lo, hi), dist = nf / n / 2 + 1;
+		for (int c : cut)
+			if (c >= lo && c <= hi && std::abs(c - m) < dist)
+				best = c, dist = std::abs(c - m);
+		bounds.push_back(best);
+	}
+	bounds.push_back(nf);
+	return bounds;
+}
+
+std::vector<bool> pareto_front(const std::vector<const stats*>& st)
+{
+	std::vector<bool> front(st.size());
+	auto dominates = [](const stats* a, const stats* b)
+	{
+		bool ge = a->bitrate <= b->bitrate && a->speed() >= b->speed() && a->psnr[3] >= b->psnr[3];
+		bool gt = a->bitrate < b->bitrate || a->speed() > b->speed() || a->psnr[3] > b->psnr[3];
+		return ge && gt;
+	};
+	for (size_t i = 0; i < st.size(); i++)
+	{
+		if (!st[i])
+			continue;
+		front[i] = 1;
+		for (size_t j = 0; j < st.size() && front[i]; j++)
+			if (st[j] && dominates(st[j], st[i]))
+				front[i] = 0;
 	}
+	return front;
+}
+
+static double median_sorted(const std::vector<double>& x)
+{
+	size_t n = x.size();
+	return n % 2 ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+}
+
+sample_summary summarize(std::vector<double> x, double level)
+{
+	sample_summary s;
+	size_t n = s.n = x.size();
+	if (!n)
+		return s;
+	std::sort(x.begin(), x.end());
+	s.median = median_sorted(x);
+	std::vector<double> d(n);
+	for (size_t i = 0; i < n; i++)
+		d[i] = std::abs(x[i] - s.median);
+	std::sort(d.begin(), d.end());
+	s.mad = median_sorted(d);
+	// [x[e], x[n - 1 - e]] misses the median with probability 2 P(B <= e), B ~ binomial(n, 1/2)
+	double p = std::pow(.5, (double)n), cdf = p;
+	size_t e = 0;
+	while (e + 1 <= (n - 1) / 2)
+	{
+		double next = p * (n - e) / (e + 1);
+		if (2 * (cdf + next) > 1 - level)
+			break;
+		e++, p = next, cdf += next;
 	}
-	if (g_layout && g_layout->event(obj, event))
+	s.lo = x[e];
+	s.hi = x[n - 1 - e];
+	s.level = std::max(0., 1 - 2 * cdf);
+	return s;
+}
+
+double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b)
+{
+	size_t m = a.size(), n = b.size();
+	if (!m || !n)
 		return 1;
-	return QObject::eventFilter(obj, event);
+	double u = 0;
+	for (double x : a)
+		for (double y : b)
+			u += x > y ? 1 : x == y ? .5 : 0;
+	double mean = m * n / 2., d = std::abs(u - mean);
+	if (m + n > 40)
+	{
+		double sigma = std::sqrt(m * n * (m + n + 1) / 12.);
+		return std::min(1., std::erfc(std::max(0., d - .5) / sigma / std::sqrt(2.)));
+	}
+	// counts of u over all orderings, the coefficients of the gaussian binomial (m + n choose m)
+	size_t top = m * n;
+	std::vector<double> c(top + 1);
+	c[0] = 1;
+	for (size_t i = 1; i <= m; i++)
+	{
+		for (size_t k = top; k >= n + i; k--)
+			c[k] -= c[k - n - i];
+		for (size_t k = i; k <= top; k++)
+			c[k] += c[k - i];
+	}
+	double tail = 0, all = 0;
+	for (size_t k = 0; k <= top; k++)
+	{
+		all += c[k];
+		if (std::abs(k - mean) >= d - 1e-9)
+			tail += c[k];
+	}
+	return std::min(1., tail / all);
+}
+
+#ifdef __linux__
+static int64_t peak_rss()
+{
+	rusage ru;
+	return getrusage(RUSAGE_SELF, &ru) ? 0 : (int64_t)ru.ru_maxrss * 1024;
+}
+
+cpu_meter::cpu_meter()
+{
+	static const std::pair<uint32_t, uint64_t> event[3] = {
+		{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+		{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	};
+	for (int i = 0; i < 3; i++)
+	{
+		perf_event_attr a = {};
+		a.size = sizeof(a);
+		a.type = event[i].first;
+		a.config = event[i].second;
+		a.inherit = 1;
+		a.exclude_kernel = i > 0;
+		a.exclude_hv = 1;
+		a.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fd[i] = (int)syscall(SYS_perf_event_open, &a, 0, -1, -1, PERF_FLAG_FD_CLOEXEC);
+	}
+	rss0 = peak_rss();
+}
+
+cpu_meter::~cpu_meter()
+{
+	for (int _ : fd)
+		if (_ >= 0)
+			close(_);
+}
+
+cpu_usage cpu_meter::read() const
+{
+	cpu_usage u;
+	uint64_t v[3];
+	double x[3] = {};
+	for (int i = 0; i < 3; i++)
+		if (fd[i] >= 0 && ::read(fd[i], v, sizeof(v)) == sizeof(v) && v[2])
+			x[i] = (double)v[0] * v[1] / v[2]; // scaled up while multiplexed
+	u.cpu = x[0] * 1e-9;
+	u.cycles = (uint64_t)x[1];
+	u.instructions = (uint64_t)x[2];
+	u.peak_rss = peak_rss() - rss0;
+	return u;
+}
+#else
+cpu_meter::cpu_meter() {}
+cpu_meter::~cpu_meter() {}
+cpu_usage cpu_meter::read() const { return {}; }
+#endif
+
+// pixels a job encodes, what its seconds are per
+static double cost_pixels(const context& ctx)
+{
+	return std::max(1., (double)ctx.in->nf * ctx.in->f.w * ctx.in->f.h);
+}
+
+double cost_model::log_predict(const std::vector<std::string>& features) const
+{
+	double y = bias;
+	for (auto& _ : features)
+		if (auto it = w.find(_); it != w.end())
+			y += it->second;
+	return y;
+}
+
+double cost_model::predict(const context& ctx)
+{
+	std::vector<std::string> f = ctx.k->features();
+	std::lock_guard lock(mutex);
+	return std::exp(log_predict(f)) * cost_pixels(ctx);
+}
+
+void cost_model::learn(const context& ctx, double seconds)
+{
+	if (!(seconds > 0))
+		return;
+	std::vector<std::string> f = ctx.k->features();
+	std::lock_guard lock(mutex);
+	double y = std::log(seconds / cost_pixels(ctx));
+	if (!n++)
+	{
+		bias = y;
+		return;
+	}
+	double e = y - log_predict(f), step = .5 * e / (1 + f.size());
+	err.push_back(std::abs(e));
+	bias += step;
+	for (auto& _ : f)
+		w[_] += step;
+}
+
+double cost_model::error()
+{
+	std::lock_guard lock(mutex);
+	if (err.empty())
+		return 0;
+	std::vector<double> _ = err;
+	std::nth_element(_.begin(), _.begin() + _.size() / 2, _.end());
+	return std::exp(_[_.size() / 2]);
+}
+
+// "0,2-3" into cpu numbers, as taken by pin_cpus and listed by sysfs
+static int parse_cpus(const std::string& list, std::vector<int>* cpus)
+{
+	cpus->clear();
+	for (const char* s = list.c_str(); *s && *s != '\n';)
+	{
+		int a, b, n = 0;
+		if (sscanf(s, "%d-%d%n", &a, &b, &n) == 2 && n)
+			;
+		else if (sscanf(s, "%d%n", &a, &n) == 1 && n)
+			b = a;
+		else
+			return -1;
+		if (a < 0 || b < a || b >= 65536)
+			return -1;
+		for (int i = a; i <= b; i++)
+			cpus->push_back(i);
+		s += n;
+		if (*s == ',')
+			s++;
+		else if (*s && *s != '\n')
+			return -1;
+	}
+	return 0;
+}
+
+#ifdef __linux__
+static int set_affinity(const std::vector<int>& cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int i : cpus)
+	{
+		if (i >= CPU_SETSIZE)
+			return -1;
+		CPU_SET(i, &set);
+	}
+	return CPU_COUNT(&set) && !sched_setaffinity(0, sizeof(set), &set) ? 0 : -1;
+}
+#else
+static int set_affinity(const std::vector<int>&)
+{
+	return -1;
+}
+#endif
+
+int pin_cpus(const std::string& list)
+{
+	std::vector<int> cpus;
+	return parse_cpus(list, &cpus) ? -1 : set_affinity(cpus);
+}
+
+namespace numa {
+
+static std::mutex mutex;
+static std::vector<std::vector<int>> topology;
+static thread_local int node = -1;
+
+const std::vector<std::vector<int>>& nodes()
+{
+	std::lock_guard lock(mutex);
+	if (!topology.empty())
+		return topology;
+	// ids may have gaps, nodes of memory only have no cpus
+	for (int id = 0; id < 1024; id++)
+	{
+		char path[64];
+		sprintf(path, "/sys/devices/system/node/node%d/cpulist", id);
+		FILE* fp = fopen(path, "r");
+		if (!fp)
+			continue;
+		char line[4096] = {};
+		std::vector<int> cpus;
+		if (fgets(line, sizeof(line), fp) && !parse_cpus(line, &cpus) && !cpus.empty())
+			topology.push_back(std::move(cpus));
+		fclose(fp);
+	}
+	if (topology.empty())
+	{
+		topology.emplace_back();
+		for (int i = 0; i < (int)std::max(1u, std::thread::hardware_concurrency()); i++)
+			topology[0].push_back(i);
+	}
+	return topology;
+}
+
+void fake(int n)
+{
+	std::vector<int> all;
+	for (auto& _ : nodes())
+		all.insert(all.end(), _.begin(), _.end());
+	std::sort(all.begin(), all.end());
+	n = std::max(n, 1);
+	std::lock_guard lock(mutex);
+	topology.assign(n, {});
+	for (size_t i = 0; i < std::max(all.size(), (size_t)n); i++) // fewer cpus than nodes: shared
+		topology[i * n / std::max(all.size(), (size_t)n)].push_back(all[i % all.size()]);
+}
+
+int bind(int n)
+{
+	const auto& t = nodes();
+	if (n < 0 || n >= (int)t.size() || set_affinity(t[n]))
+		return -1;
+	node = n;
+	return 0;
+}
+
+int current()
+{
+	return node;
+}
+
+}
+
+int res::resize(const format& of, size_t of_count)
+{
+	if (!empty())
+		return -1;
+	f = of;
+	size_t frame_size = f.frame_size(), bytes = frame_size * of_count;
+	// first written by the encode's worker, whose numa node the pages go to
+	uint8_t* ptr = (uint8_t*)malloc(bytes);
+	if (!ptr)
+		return -1;
+	buf.resize(of_count);
+	for (int n = 0; n < of_count; n++)
+	{
+		buf[n] = ptr;
+		ptr += frame_size;
+	}
+	ready = std::make_unique<std::atomic<bool>[]>(of_count);
+	metrics::result_bytes.add(bytes);
+	allocated.store(1, std::memory_order_release);
+	return 0;
+}
+
+void vs_init()
+{
+	if (!vsscript_init())
+		throw "!vsscript_init()";
+	vsapi = vsscript_getVSApi();
+	if (!vsapi)
+		throw "!vsapi";
+	if (vsscript_createScript(&se))
+		sprintf(error_msg, "%s", vsscript_getError(se)), throw error_msg;
+	core = vsscript_getCore(se);
+	if (!core)
+		throw "!core";
+	vsapi->setThreadCount(1, core);
+	format::register_presets();
+}
+
+void vs_finalize()
+{
+	if (vsapi)
+	{
+		if (se)
+			vsscript_freeScript(se), se = 0;
+		vsapi = 0;
+		vsscript_finalize();
+	}
 }
 
 template< typename T>
@@ -540,8 +1083,9 @@ template<>
 std::string p2str<format>(const std::any& _x)
 {
 	int x = std::any_cast<int>(_x);
+	// inputs without a core (c api) have no preset names, the id stands for itself
 	if (!format::id2name.count(x) && format::try_get_format_preset(x))
-		throw;
+		return std::to_string(x);
 	return format::id2name.at(x);
 }
 
@@ -553,12 +1097,12 @@ int str2p<format>(const char** str, void* _x)
 	char buf[16] = { 0 };
 	n = sscanf(*str, "%15[^\n]\n%n", buf, &n) == 1 ? n : 0;//...
 	std::string name = buf;
-	if (!format::name2id.count(name))
-	{
-		// construct from name
+	if (format::name2id.count(name))
+		*x = format::name2id.at(buf);
+	else if (!name.empty() && name.find_first_not_of("0123456789") == std::string::npos)
+		*x = atoi(buf); // as p2str writes a format without a name
+	else
 		return 0;
-	}
-	*x = format::name2id.at(buf);
 	*str += n; return n;
 }
 
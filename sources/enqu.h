@@ -7,10 +7,17 @@
 
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
 #include <tuple>
 #include <array>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <list>
 #include <map>
 #include <set>
 #include <any>
@@ -18,9 +25,9 @@
 #include <functional>
 #include <utility>
 #include <type_traits>
-
-#include <QtWidgets>
-//#include <QThread>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
 
 #define XSTR(X) STR(X)
 #define STR(X) #X
@@ -56,11 +63,6 @@ void interleave_copy(size_t h, size_t w, size_t np, size_t ssh, size_t ssw, uint
 typedef void (*plane_copy_f)(size_t, size_t, uint8_t**, uint8_t*, size_t);
 typedef void (*copy_f)(size_t, size_t, size_t, size_t, size_t, uint8_t*, uint8_t**, int*);
 
-extern std::vector<int> g_sof;
-extern int g_si, g_nf;
-extern QGraphicsPixmapItem* g_pixmap;
-extern QLabel* g_stats;
-extern QGraphicsView* g_view;
 extern char error_msg[1024];
 extern const VSAPI* vsapi;
 extern VSScript* se;
@@ -81,7 +83,11 @@ struct format
 	static std::map<int, std::string> id2name;
 	static int try_get_format_preset(int id)
 	{
+		if (!vsapi || !core)
+			return -1;
 		const VSFormat* f = vsapi->getFormatPreset(id, core);
+		if (!f)
+			return -1;
 		std::string name = f->name;
 		if (name.empty())
 			return -1;
@@ -89,6 +95,13 @@ struct format
 		name2id[f->name] = id;
 		return 0;
 	}
+	// names of the gray and yuv presets, so str2p<format> parses them before first use
+	static void register_presets()
+	{
+		for (int family : { cmGray, cmYUV })
+			for (int id = family + 10; id < family + 64; id++)
+				try_get_format_preset(id);
+	}
 	size_t frame_size() const
 	{
 		int bytes_per_sample = (bit_depth + 7) >> 3;
@@ -97,23 +110,80 @@ struct format
 			size += (size >> ssx >> ssx) * (np - 1);
 		return size * bytes_per_sample;
 	}
+	// plane pointers and byte strides of a contiguous frame
+	void planes(uint8_t* frame, uint8_t** p, int* stride) const
+	{
+		stride[0] = w * ((bit_depth + 7) >> 3);
+		stride[2] = stride[1] = stride[0] >> ssx;
+		p[0] = frame;
+		p[1] = p[0] + (size_t)stride[0] * h;
+		p[2] = p[1] + ((size_t)stride[1] * h >> ssx);
+	}
 };
 
-VSNodeRef* invoke_raws_to_node(uint8_t** ptr);
+VSNodeRef* invoke_raws_to_node(const format&, int nf, uint8_t** ptr);
 VSNodeRef* invoke_node_to_src(const format&, VSNodeRef* node);
-VSNodeRef* invoke_raws_to_out(const format&, uint8_t** ptr, int, int);
+VSNodeRef* invoke_raws_to_out(const format&, int nf, uint8_t** ptr, int, int);
 int node_get_frame(int n, VSNodeRef* node, uint8_t** ptr);
 
-int pixmap_update(int si);
+// script environment and core shared by every frontend, throws const char*
+void vs_init();
+void vs_finalize();
 
 struct video_buf_map
 {
+	format f;
+	int nf = 0;
+	int64_t fps_num = 24000, fps_den = 1001; // of the clip, the default where it has none
 	virtual uint8_t** src(const format& f) = 0;
 	virtual uint8_t* out(int, int, int) = 0;
 	virtual uint8_t* out(int, int, uint8_t*, const format& f) = 0;
+	// format of preset id at the input size
+	virtual int get_format(int id, format* of)
+	{
+		*of = format(id, f.h, f.w);
+		return 0;
+	}
+	// plane pointers and byte strides of input frame n in format of
+	virtual int planes(const format& of, int n, uint8_t** p, int* stride)
+	{
+		uint8_t** frames = src(of);
+		if (!frames || n < 0 || n >= nf)
+			return -1;
+		of.planes(frames[n], p, stride);
+		return 0;
+	}
 	virtual ~video_buf_map() = default;
 };
 
+// copies every frame of node (consumed) to memory, 0 on failure
+std::shared_ptr<video_buf_map> make_video_buf_map(VSNodeRef* node);
+// first nf frames of in, sharing its memory
+std::shared_ptr<video_buf_map> make_prefix_map(std::shared_ptr<video_buf_map> in, int nf);
+// nf frames of in from first on, sharing its memory
+std::shared_ptr<video_buf_map> make_range_map(std::shared_ptr<video_buf_map> in, int first, int nf);
+// first frames of the scenes of in, from the luma of consecutive frames; 0, the cuts, then nf
+std::vector<int> scene_cuts(video_buf_map* in);
+/* frames of in standing for the whole clip, about nf / ratio: runs of seg frames inside
+ * a scene at evenly spaced points */
+std::vector<int> proxy_frames(video_buf_map* in, int ratio, int seg = 12);
+/* about n chunks of nf frames split at the cuts (as scene_cuts) nearest to even spacing,
+ * evenly where none is close, none shorter than min_frames; 0, the joins, then nf */
+std::vector<int> chunk_bounds(const std::vector<int>& cut, int nf, int n, int min_frames);
+// frames of in in the given order, sharing its memory
+std::shared_ptr<video_buf_map> make_proxy_map(std::shared_ptr<video_buf_map> in, std::vector<int> frames);
+/* the w x h window at x, y of every frame of in, planes point into in's frames with its
+ * strides; x, y even. src() has no contiguous frames to give and returns 0 */
+std::shared_ptr<video_buf_map> make_crop_map(std::shared_ptr<video_buf_map> in, int x, int y, int w, int h);
+/* preview of frame p, contiguous in of, in place over frame n of the whole input, as
+ * video_buf_map::out; plain out(h, w, p, of) if in is not a crop map */
+uint8_t* crop_out(video_buf_map* in, int n, int h, int w, uint8_t* p, const format& of);
+/* in with a copy of its frames per numa node and format, made by the first thread bound to
+ * the node (numa::bind) that reads them, which places the pages there; unbound threads and
+ * nodes past the budget (half the memory available when made) read in's. in itself on a
+ * single node */
+std::shared_ptr<video_buf_map> make_numa_map(std::shared_ptr<video_buf_map> in);
+
 typedef std::string(*p2str_t)(const std::any&);
 typedef int(*str2p_t)(const char**, void*);
 
@@ -122,48 +192,408 @@ typedef std::chrono::time_point<std::chrono::high_resolution_clock> time_point_t
 #define bool_t int
 constexpr bool_t operator"" _b(unsigned long long i) { return bool_t(i); }
 
+// of one frame against its source
+struct frame_quality
+{
+	double sse[3] = {};
+	double ssim = 0; // luma, mean over 8x8 windows at step 4
+	double ms_ssim = 0; // luma
+	bool valid = 0;
+};
+
+// encoder side data of one frame, as reported with the picture
+struct frame_info
+{
+	int poc = -1; // -1 if it was not encoded
+	uint32_t bits = 0;
+	float qp = 0; // average
+	float time = 0; // ms spent in the encoder
+	char type = 0; // I (idr), i, P, B, b (non-reference B)
+};
+
+// coding decisions of one frame per 8x8 block, depth | mode << 2
+struct cu_map
+{
+	enum mode_t { intra, inter, skip };
+	int w = 0, h = 0; // in blocks
+	std::vector<uint8_t> v;
+	int depth(int x, int y) const { return v[y * w + x] & 3; }
+	int mode(int x, int y) const { return v[y * w + x] >> 2; }
+};
+
+// totals since a cpu_meter started
+struct cpu_usage
+{
+	double cpu = 0; // s, 0 if unavailable
+	uint64_t cycles = 0, instructions = 0; // user space, 0 if unavailable
+	int64_t peak_rss = 0; // bytes, growth of the process peak
+};
+
+/* cpu time and counters of the calling thread and of the threads it starts afterwards
+ * (the encoder's), through linux perf events inherited by them; a thread counts once it
+ * exited. cpu stays 0 where the kernel denies them, the calling thread alone would miss
+ * most of the encode */
+class cpu_meter
+{
+	int fd[3] = { -1, -1, -1 }; // task clock, cycles, instructions
+	int64_t rss0 = 0;
+public:
+	cpu_meter();
+	~cpu_meter();
+	cpu_meter(const cpu_meter&) = delete;
+	cpu_meter& operator=(const cpu_meter&) = delete;
+	cpu_usage read() const;
+};
+
+/* restricts the calling thread, and the threads it creates from then on, to the listed cpus
+ * ("0,2-3"); 0 on success, -1 on a bad list or where affinity is unsupported */
+int pin_cpus(const std::string& list);
+
+namespace numa {
+// cpus of each node, from /sys/devices/system/node on linux, else one node of every cpu
+const std::vector<std::vector<int>>& nodes();
+// the cpus split evenly into n nodes instead (shared if fewer), to try placement on one node
+void fake(int n);
+/* restricts the calling thread, and the threads it creates from then on, to the cpus of
+ * node n, which becomes its current(); 0 on success, -1 where affinity is unsupported */
+int bind(int n);
+int current(); // -1 if unbound
+}
+
 struct stats
 {
+	stats() = default;
 	stats(const std::string& str)
 		: str(str)
 	{
 	}
 	std::string str;
-	static std::unique_ptr<stats> default_stats(size_t acc_bytes, double elapsed_encode_time)
+	double bitrate = 0; // kbps
+	double fps = 0;
+	double time = 0; // s
+	double pass_time[2] = {}; // s, wall, a reused first pass counts its own
+	double cpu_time = 0; // s, both passes, 0 if unavailable
+	double cpu_fps = 0; // frames per cpu second, holds while concurrent jobs compete for cores
+	uint64_t cycles = 0, instructions = 0;
+	int64_t rss_delta = 0; // bytes, growth of the process peak during the job
+	double psnr[4] = {}; // y, u, v, all; 0 if not measured
+	double ssim = 0;
+	double ms_ssim = 0;
+	std::vector<frame_quality> frame; // by sof index
+	std::vector<frame_info> info; // by sof index, empty if the encoder reports none
+	std::vector<cu_map> cu; // by sof index, empty unless collected (context::collect_cu)
+	void update_str()
 	{
 		char tmp[1024];
-		int n = sprintf(tmp, "bitrate = %lf, fps = %lf", .001 * acc_bytes * 8 * 24. / enqu::g_nf, enqu::g_nf / elapsed_encode_time);
-		std::string str(tmp, tmp + n);
-		return std::make_unique<stats>(str);
+		int n = sprintf(tmp, "bitrate = %lf, fps = %lf", bitrate, fps);
+		if (cpu_time > 0)
+			n += sprintf(tmp + n, ", cpu fps = %lf", cpu_fps);
+		n += sprintf(tmp + n, "\npass %.2lf + %.2lf s, cpu %.2lf s, rss +%.1lf MiB", pass_time[0], pass_time[1], cpu_time, rss_delta / 1048576.);
+		if (cycles)
+			n += sprintf(tmp + n, ", ipc %.2lf", (double)instructions / cycles);
+		if (psnr[3] > 0)
+			n += sprintf(tmp + n, "\npsnr = %.3lf (y %.3lf, u %.3lf, v %.3lf), ssim = %.5lf, ms-ssim = %.5lf", psnr[3], psnr[0], psnr[1], psnr[2], ssim, ms_ssim);
+		str.assign(tmp, tmp + n);
+	}
+	// speed compared between jobs, per cpu second where measured
+	double speed() const
+	{
+		return cpu_fps > 0 ? cpu_fps : fps;
+	}
+	static std::unique_ptr<stats> default_stats(size_t acc_bytes, double elapsed_encode_time, int nf, double clip_fps)
+	{
+		auto st = std::make_unique<stats>();
+		st->bitrate = .001 * acc_bytes * 8 * clip_fps / nf;
+		st->fps = nf / elapsed_encode_time;
+		st->time = elapsed_encode_time;
+		st->update_str();
+		return st;
+	}
+};
+
+/* score of a search, higher is better
+ * quality: psnr at the bitrate of the key
+ * speed: fps (stats::speed) while psnr >= floor, below it the (negative) shortfall */
+struct objective
+{
+	enum type_t { quality, speed } type = quality;
+	double floor = 0;
+	double score(const stats* st) const
+	{
+		if (!st)
+			return -1e9;
+		if (type == quality)
+			return st->psnr[3];
+		return st->psnr[3] >= floor ? st->speed() : st->psnr[3] - floor;
 	}
 };
 
+// non dominated entries by bitrate (lower), fps and psnr (higher), 0 entries are skipped
+std::vector<bool> pareto_front(const std::vector<const stats*>& st);
+
+/* repeated measurements: median, median absolute deviation and a distribution free confidence
+ * interval of the median between order statistics; level is the coverage reached, below the
+ * one asked when there are too few samples (95% needs 6) */
+struct sample_summary
+{
+	size_t n = 0;
+	double median = 0, mad = 0, lo = 0, hi = 0, level = 0;
+};
+sample_summary summarize(std::vector<double> x, double level = .95);
+// two sided p-value of the mann-whitney u test, exact up to 40 samples in all
+double mann_whitney_p(const std::vector<double>& a, const std::vector<double>& b);
+
+/* process wide metrics, updated lock free from any thread; instances register themselves
+ * by name for the exporter and the resource panel and have static storage */
+struct metric
+{
+	enum type_t { counter, gauge, histogram };
+	const char* name, * help;
+	type_t type;
+	metric(const char* name, const char* help, type_t type);
+	metric(const metric&) = delete;
+	virtual ~metric();
+	// in registration order
+	static std::vector<metric*> all();
+};
+
+struct metric_counter : metric
+{
+	metric_counter(const char* name, const char* help) : metric(name, help, counter) {}
+	void add(uint64_t n = 1) { v.fetch_add(n, std::memory_order_relaxed); }
+	uint64_t get() const { return v.load(std::memory_order_relaxed); }
+private:
+	std::atomic<uint64_t> v = 0;
+};
+
+struct metric_gauge : metric
+{
+	metric_gauge(const char* name, const char* help) : metric(name, help, gauge) {}
+	void add(int64_t n) { v.fetch_add(n, std::memory_order_relaxed); }
+	void set(int64_t n) { v.store(n, std::memory_order_relaxed); }
+	int64_t get() const { return v.load(std::memory_order_relaxed); }
+private:
+	std::atomic<int64_t> v = 0;
+};
+
+// buckets by ascending upper bound, the last one unbounded
+struct metric_histogram : metric
+{
+	const std::vector<double> bounds;
+	metric_histogram(const char* name, const char* help, std::vector<double> bounds);
+	void observe(double x);
+	// cumulative bucket counts, bounds.size() + 1 of them; count and sum
+	void get(std::vector<uint64_t>* bucket, uint64_t* count, double* sum) const;
+private:
+	std::unique_ptr<std::atomic<uint64_t>[]> bucket;
+	std::atomic<uint64_t> count = 0;
+	std::atomic<double> sum = 0;
+};
+
+namespace metrics {
+extern metric_gauge input_bytes, preview_bytes, result_bytes, pool_queued, pool_busy;
+extern metric_counter jobs_done, jobs_failed, jobs_cancelled, frames_encoded, bytes_encoded;
+extern metric_histogram job_seconds, frame_ms;
+}
+
+// prometheus text exposition of every metric
+std::string metrics_text();
+
+class metrics_exporter
+{
+	std::thread worker;
+	std::mutex mutex;
+	std::condition_variable cv;
+	bool stopped = 0;
+	int fd = -1;
+public:
+	~metrics_exporter() { stop(); }
+	/* to: a port number, served over http on 127.0.0.1 (not on windows), else a file
+	 * rewritten every second; 0 on success */
+	int start(const std::string& to);
+	void stop();
+};
+
+/* chrome trace events kept in a ring per thread, the last few thousand of each; off until
+ * enabled, a disabled span costs a relaxed load. names are static strings */
+namespace trace {
+extern std::atomic<bool> on;
+void enable(bool);
+int64_t now(); // us
+void record(const char* name, int64_t begin, int64_t dur, int64_t arg = -1);
+// what the rings hold as trace event json (chrome://tracing, perfetto), 0 on success
+int dump(const std::string& path);
+}
+
+struct trace_span
+{
+	const char* name;
+	int64_t arg, t0 = -1;
+	trace_span(const char* name, int64_t arg = -1)
+		: name(name), arg(arg)
+	{
+		if (trace::on.load(std::memory_order_relaxed))
+			t0 = trace::now();
+	}
+	~trace_span()
+	{
+		if (t0 >= 0)
+			trace::record(name, t0, trace::now() - t0, arg);
+	}
+};
+
+/* result of one job; written by a single worker, read by any thread
+ * state: queued -> pass1 -> pass2 -> done, or -> failed / cancelled (terminal)
+ * buf and f are published once by resize (allocated), each frame by publish (ready[n]),
+ * stats by the transition to done */
 struct res
 {
+	enum state_t { queued, pass1, pass2, done, failed, cancelled };
 	format f;
 	std::unique_ptr<enqu::stats> stats;
 	std::vector<uint8_t*> buf;
-	void resize(int id, std::pair<int, int> size, size_t of_count);
+	int resize(const format& of, size_t of_count);
 	res() = default;
 	~res()
 	{
 		if (!buf.empty())
-			free(buf[0]);
+			free_frames();
 	}
 	bool empty() const
 	{
-		return buf.empty();
+		return !allocated.load(std::memory_order_acquire);
 	}
 	uint8_t** data()
 	{
 		return buf.data();
 	}
+	int get_state() const
+	{
+		return state.load(std::memory_order_acquire);
+	}
+	// fails once terminal (done, failed, cancelled)
+	bool set_state(int s)
+	{
+		int x = state.load(std::memory_order_relaxed);
+		do
+		{
+			if (x >= done)
+				return 0;
+		} while (!state.compare_exchange_weak(x, s, std::memory_order_acq_rel));
+		return 1;
+	}
+	bool cancel()
+	{
+		return set_state(cancelled);
+	}
+	void publish(size_t n)
+	{
+		ready[n].store(1, std::memory_order_release);
+		nready.fetch_add(1, std::memory_order_relaxed);
+	}
+	// 0 until frame n is written
+	uint8_t* frame(size_t n) const
+	{
+		if (empty() || n >= buf.size() || !ready[n].load(std::memory_order_acquire))
+			return 0;
+		return buf[n];
+	}
+	int ready_count() const
+	{
+		return nready.load(std::memory_order_relaxed);
+	}
+	// by the worker before done, for entries no reader displays frames of
+	void drop_frames()
+	{
+		allocated.store(0, std::memory_order_release);
+		if (!buf.empty())
+			free_frames();
+		buf.clear();
+	}
+	// 0 until done
+	const enqu::stats* get_stats() const
+	{
+		return get_state() == done ? stats.get() : 0;
+	}
+	static const char* state_name(int s)
+	{
+		static const char* name[] = { "queued", "pass 1", "pass 2", "done", "failed", "cancelled" };
+		return name[s];
+	}
+private:
+	void free_frames()
+	{
+		free(buf[0]);
+		metrics::result_bytes.add(-(int64_t)(f.frame_size() * buf.size()));
+	}
+	std::atomic<int> state = queued;
+	std::atomic<bool> allocated = 0;
+	std::unique_ptr<std::atomic<bool>[]> ready;
+	std::atomic<int> nready = 0;
+};
+
+/* key -> res; entries are shared so workers and readers pin them across clear() */
+template< typename K>
+class res_store
+{
+	mutable std::shared_mutex mutex;
+	std::map<K, std::shared_ptr<res>> map;
+public:
+	std::shared_ptr<res> find(const K& k) const
+	{
+		std::shared_lock lock(mutex);
+		auto it = map.find(k);
+		return it == map.end() ? nullptr : it->second;
+	}
+	// inserts a fresh entry if k is absent, failed or cancelled; second is true if inserted
+	std::pair<std::shared_ptr<res>, bool> try_emplace(const K& k)
+	{
+		std::unique_lock lock(mutex);
+		auto t = map.try_emplace(k);
+		std::shared_ptr<res>& r = t.first->second;
+		if (!t.second && r->get_state() < res::failed)
+			return { r, false };
+		r = std::make_shared<res>();
+		return { r, true };
+	}
+	// a fresh entry for k in any case, the one it replaces is cancelled
+	std::shared_ptr<res> replace(const K& k)
+	{
+		std::unique_lock lock(mutex);
+		std::shared_ptr<res>& r = map[k];
+		if (r)
+			r->cancel();
+		r = std::make_shared<res>();
+		return r;
+	}
+	// cancels pending entries, running jobs stop at the next frame
+	void clear()
+	{
+		std::unique_lock lock(mutex);
+		for (auto& _ : map)
+			_.second->cancel();
+		map.clear();
+	}
+	size_t size() const
+	{
+		std::shared_lock lock(mutex);
+		return map.size();
+	}
+	template< typename F>
+	void for_each(F f) const
+	{
+		std::shared_lock lock(mutex);
+		for (auto& _ : map)
+			f(_.first, *_.second);
+	}
 };
 
 struct key
 {
 	virtual bool operator<(const key&) const = 0;
-	//	virtual ~key() = default;
+	// "name=value" of every field, what cost_model learns on
+	virtual std::vector<std::string> features() const { return {}; }
+	virtual ~key() = default;
 };
 
 template< typename T>
@@ -190,23 +620,58 @@ struct tuple_key_t : key
 
 class threadpool;
 struct context;
+
+/* encode seconds of a job predicted from its key (key::features) and the pixels it encodes,
+ * learned online from the jobs done: log seconds per pixel as a bias plus a weight per field
+ * value, normalized lms steps that move the prediction of each job learned halfway to what it
+ * took. values not seen yet add nothing; before the first job about 5 Mpixel/s */
+class cost_model
+{
+	std::mutex mutex;
+	double bias = std::log(2e-7);
+	std::map<std::string, double> w;
+	std::vector<double> err; // |log(predicted / taken)| of each job learned after the first
+	size_t n = 0;
+	double log_predict(const std::vector<std::string>& features) const;
+public:
+	double predict(const context&);
+	void learn(const context&, double seconds);
+	// median factor between predicted and taken, 0 until two jobs are learned
+	double error();
+};
+
 struct encoder
 {
 	const char* name = 0;
 	int err = 0;
 	std::string err_detail;
-	bool m_abort = 0;
+	std::atomic<bool> m_abort = 0;
+	bool lockstep = 0; // encodes context::lockstep groups, else they are not to be formed
+	cost_model cost; // of its jobs, learned by the pool
 	virtual int encode(context*, threadpool*) = 0;
 	virtual ~encoder() = default;
 };
 
+/* one job; owns a copy of its key and pins its result and input */
 struct context
 {
-	const key* k;
-	res& r;
+	std::unique_ptr<const key> k;
+	std::shared_ptr<res> r;
 	encoder* e;
-	context(const key* k, res& r, encoder* e)
-		: k(k), r(r), e(e)
+	std::shared_ptr<video_buf_map> in;
+	std::vector<int> sof;
+	std::function<void(context*)> notify; // on the worker, once the job left the pool
+	bool keep_frames = 1; // else only stats survive the job
+	bool collect_cu = 0; // block level decisions into stats::cu, costs pass 2 some time
+	int64_t queued = -1; // trace::now() when pushed, if tracing
+	double cost = 0; // predicted seconds, with its lockstep group; set when pushed
+	bool share_first_pass = 1; // else runs its own, so that it is timed
+	bool measure = 1; // quality per frame, its thread competes with the encoder for cpu
+	// jobs on the same input and frames encoded along with this one, each frame fed to all
+	// encoders in turn (encoder::lockstep); notified after it
+	std::vector<std::unique_ptr<context>> lockstep;
+	context(std::unique_ptr<const key> k, std::shared_ptr<res> r, encoder* e, std::shared_ptr<video_buf_map> in, const std::vector<int>& sof)
+		: k(std::move(k)), r(std::move(r)), e(e), in(std::move(in)), sof(sof)
 	{
 	}
 };
@@ -217,8 +682,25 @@ class threadpool// : public QThread
 	std::condition_variable v;
 	std::mutex mutex;
 	std::vector<std::thread> worker;
-	std::queue<std::unique_ptr<context>> q;
+	std::deque<std::unique_ptr<context>> q;
+	std::condition_variable idle;
+	size_t busy = 0;
 	bool keep_alive = 0;
+	bool sjf = 0;
+	struct running_t
+	{
+		std::vector<const res*> r;
+		double cost;
+		int64_t start;
+	};
+	std::list<running_t> running;
+	// the queued job to run next
+	size_t next() const
+	{
+		if (!sjf)
+			return 0;
+		return std::min_element(q.begin(), q.end(), [](auto& a, auto& b) { return a->cost < b->cost; }) - q.begin();
+	}
 	//Q_SIGNALS:
 	//void progress_report();
 public:
@@ -229,15 +711,22 @@ public:
 	{
 		stop();
 	}
-	void start(size_t n)
+	// numa: workers bound to the nodes in turn (numa::bind), with the encoders they start
+	void start(size_t n, bool numa = 0)
 	{
-		keep_alive = 1;
+		{
+			std::lock_guard lock(mutex);
+			keep_alive = 1;
+		}
 		for (size_t i = worker.size(); i < n; i++)
-			worker.emplace_back(std::bind(&threadpool::thread, this));
+			worker.emplace_back(std::bind(&threadpool::thread, this, numa ? (int)(i % numa::nodes().size()) : -1));
 	}
 	void stop()
 	{
-		keep_alive = 0;
+		{
+			std::lock_guard lock(mutex);
+			keep_alive = 0;
+		}
 		v.notify_all();
 		for (std::thread& _ : worker)
 			_.join();
@@ -245,34 +734,171 @@ public:
 	}
 	void push(std::unique_ptr<context> ctx)
 	{
+		if (trace::on.load(std::memory_order_relaxed))
+			ctx->queued = trace::now();
+		ctx->cost = ctx->e->cost.predict(*ctx);
+		for (auto& _ : ctx->lockstep)
+			ctx->cost += ctx->e->cost.predict(*_);
 		std::unique_lock lock(mutex);
-		q.push(std::move(ctx));
+		q.push_back(std::move(ctx));
+		metrics::pool_queued.add(1);
 		v.notify_one();
 	}
+	// blocks until at most pending jobs are queued or running
+	void wait(size_t pending = 0)
+	{
+		std::unique_lock lock(mutex);
+		idle.wait(lock, [this, pending] { return q.size() + busy <= pending; });
+	}
+	size_t pending()
+	{
+		std::lock_guard lock(mutex);
+		return q.size() + busy;
+	}
+	size_t size()
+	{
+		std::lock_guard lock(mutex);
+		return worker.size();
+	}
+	// shortest predicted job first (context::cost) instead of in order
+	void set_sjf(bool x)
+	{
+		std::lock_guard lock(mutex);
+		sjf = x;
+	}
+	/* seconds until each running and queued job is done, their predicted costs dealt to the
+	 * workers in the order they would run; by result, lockstep members as their group */
+	std::map<const res*, double> eta()
+	{
+		std::lock_guard lock(mutex);
+		int64_t t = trace::now();
+		std::map<const res*, double> _;
+		std::priority_queue<double, std::vector<double>, std::greater<double>> free; // worker free in
+		for (auto& r : running)
+		{
+			double left = std::max(0., r.cost - (t - r.start) * 1e-6);
+			free.push(left);
+			for (const res* x : r.r)
+				_[x] = left;
+		}
+		while (free.size() < worker.size())
+			free.push(0);
+		std::vector<const context*> order;
+		for (auto& ctx : q)
+			order.push_back(ctx.get());
+		if (sjf)
+			std::stable_sort(order.begin(), order.end(), [](auto a, auto b) { return a->cost < b->cost; });
+		for (const context* ctx : order)
+		{
+			double done = (free.empty() ? 0 : free.top()) + ctx->cost;
+			if (!free.empty())
+				free.pop();
+			free.push(done);
+			_[ctx->r.get()] = done;
+			for (auto& x : ctx->lockstep)
+				_[x->r.get()] = done;
+		}
+		return _;
+	}
 private:
-	void thread()
+	void thread(int node)
 	{
-		std::unique_lock lock(mutex, std::defer_lock);
-		for (; keep_alive;)
+		if (node >= 0)
+			numa::bind(node);
+		for (;;)
 		{
-			lock.lock();
-			if (q.empty())
+			std::unique_lock lock(mutex);
+			v.wait(lock, [this] { return !keep_alive || !q.empty(); });
+			if (!keep_alive)
+				break;
+			size_t i = next();
+			std::unique_ptr<context> ctx = std::move(q[i]);
+			q.erase(q.begin() + i);
+			auto run = running.insert(running.end(), { { ctx->r.get() }, ctx->cost, trace::now() });
+			for (auto& _ : ctx->lockstep)
+				run->r.push_back(_->r.get());
+			busy++;
+			metrics::pool_queued.add(-1);
+			metrics::pool_busy.add(1);
+			lock.unlock();
+			if (ctx->queued >= 0)
+				trace::record("queued", ctx->queued, trace::now() - ctx->queued);
 			{
-				v.wait(lock);
-				if (!keep_alive)
-				{
-					lock.unlock();
-					break;
-				}
+				trace_span span("job");
+				if (ctx->e->encode(ctx.get(), this))
+					ctx->r->set_state(res::failed);
 			}
-			std::unique_ptr<context> ctx = std::move(q.front());
-			q.pop();
-			lock.unlock();
-			ctx->e->encode(ctx.get(), this);
+			// a lockstep member's time is its group's
+			if (const stats* st = ctx->r->get_stats(); st && ctx->lockstep.empty() && ctx->r->get_state() == res::done)
+				ctx->e->cost.learn(*ctx, st->time);
+			std::vector<context*> group = { ctx.get() };
+			for (auto& _ : ctx->lockstep)
+				group.push_back(_.get());
+			for (context* c : group)
+			{
+				int s = c->r->get_state();
+				(s == res::done ? metrics::jobs_done : s == res::failed ? metrics::jobs_failed : metrics::jobs_cancelled).add();
+				if (c->notify)
+					c->notify(c);
+			}
+			ctx.reset();
+			lock.lock();
+			running.erase(run);
+			--busy;
+			metrics::pool_busy.add(-1);
+			idle.notify_all();
 		}
 	}
 };
 
+/* blocks a thread on a set of jobs of a shared pool; the state outlives the jobs notifying it,
+ * stop() releases the waiter and cancels what it waits for */
+class batch
+{
+	struct state_t
+	{
+		std::mutex mutex;
+		std::condition_variable cv;
+		bool stopped = 0;
+	};
+	std::shared_ptr<state_t> s = std::make_shared<state_t>();
+public:
+	void push(threadpool* pool, std::unique_ptr<context> ctx)
+	{
+		ctx->notify = [s = s](context*)
+		{
+			std::lock_guard lock(s->mutex);
+			s->cv.notify_all();
+		};
+		pool->push(std::move(ctx));
+	}
+	// until every r is terminal, -1 once stopped
+	int wait(const std::vector<std::shared_ptr<res>>& r)
+	{
+		std::unique_lock lock(s->mutex);
+		s->cv.wait(lock, [&]
+		{
+			return s->stopped || std::all_of(r.begin(), r.end(), [](auto& _) { return _->get_state() >= res::done; });
+		});
+		if (!s->stopped)
+			return 0;
+		for (auto& _ : r)
+			_->cancel();
+		return -1;
+	}
+	void stop()
+	{
+		std::lock_guard lock(s->mutex);
+		s->stopped = 1;
+		s->cv.notify_all();
+	}
+	bool stopped() const
+	{
+		std::lock_guard lock(s->mutex);
+		return s->stopped;
+	}
+};
+
 typedef struct par
 {
 	const char* name;
@@ -290,14 +916,22 @@ struct ctrl
 	std::unique_ptr<encoder> e;
 	virtual size_t size() const = 0;
 	virtual std::unique_ptr<key> keygen(size_t) const = 0;
+	// one value per line, -1 with error_msg set and v left as is if a line does not parse
 	template< typename T>
-	void update_params_impl(size_t stride, size_t* c, std::vector<std::any>& v, const par_t& p, const char* str)
+	int update_params_impl(size_t stride, size_t* c, std::vector<std::any>& v, const par_t& p, const char* str)
 	{
 		std::vector<T> _;
+		error_msg[0] = 0;
 		for (T x; *str && p.str2p(&str, &x);)
 			_.emplace_back(x);
+		if (*str)
+		{
+			if (!error_msg[0])
+				snprintf(error_msg, sizeof(error_msg), "[%s] bad value %.*s", p.name, (int)strcspn(str, "\n"), str);
+			return -1;
+		}
 		if (_.empty())
-			return;
+			return 0;
 		std::sort(_.begin(), _.end());
 		_.erase(std::unique(_.begin(), _.end()), _.end());
 		for (size_t i = 0; i < 3; i++)
@@ -314,6 +948,7 @@ struct ctrl
 		v.clear();
 		for (size_t i = 0; i < _.size(); i++)
 			v.emplace_back(T(_[i]));
+		return 0;
 	}
 	virtual void update(int) = 0;
 	virtual void show() {}
@@ -326,41 +961,4 @@ protected:
 	static void default_hide(Args...);
 };
 
-class layout
-{
-	QTabWidget* stack;
-public:
-	layout(QTabWidget* stack) : stack(stack) {}
-	virtual int pixmap_update(int) = 0;
-	virtual void input_changed() = 0;
-	virtual bool event(QObject*, QEvent*) = 0;
-	virtual ~layout() { clear(); }
-	void clear()
-	{
-		while (stack->count())
-			delete stack->widget(0);
-	}
-};
-
-class elabel : public QLabel
-{
-	Q_OBJECT
-public:
-	elabel(QWidget* parent = nullptr)
-		: QLabel(parent)
-	{
-	}
-Q_SIGNALS:
-	void pressed();
-protected:
-	void mousePressEvent(QMouseEvent*) override
-	{
-		Q_EMIT pressed();
-	}
-};
-
-extern format g_f, g_of;
-extern std::unique_ptr<video_buf_map> g_buf;
-extern std::unique_ptr<layout> g_layout;
-
 }
@@ -0,0 +1,244 @@
+#include "enqu.h"
+#include "enqu_x265.h"
+#include "enqu_api.h"
+
+namespace enqu {
+
+/* frames owned by the embedder, read in place; only its own format is available,
+ * there is no script core to convert through */
+struct video_buf_map_ext : video_buf_map
+{
+	std::shared_mutex mutex;
+	std::vector<std::array<uint8_t*, 3>> p;
+	std::vector<std::array<int, 3>> stride;
+	video_buf_map_ext(const format& f, int nf)
+		: p(nf), stride(nf)
+	{
+		this->f = f;
+		this->nf = nf;
+	}
+	uint8_t** src(const format&) { return 0; }
+	uint8_t* out(int, int, int) { return 0; }
+	uint8_t* out(int, int, uint8_t*, const format&) { return 0; }
+	int get_format(int id, format* of)
+	{
+		if (id != f.id)
+			return -1;
+		*of = f;
+		return 0;
+	}
+	int planes(const format& of, int n, uint8_t** p_, int* stride_)
+	{
+		if (of.id != f.id || n < 0 || n >= nf)
+			return -1;
+		std::shared_lock lock(mutex);
+		if (!p[n][0])
+			return -1;
+		std::copy_n(p[n].begin(), 3, p_);
+		std::copy_n(stride[n].begin(), 3, stride_);
+		return 0;
+	}
+	void set(int n, const void* const* planes, const int* stride_)
+	{
+		std::unique_lock lock(mutex);
+		for (int i = 0; i < 3; i++)
+		{
+			p[n][i] = i < f.np ? (uint8_t*)planes[i] : 0;
+			stride[n][i] = i < f.np ? stride_[i] : 0;
+		}
+	}
+};
+
+}
+
+using namespace enqu;
+
+struct enqu_session
+{
+	x265_params x;
+	std::shared_ptr<video_buf_map_ext> in;
+	std::vector<int> sof;
+	res_store<x265_key> q;
+	std::vector<std::shared_ptr<res>> jobs;
+	std::mutex mutex;
+	std::condition_variable changed;
+	threadpool pool;
+	std::shared_ptr<res> job(int i)
+	{
+		std::lock_guard lock(mutex);
+		return i >= 0 && i < jobs.size() ? jobs[i] : nullptr;
+	}
+};
+
+int enqu_version(void)
+{
+	return ENQU_VERSION;
+}
+
+enqu_session* enqu_session_create(int threads)
+{
+	auto s = std::make_unique<enqu_session>();
+	if (s->x.err)
+		return 0;
+	s->pool.start(threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency()));
+	return s.release();
+}
+
+void enqu_session_destroy(enqu_session* s)
+{
+	if (!s)
+		return;
+	s->q.clear();
+	s->pool.stop();
+	delete s;
+}
+
+int enqu_set_input(enqu_session* s, int width, int height, int bit_depth, int planes, int subsampling, int num_frames)
+{
+	if (!s || width <= 0 || height <= 0 || (bit_depth != 8 && bit_depth != 10 && bit_depth != 12) || (planes != 1 && planes != 3)
+		|| subsampling < 0 || subsampling > 1 || num_frames <= 0)
+		return -1;
+	format f;
+	f.id = 0; // not a script format, keys of this session all carry it
+	f.h = height;
+	f.w = width;
+	f.bit_depth = bit_depth;
+	f.np = planes;
+	f.ssx = planes == 1 ? 0 : subsampling;
+	std::lock_guard lock(s->mutex);
+	if (!s->jobs.empty())
+		return -1;
+	s->in = std::make_shared<video_buf_map_ext>(f, num_frames);
+	s->sof.resize(num_frames);
+	for (int n = 0; n < num_frames; n++)
+		s->sof[n] = n;
+	return 0;
+}
+
+int enqu_register_frame(enqu_session* s, int n, const void* const* planes, const int* stride)
+{
+	if (!s || !planes || !stride)
+		return -1;
+	std::shared_ptr<video_buf_map_ext> in;
+	{
+		std::lock_guard lock(s->mutex);
+		in = s->in;
+	}
+	if (!in || n < 0 || n >= in->nf)
+		return -1;
+	for (int i = 0; i < in->f.np; i++)
+		if (!planes[i] || stride[i] <= 0)
+			return -1;
+	in->set(n, planes, stride);
+	return 0;
+}
+
+int enqu_submit(enqu_session* s, const char* params)
+{
+	if (!s)
+		return -1;
+	std::unique_lock lock(s->mutex);
+	if (!s->in)
+		return -1;
+	x265_params& x = s->x;
+	for (auto& _ : x.v)
+		_.clear();
+	x265_key::defaults(x.v);
+	if (params && x.parse(params))
+		return -1;
+	for (int i = 0; i < x265_key::tuple_size; i++)
+		if (i != x265_key::format_id && x.v[i].size() != 1)
+			return -1;
+	size_t c[x265_key::tuple_size] = {};
+	x265_key k(x265_key::keygen_impl(c, x.v, std::make_index_sequence<x265_key::tuple_size>{}));
+	std::get<x265_key::format_id>(k._) = s->in->f.id;
+	auto t = s->q.try_emplace(k);
+	int job = (int)s->jobs.size();
+	s->jobs.push_back(t.first);
+	if (t.second)
+	{
+		std::unique_ptr<context> ctx = k.ctx(t.first, x.e.get(), s->in, s->sof);
+		ctx->notify = [s](context*)
+		{
+			std::lock_guard lock(s->mutex);
+			s->changed.notify_all();
+		};
+		s->pool.push(std::move(ctx));
+	}
+	return job;
+}
+
+int enqu_state(enqu_session* s, int job)
+{
+	std::shared_ptr<res> r = s ? s->job(job) : nullptr;
+	return r ? r->get_state() : -1;
+}
+
+int enqu_wait(enqu_session* s, int job, int timeout_ms)
+{
+	if (!s)
+		return -1;
+	std::unique_lock lock(s->mutex);
+	if (job >= (int)s->jobs.size())
+		return -1;
+	auto finished = [&]
+	{
+		if (job >= 0)
+			return s->jobs[job]->get_state() >= res::done;
+		return std::all_of(s->jobs.begin(), s->jobs.end(), [](auto& r) { return r->get_state() >= res::done; });
+	};
+	if (timeout_ms < 0)
+		s->changed.wait(lock, finished);
+	else if (!s->changed.wait_for(lock, std::chrono::milliseconds(timeout_ms), finished))
+		return 1;
+	return 0;
+}
+
+int enqu_cancel(enqu_session* s, int job)
+{
+	std::shared_ptr<res> r = s ? s->job(job) : nullptr;
+	if (!r)
+		return -1;
+	r->cancel();
+	return 0;
+}
+
+int enqu_get_stats(enqu_session* s, int job, enqu_stats* st)
+{
+	std::shared_ptr<res> r = s ? s->job(job) : nullptr;
+	if (!r || !st || st->size < offsetof(enqu_stats, ms_ssim))
+		return -1;
+	st->state = r->get_state();
+	const stats* _ = r->get_stats();
+	if (!_)
+		return -1;
+	st->bitrate = _->bitrate;
+	st->fps = _->fps;
+	st->time = _->time;
+	st->psnr_y = _->psnr[0];
+	st->psnr_u = _->psnr[1];
+	st->psnr_v = _->psnr[2];
+	st->psnr = _->psnr[3];
+	st->ssim = _->ssim;
+	if (st->size >= offsetof(enqu_stats, cpu_time))
+		st->ms_ssim = _->ms_ssim;
+	if (st->size >= sizeof(enqu_stats))
+	{
+		st->cpu_time = _->cpu_time;
+		st->cpu_fps = _->cpu_fps;
+	}
+	return 0;
+}
+
+int enqu_get_frame(enqu_session* s, int job, int n, const void** planes, int* stride)
+{
+	std::shared_ptr<res> r = s ? s->job(job) : nullptr;
+	uint8_t* frame;
+	if (!r || !planes || !stride || n < 0 || !(frame = r->frame(n)))
+		return -1;
+	uint8_t* p[3];
+	r->f.planes(frame, p, stride);
+	for (int i = 0; i < r->f.np; i++)
+		planes[i] = p[i];
+	return 0;
+}
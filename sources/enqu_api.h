@@ -0,0 +1,83 @@
+#ifndef ENQU_API_H
+#define ENQU_API_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#if defined(ENQU_API_EXPORTS)
+#define ENQU_API __declspec(dllexport)
+#else
+#define ENQU_API __declspec(dllimport)
+#endif
+#else
+#define ENQU_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* embeddable x265 encoder comparison
+ *
+ * a session owns its input, worker threads and results, sessions are independent
+ * and every call is thread safe. input frames are registered by pointer and read
+ * in place by the encoders (no copy), they must stay valid until the jobs reading
+ * them are done or the session is destroyed.
+ * functions returning int give a negative value on error. */
+
+#define ENQU_VERSION 3
+
+/* job states */
+#define ENQU_QUEUED 0
+#define ENQU_PASS1 1
+#define ENQU_PASS2 2
+#define ENQU_DONE 3
+#define ENQU_FAILED 4
+#define ENQU_CANCELLED 5
+
+typedef struct enqu_session enqu_session;
+
+typedef struct enqu_stats
+{
+	size_t size; /* sizeof(enqu_stats), set by the caller */
+	int state;
+	double bitrate; /* kbps */
+	double fps;
+	double time; /* s */
+	double psnr_y, psnr_u, psnr_v, psnr;
+	double ssim;
+	double ms_ssim; /* since version 2 */
+	double cpu_time; /* s, of the encoder threads, 0 if unavailable; since version 3 */
+	double cpu_fps; /* frames per cpu second, unaffected by concurrent jobs */
+} enqu_stats;
+
+ENQU_API int enqu_version(void);
+
+/* threads <= 0 uses every core, 0 on failure */
+ENQU_API enqu_session* enqu_session_create(int threads);
+/* cancels pending jobs and waits for running ones */
+ENQU_API void enqu_session_destroy(enqu_session* s);
+
+/* planar integer input of bit_depth 8, 10 or 12, planes 1 (gray) or 3 (yuv), subsampling 0 (444) or 1 (420),
+ * taken as 24000/1001 fps; resets the registered frames, fails once jobs were submitted */
+ENQU_API int enqu_set_input(enqu_session* s, int width, int height, int bit_depth, int planes, int subsampling, int num_frames);
+/* frame n, stride in bytes per plane, samples of bit_depth > 8 are 16 bit */
+ENQU_API int enqu_register_frame(enqu_session* s, int n, const void* const* planes, const int* stride);
+
+/* params as in enqu-cli, [name] followed by one value, unset fields keep their defaults
+ * and format follows the input; returns the job id */
+ENQU_API int enqu_submit(enqu_session* s, const char* params);
+ENQU_API int enqu_state(enqu_session* s, int job);
+/* job < 0 waits for every job, timeout_ms < 0 waits forever; 1 on timeout */
+ENQU_API int enqu_wait(enqu_session* s, int job, int timeout_ms);
+ENQU_API int enqu_cancel(enqu_session* s, int job);
+/* stats->size must be set, fields past it are left alone; fails until the job is done */
+ENQU_API int enqu_get_stats(enqu_session* s, int job, enqu_stats* stats);
+/* reconstructed frame n, valid while the session lives; fails until the frame is ready */
+ENQU_API int enqu_get_frame(enqu_session* s, int job, int n, const void** planes, int* stride);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
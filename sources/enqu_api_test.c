@@ -0,0 +1,74 @@
+/* smoke test of libenqu: a session without vapoursynth encodes a few synthetic frames,
+ * reports stats and gives back reconstructions of the input's size; fails on any error or crash */
+#include "enqu_api.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define W 64
+#define H 64
+#define NF 4
+
+static uint8_t y[NF][W * H], u[NF][W * H / 4], v[NF][W * H / 4];
+
+static int fail(enqu_session* s, const char* what)
+{
+	fprintf(stderr, "%s\n", what);
+	enqu_session_destroy(s);
+	return 1;
+}
+
+int main(void)
+{
+	enqu_session* s = enqu_session_create(1);
+	if (!s)
+		return fprintf(stderr, "enqu_session_create\n"), 1;
+	if (enqu_set_input(s, W, H, 9, 3, 1, NF) >= 0)
+		return fail(s, "enqu_set_input accepted 9 bits");
+	if (enqu_set_input(s, W, H, 8, 3, 1, NF) < 0)
+		return fail(s, "enqu_set_input");
+	for (int n = 0; n < NF; n++)
+	{
+		for (int i = 0; i < W * H; i++)
+			y[n][i] = (uint8_t)(i % W * 2 + i / W + n * 3);
+		for (int i = 0; i < W * H / 4; i++)
+			u[n][i] = v[n][i] = 128;
+		const void* planes[3] = { y[n], u[n], v[n] };
+		int stride[3] = { W, W / 2, W / 2 };
+		if (enqu_register_frame(s, n, planes, stride) < 0)
+			return fail(s, "enqu_register_frame");
+	}
+	int job = enqu_submit(s, "[bitrate]\n400\n");
+	if (job < 0)
+		return fail(s, "enqu_submit");
+	if (enqu_wait(s, job, 60000))
+		return fail(s, "enqu_wait");
+	int state = enqu_state(s, job);
+	printf("state %d\n", state);
+	if (state != ENQU_DONE)
+		return fail(s, "job not done");
+	enqu_stats st = { sizeof(st) };
+	if (enqu_get_stats(s, job, &st) < 0 || !(st.bitrate > 0))
+		return fail(s, "enqu_get_stats");
+	printf("bitrate %.1f psnr %.2f\n", st.bitrate, st.psnr);
+	const void* planes[3];
+	int stride[3];
+	if (enqu_get_frame(s, job, NF - 1, planes, stride) < 0)
+		return fail(s, "enqu_get_frame");
+	if (stride[0] < W || stride[1] < W / 2 || stride[2] < W / 2)
+		return fail(s, "enqu_get_frame: planes smaller than the input");
+	// a reconstruction of the last frame, not of another one or garbage
+	long err = 0;
+	for (int i = 0; i < H; i++)
+		for (int j = 0; j < W; j++)
+		{
+			int d = ((const uint8_t*)planes[0])[i * stride[0] + j] - y[NF - 1][i * W + j];
+			err += d < 0 ? -d : d;
+		}
+	if (err > 8L * W * H)
+		return fail(s, "enqu_get_frame: not the input's last frame");
+	if (enqu_get_frame(s, job, NF, planes, stride) >= 0)
+		return fail(s, "enqu_get_frame past the last frame");
+	enqu_session_destroy(s);
+	return 0;
+}
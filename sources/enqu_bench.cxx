@@ -0,0 +1,365 @@
+#include "enqu.h"
+#include "enqu_x265.h"
+
+namespace enqu {
+
+static void usage()
+{
+	fprintf(stderr,
+		"enqu-bench [-o out.json] [-r repeats] [-f filter]\n"
+		"  -o file        json output (default: stdout)\n"
+		"  -r n           timed batches per case, the median is reported (default: 7)\n"
+		"  -f filter      only cases whose name contains filter\n");
+}
+
+static volatile size_t sink;
+
+struct bench_result
+{
+	std::string name;
+	size_t iterations; // per batch
+	double median, min; // ns per iteration
+	double bytes; // per iteration, 0 if not a throughput
+};
+
+struct bench
+{
+	std::vector<bench_result> results;
+	std::vector<std::string> skipped;
+	std::string filter;
+	int repeats = 7;
+	bool wanted(const std::string& name) const
+	{
+		return name.find(filter) != std::string::npos;
+	}
+	// batches grow until one lasts 10ms, then the same batch is timed repeats times
+	template< typename F>
+	void run(const std::string& name, double bytes, F f)
+	{
+		if (!wanted(name))
+			return;
+		auto batch = [&](size_t n)
+		{
+			auto t0 = std::chrono::steady_clock::now();
+			for (size_t i = 0; i < n; i++)
+				f(i);
+			return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+		};
+		size_t n = 1;
+		while (batch(n) < 1e7 && n < (1ull << 30))
+			n *= 2;
+		std::vector<double> t(repeats);
+		for (double& _ : t)
+			_ = batch(n) / n;
+		std::sort(t.begin(), t.end());
+		results.push_back({ name, n, t[t.size() / 2], t[0], bytes });
+		fprintf(stderr, "%-48s %12.1lf ns\n", name.c_str(), t[t.size() / 2]);
+	}
+	void skip(const std::string& name)
+	{
+		if (wanted(name))
+			skipped.push_back(name);
+	}
+	void write(FILE* fp) const
+	{
+		fprintf(fp, "{\n\"context\": {\"compiler\": \"%s\", \"threads\": %u, \"repeats\": %d},\n\"benchmarks\": [\n",
+#ifdef __VERSION__
+			__VERSION__,
+#else
+			"",
+#endif
+			std::thread::hardware_concurrency(), repeats);
+		for (size_t i = 0; i < results.size(); i++)
+		{
+			const bench_result& r = results[i];
+			fprintf(fp, "{\"name\": \"%s\", \"iterations\": %zu, \"ns_median\": %.3lf, \"ns_min\": %.3lf", r.name.c_str(), r.iterations, r.median, r.min);
+			if (r.bytes > 0)
+				fprintf(fp, ", \"bytes_per_second\": %.0lf", r.bytes / r.median * 1e9);
+			fprintf(fp, "}%s\n", i + 1 < results.size() ? "," : "");
+		}
+		fprintf(fp, "],\n\"skipped\": [");
+		for (size_t i = 0; i < skipped.size(); i++)
+			fprintf(fp, "%s\"%s\"", i ? ", " : "", skipped[i].c_str());
+		fprintf(fp, "]\n}\n");
+	}
+};
+
+struct bench_format
+{
+	const char* name;
+	int id, bit_depth, np, ssx;
+};
+
+static const bench_format formats[] = {
+	{ "YUV420P8", pfYUV420P8, 8, 3, 1 },
+	{ "YUV420P10", pfYUV420P10, 10, 3, 1 },
+	{ "YUV444P10", pfYUV444P10, 10, 3, 0 },
+	{ "Gray8", pfGray8, 8, 1, 0 },
+};
+
+// aligned rows and rows with a tail, as vapoursynth pads strides to 32 bytes
+static const std::pair<int, int> sizes[] = { { 640, 360 }, { 1000, 562 }, { 1920, 1080 }, { 3840, 2160 } };
+
+static format make_format(const bench_format& bf, int w, int h)
+{
+	format f;
+	f.id = bf.id, f.h = h, f.w = w, f.bit_depth = bf.bit_depth, f.np = bf.np, f.ssx = bf.ssx;
+	return f;
+}
+
+static std::string case_name(const char* what, const format& f, const char* fmt)
+{
+	char tmp[128];
+	sprintf(tmp, "%s/%dx%d/%s", what, f.w, f.h, fmt);
+	return tmp;
+}
+
+// same bytes on every run, so results compare between builds
+static void fill(uint8_t* p, size_t n, int bit_depth)
+{
+	uint32_t x = 12345;
+	if (bit_depth > 8)
+		for (size_t i = 0; i < n / 2; i++)
+			reinterpret_cast<uint16_t*>(p)[i] = (x = x * 1664525 + 1013904223) >> (32 - bit_depth);
+	else
+		for (size_t i = 0; i < n; i++)
+			p[i] = (x = x * 1664525 + 1013904223) >> 24;
+}
+
+static void bench_copy(bench& b)
+{
+	for (auto [w, h] : sizes)
+		for (const bench_format& bf : formats)
+		{
+			format f = make_format(bf, w, h);
+			int bps = (f.bit_depth + 7) >> 3;
+			// planes with padded strides as an encoder or vapoursynth hands them out
+			std::vector<uint8_t> frame(f.frame_size()), planes[3];
+			uint8_t* pp[3] = {};
+			int stride[3] = {};
+			for (int p = 0; p < f.np; p++)
+			{
+				int pw = p ? w >> f.ssx : w, ph = p ? h >> f.ssx : h;
+				stride[p] = (pw * bps + 63) & ~63;
+				planes[p].resize((size_t)stride[p] * ph);
+				fill(planes[p].data(), planes[p].size(), f.bit_depth);
+				pp[p] = planes[p].data();
+			}
+			copy_f c = bps > 1 ? copy<uint16_t> : copy<uint8_t>, cs = bps > 1 ? copy_s<uint16_t> : copy_s<uint8_t>;
+			plane_copy_f pc = bps > 1 ? plane_copy<uint16_t> : plane_copy<uint8_t>, pcs = bps > 1 ? plane_copy_s<uint16_t> : plane_copy_s<uint8_t>;
+			double bytes = (double)f.frame_size();
+			b.run(case_name("copy", f, bf.name), bytes, [&](size_t)
+			{
+				c(f.h, f.w, f.np, f.ssx, f.ssx, frame.data(), pp, stride);
+			});
+			b.run(case_name("copy_s", f, bf.name), bytes, [&](size_t)
+			{
+				cs(f.h, f.w, f.np, f.ssx, f.ssx, frame.data(), pp, stride);
+			});
+			b.run(case_name("plane_copy", f, bf.name), (double)w * h * bps, [&](size_t)
+			{
+				uint8_t* dst = frame.data();
+				pc(f.h, f.w, &dst, pp[0], stride[0]);
+			});
+			b.run(case_name("plane_copy_s", f, bf.name), (double)w * h * bps, [&](size_t)
+			{
+				uint8_t* src = frame.data();
+				pcs(f.h, f.w, &src, pp[0], stride[0]);
+			});
+		}
+}
+
+static void bench_frame_size(bench& b)
+{
+	std::vector<format> f;
+	for (auto [w, h] : sizes)
+		for (const bench_format& bf : formats)
+			f.push_back(make_format(bf, w, h));
+	b.run("format::frame_size", 0, [&](size_t i)
+	{
+		sink = sink + f[i % f.size()].frame_size();
+	});
+}
+
+static VSNodeRef* blank_clip(const format& f, int nf)
+{
+	VSPlugin* std_p = vsapi->getPluginById("com.vapoursynth.std", core);
+	if (!std_p)
+		return 0;
+	VSMap* args = vsapi->createMap();
+	vsapi->propSetInt(args, "width", f.w, paReplace);
+	vsapi->propSetInt(args, "height", f.h, paReplace);
+	vsapi->propSetInt(args, "format", f.id, paReplace);
+	vsapi->propSetInt(args, "length", nf, paReplace);
+	VSMap* res = vsapi->invoke(std_p, "BlankClip", args);
+	vsapi->freeMap(args);
+	VSNodeRef* node = vsapi->getError(res) ? 0 : vsapi->propGetNode(res, "clip", 0, 0);
+	vsapi->freeMap(res);
+	return node;
+}
+
+static void bench_vs(bench& b, bool vs)
+{
+	const int nf = 8;
+	for (auto [w, h] : sizes)
+		for (const bench_format& bf : formats)
+		{
+			format f = make_format(bf, w, h);
+			std::string name = case_name("node_get_frame", f, bf.name);
+			VSNodeRef* node = vs ? blank_clip(f, nf) : 0;
+			if (!node)
+			{
+				b.skip(name);
+				continue;
+			}
+			std::vector<uint8_t> frame(f.frame_size());
+			b.run(name, (double)f.frame_size(), [&](size_t i)
+			{
+				uint8_t* ptr = frame.data();
+				node_get_frame(int(i % nf), node, &ptr);
+			});
+			vsapi->freeNode(node);
+		}
+	// conversion of the input to the bgr preview at its own size
+	for (auto [w, h] : sizes)
+	{
+		const bench_format& bf = formats[1];
+		format f = make_format(bf, w, h);
+		std::string name = case_name("preview", f, bf.name);
+		if (!b.wanted(name))
+			continue;
+		std::shared_ptr<video_buf_map> in;
+		if (VSNodeRef* node = vs ? blank_clip(f, nf) : 0)
+			in = make_video_buf_map(node);
+		try
+		{
+			if (!in || !in->out(0, h, w))
+				throw "";
+		}
+		catch (const char*)
+		{
+			b.skip(name);
+			continue;
+		}
+		b.run(name, (double)w * h * 4, [&](size_t i)
+		{
+			in->out(int(i % nf), h, w);
+		});
+	}
+}
+
+static void bench_keys(bench& b, bool vs)
+{
+	x265_params x;
+	const char* text =
+		"[bitrate]\n100\n200\n400\n800\n"
+		"[rd]\n3,3\n4,4\n6,6\n"
+		"[ref]\n1,1\n3,3\n5,5\n"
+		"[subme]\n1\n2\n3\n"
+		"[aq_strength]\n0.6\n1.0\n"
+		"[deblock]\n0,0,0\n1,-1,-1\n";
+	if (x.parse(text))
+	{
+		fprintf(stderr, "cannot parse the bench params\n");
+		return;
+	}
+	std::vector<x265_key> keys;
+	x265_sweep sweep(x, {});
+	for (x265_key k; sweep.next(&k);)
+		keys.push_back(k);
+	b.run("x265_key::less", 0, [&](size_t i)
+	{
+		sink = sink + (keys[i % keys.size()] < keys[(i * 7 + 3) % keys.size()]);
+	});
+	b.run("x265_key::set_insert", 0, [&](size_t)
+	{
+		std::set<x265_key> s(keys.begin(), keys.end());
+		sink = sink + s.size();
+	});
+	b.run("x265_params::keygen", 0, [&](size_t i)
+	{
+		sink = sink + (size_t)x.keygen(i % 3).get();
+	});
+	// the format field needs the vapoursynth presets
+	std::vector<int> fields;
+	for (int i = 0; i < x265_key::tuple_size; i++)
+		if (i != x265_key::format_id || vs)
+			fields.push_back(i);
+	std::vector<std::string> str(x265_key::tuple_size);
+	b.run("par::p2str", 0, [&](size_t i)
+	{
+		int j = fields[i % fields.size()];
+		str[j] = x265_params::p[j].p2str(x.v[j][0]);
+	});
+	for (int j : fields)
+		str[j] = x265_params::p[j].p2str(x.v[j][0]) + '\n';
+	b.run("par::str2p", 0, [&](size_t i)
+	{
+		int j = fields[i % fields.size()];
+		alignas(16) uint8_t tmp[64];
+		const char* s = str[j].c_str();
+		sink = sink + x265_params::p[j].str2p(&s, tmp);
+	});
+	b.run("x265_params::parse", (double)strlen(text), [&](size_t)
+	{
+		x.parse(text);
+	});
+}
+
+static int run(int argc, char** argv)
+{
+	bench b;
+	const char* out = 0;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string a = argv[i];
+		bool has_value = i + 1 < argc;
+		if (a == "-o" && has_value)
+			out = argv[++i];
+		else if (a == "-r" && has_value)
+			b.repeats = std::max(1, atoi(argv[++i]));
+		else if (a == "-f" && has_value)
+			b.filter = argv[++i];
+		else
+			return usage(), 1;
+	}
+	bool vs = 1;
+	try
+	{
+		vs_init();
+	}
+	catch (const char* msg)
+	{
+		fprintf(stderr, "%s, vapoursynth cases skipped\n", msg);
+		vs = 0;
+	}
+	bench_copy(b);
+	bench_frame_size(b);
+	bench_vs(b, vs);
+	bench_keys(b, vs);
+	FILE* fp = out ? fopen(out, "w") : stdout;
+	if (!fp)
+		return 1;
+	b.write(fp);
+	if (out)
+		fclose(fp);
+	return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	int ret;
+	try
+	{
+		ret = enqu::run(argc, argv);
+	}
+	catch (const char* msg)
+	{
+		fprintf(stderr, "%s\n", msg);
+		ret = 1;
+	}
+	enqu::vs_finalize();
+	return ret;
+}
@@ -0,0 +1,609 @@
+#include "enqu.h"
+#include "enqu_x265.h"
+
+namespace enqu {
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: enqu-cli [options] input params\n"
+		"  input          .vpy script, or raw planar frames with -s and -p\n"
+		"  params         [name] followed by newline separated values, as in the x265 tab\n"
+		"  -s WxH         raw frame size\n"
+		"  -p format      raw format name (e.g. YUV420P10)\n"
+		"  -j n           parallel jobs (default: all cores)\n"
+		"  -f csv|json    output format (default: csv)\n"
+		"  -o file        output file (default: stdout)\n"
+		"  -O objective   search instead of encoding every combination, writes the best params\n"
+		"                 quality (psnr at the listed bitrate) or speed:PSNR (fps above a psnr floor)\n"
+		"  -Q psnr        bitrate reaching psnr, bracketed on a prefix then encoded in full\n"
+		"  -M port|file   prometheus metrics, served on 127.0.0.1:port or written to file every second\n"
+		"  -T file        trace of jobs, passes and frame fetches as chrome trace json, written on exit\n"
+		"  -B runs[:warm] speed benchmark, every combination encoded runs times one at a time after\n"
+		"                 warm runs (default 1); median fps, mad, 95%% interval and significance\n"
+		"  -P cpus        pin encodes to the listed cpus, e.g. 2-3\n"
+		"  -X ratio       sweep on a proxy of about 1/ratio of the clip (scene sampled), then encode\n"
+		"                 its pareto front on the whole clip (full_* columns)\n"
+		"  -W workers     encode in enqu-worker processes: a count of local ones, host:port of\n"
+		"                 enqu-worker -l, host:port*n for n of them; comma separated, sets -j\n"
+		"  -K chunks[:1]  each combination in turn split at scene cuts into chunks (0: one per job)\n"
+		"                 encoded in parallel; rate control error report, :1 compares an unchunked encode\n"
+		"  -L n           sweep n combinations per job in lockstep, each frame fed to their encoders\n"
+		"                 in turn while in cache (default -j: cores / n)\n"
+		"  -S             run the sweep's jobs shortest predicted first (cost model learned from the\n"
+		"                 jobs done), fed further ahead to have a choice\n"
+		"  -N nodes       bind workers to numa nodes in turn, the input copied to each node that\n"
+		"                 memory allows; 0 for the detected nodes, else cpus split into that many\n"
+		"  input may be synthetic[:frames], generated at -s (default 640x360) and -p (default YUV420P8)\n");
+}
+
+static const char* trace_to = 0;
+static bool numa_on = 0;
+static bool sjf = 0;
+
+static int read_file(const char* path, std::string& out)
+{
+	FILE* fp = fopen(path, "rb");
+	if (!fp)
+		return -1;
+	char tmp[4096];
+	for (size_t n; (n = fread(tmp, 1, sizeof(tmp), fp));)
+		out.append(tmp, n);
+	fclose(fp);
+	return 0;
+}
+
+static std::shared_ptr<video_buf_map> open_vpy(const char* path)
+{
+	if (vsscript_evaluateFile(&se, path, efSetWorkingDir))
+	{
+		fprintf(stderr, "%s\n", vsscript_getError(se));
+		return 0;
+	}
+	VSNodeRef* node = vsscript_getOutput(se, 0);
+	if (!node)
+		return 0;
+	return make_video_buf_map(node);
+}
+
+static std::shared_ptr<video_buf_map> open_raw(const char* path, int w, int h, const std::string& name)
+{
+	if (!format::name2id.count(name))
+	{
+		fprintf(stderr, "unknown format %s\n", name.c_str());
+		return 0;
+	}
+	format f(format::name2id.at(name), h, w);
+	std::string data;
+	if (read_file(path, data))
+		return 0;
+	size_t frame_size = f.frame_size();
+	int nf = (int)(data.size() / frame_size);
+	if (!nf)
+		return 0;
+	std::vector<uint8_t*> ptr(nf);
+	for (int n = 0; n < nf; n++)
+		ptr[n] = (uint8_t*)data.data() + frame_size * n;
+	VSNodeRef* node = invoke_raws_to_node(f, nf, ptr.data());
+	if (!node)
+		return 0;
+	return make_video_buf_map(node); // copies, data may go
+}
+
+// moving gradients and blocks over fixed noise, the same on every run
+static std::shared_ptr<video_buf_map> open_synthetic(int nf, int w, int h, const std::string& name)
+{
+	if (!format::name2id.count(name))
+	{
+		fprintf(stderr, "unknown format %s\n", name.c_str());
+		return 0;
+	}
+	format f(format::name2id.at(name), h, w);
+	size_t frame_size = f.frame_size();
+	std::vector<uint8_t> data(frame_size * nf);
+	std::vector<uint8_t*> ptr(nf);
+	int max = (1 << f.bit_depth) - 1;
+	for (int n = 0; n < nf; n++)
+	{
+		uint8_t* p[3];
+		int stride[3];
+		f.planes(ptr[n] = data.data() + frame_size * n, p, stride);
+		uint32_t seed = 12345;
+		for (int c = 0; c < f.np; c++)
+		{
+			int pw = c ? w >> f.ssx : w, ph = c ? h >> f.ssx : h;
+			for (int y = 0; y < ph; y++)
+				for (int x = 0; x < pw; x++)
+				{
+					seed = seed * 1664525 + 1013904223;
+					int v = (x * 2 + y + n * 3) % 256 + (seed >> 29);
+					if (!c && ((x + n * 4) / 32 + (y + n * 2) / 32) % 5 == 0)
+						v = 255 - v / 2;
+					v = std::min(max, v << (f.bit_depth - 8));
+					if (f.bit_depth > 8)
+						((uint16_t*)(p[c] + (size_t)stride[c] * y))[x] = (uint16_t)v;
+					else
+						p[c][(size_t)stride[c] * y + x] = (uint8_t)v;
+				}
+		}
+	}
+	VSNodeRef* node = invoke_raws_to_node(f, nf, ptr.data());
+	if (!node)
+		return 0;
+	return make_video_buf_map(node); // copies, data may go
+}
+
+struct job
+{
+	std::vector<size_t> c; // candidate index per field
+	std::shared_ptr<res> r;
+	x265_key k;
+	std::shared_ptr<res> full; // confirmation on the whole clip of a proxy sweep's finalist
+};
+
+static std::string csv_field(const std::string& s)
+{
+	if (s.find_first_of(",\"\r\n") == std::string::npos)
+		return s;
+	std::string _ = "\"";
+	for (char c : s)
+		_ += c == '"' ? "\"\"" : std::string(1, c);
+	return _ + '"';
+}
+
+// quoted, lib paths may hold backslashes
+static std::string json_string(const std::string& s)
+{
+	std::string _ = "\"";
+	for (unsigned char c : s)
+	{
+		if (c == '"' || c == '\\')
+			_ += '\\', _ += c;
+		else if (c < 0x20)
+		{
+			char tmp[8];
+			sprintf(tmp, "\\u%04x", c);
+			_ += tmp;
+		}
+		else
+			_ += c;
+	}
+	return _ + '"';
+}
+
+static void write_results(FILE* fp, bool json, const x265_params& x, const std::vector<job>& jobs)
+{
+	std::vector<int> swept;
+	for (int i = 0; i < x265_key::tuple_size; i++)
+		if (x.v[i].size() > 1)
+			swept.push_back(i);
+	bool proxy = std::any_of(jobs.begin(), jobs.end(), [](const job& _) { return !!_.full; });
+	if (!json)
+	{
+		for (int i : swept)
+			fprintf(fp, "%s,", x265_params::p[i].name);
+		fprintf(fp, "state,bitrate,fps,time,psnr_y,psnr_u,psnr_v,psnr,ssim,ms_ssim,cpu_time,cpu_fps,rss_delta,cycles,instructions,pareto%s\n",
+			proxy ? ",full_bitrate,full_fps,full_psnr" : "");
+	}
+	else
+		fprintf(fp, "[\n");
+	std::vector<const stats*> all(jobs.size());
+	for (size_t n = 0; n < jobs.size(); n++)
+		all[n] = jobs[n].r->get_stats();
+	std::vector<bool> front = pareto_front(all);
+	for (size_t n = 0; n < jobs.size(); n++)
+	{
+		const job& _ = jobs[n];
+		const stats* st = _.r->get_stats();
+		stats zero;
+		if (!st)
+			st = &zero;
+		const char* state = res::state_name(_.r->get_state());
+		if (!json)
+		{
+			for (int i : swept)
+				fprintf(fp, "%s,", csv_field(x265_params::p[i].p2str(x.v[i][_.c[i]])).c_str());
+			fprintf(fp, "%s,%.3lf,%.3lf,%.3lf,%.4lf,%.4lf,%.4lf,%.4lf,%.6lf,%.6lf,%.3lf,%.3lf,%lld,%llu,%llu,%d", state, st->bitrate, st->fps, st->time,
+				st->psnr[0], st->psnr[1], st->psnr[2], st->psnr[3], st->ssim, st->ms_ssim,
+				st->cpu_time, st->cpu_fps, (long long)st->rss_delta, (unsigned long long)st->cycles, (unsigned long long)st->instructions, (int)front[n]);
+			if (proxy)
+			{
+				const stats* full = _.full ? _.full->get_stats() : 0;
+				if (full)
+					fprintf(fp, ",%.3lf,%.3lf,%.4lf", full->bitrate, full->fps, full->psnr[3]);
+				else
+					fprintf(fp, ",,,");
+			}
+			fprintf(fp, "\n");
+			continue;
+		}
+		fprintf(fp, "  { \"params\": {");
+		for (size_t k = 0; k < swept.size(); k++)
+		{
+			int i = swept[k];
+			fprintf(fp, "%s \"%s\": %s", k ? "," : "", x265_params::p[i].name, json_string(x265_params::p[i].p2str(x.v[i][_.c[i]])).c_str());
+		}
+		fprintf(fp, " }, \"state\": \"%s\", \"bitrate\": %.3lf, \"fps\": %.3lf, \"time\": %.3lf, "
+			"\"psnr_y\": %.4lf, \"psnr_u\": %.4lf, \"psnr_v\": %.4lf, \"psnr\": %.4lf, \"ssim\": %.6lf, \"ms_ssim\": %.6lf, "
+			"\"cpu_time\": %.3lf, \"cpu_fps\": %.3lf, \"rss_delta\": %lld, \"cycles\": %llu, \"instructions\": %llu, \"pareto\": %s",
+			state, st->bitrate, st->fps, st->time, st->psnr[0], st->psnr[1], st->psnr[2], st->psnr[3], st->ssim, st->ms_ssim,
+			st->cpu_time, st->cpu_fps, (long long)st->rss_delta, (unsigned long long)st->cycles, (unsigned long long)st->instructions,
+			front[n] ? "true" : "false");
+		if (const stats* full = _.full ? _.full->get_stats() : 0)
+			fprintf(fp, ", \"full\": { \"bitrate\": %.3lf, \"fps\": %.3lf, \"psnr\": %.4lf }", full->bitrate, full->fps, full->psnr[3]);
+		fprintf(fp, " }%s\n", n + 1 < jobs.size() ? "," : "");
+	}
+	if (json)
+		fprintf(fp, "]\n");
+}
+
+static int run_search(const std::string& spec, const x265_params& x, std::shared_ptr<video_buf_map> in, size_t n_jobs, const char* out)
+{
+	objective o;
+	if (spec.starts_with("speed:"))
+		o.type = objective::speed, o.floor = atof(spec.c_str() + 6);
+	else if (spec != "quality")
+		return usage(), 1;
+	x265_search search(x, {}, 0, o);
+	threadpool pool;
+	pool.start(n_jobs, numa_on);
+	fprintf(stderr, "searching %zu axes, %zu workers\n", search.axes.size(), n_jobs);
+	int err = search.run(x.e.get(), &pool, in);
+	pool.stop();
+	x265_search::result r = search.get();
+	fputs(r.log.c_str(), stderr);
+	if (err)
+		return 1;
+	FILE* fp = out ? fopen(out, "w") : stdout;
+	if (!fp)
+		return 1;
+	fprintf(fp, "# score %.4lf, bitrate %.3lf, fps %.3lf, psnr %.4lf, ssim %.6lf, %zu encodes\n",
+		r.score, r.st.bitrate, r.st.fps, r.st.psnr[3], r.st.ssim, r.encodes);
+	for (int i = 0; i < x265_key::tuple_size; i++)
+		if (i != x265_key::format_id)
+			fprintf(fp, "[%s]\n%s\n", x265_params::p[i].name, x265_params::p[i].p2str(search.v[i][r.c[i]]).c_str());
+	if (out)
+		fclose(fp);
+	return 0;
+}
+
+// the swept fields of the key at c
+static std::string key_name(const x265_params& x, const x265_sweep& sweep, const std::vector<size_t>& c)
+{
+	std::string name;
+	for (int i : sweep.axes)
+		name += std::string(name.empty() ? "" : " ") + x265_params::p[i].name + ' ' + x265_params::p[i].p2str(x.v[i][c[i]]);
+	return name.empty() ? "key" : name;
+}
+
+static int run_bench(const x265_params& x, std::shared_ptr<video_buf_map> in, int runs, int warmup, const char* out)
+{
+	std::vector<x265_key> keys;
+	std::vector<std::string> names;
+	x265_sweep sweep(x, {});
+	for (;;)
+	{
+		std::vector<size_t> c = sweep.c;
+		x265_key k;
+		if (!sweep.next(&k))
+			break;
+		keys.push_back(k);
+		names.push_back(key_name(x, sweep, c));
+	}
+	x265_bench bench(keys);
+	bench.runs = runs;
+	bench.warmup = warmup;
+	// one worker, an encode never shares the cpus with another
+	threadpool pool;
+	pool.start(1, numa_on);
+	fprintf(stderr, "%zu keys, %d runs each after %d warmup\n", keys.size(), runs, warmup);
+	int err = bench.run(x.e.get(), &pool, in);
+	pool.stop();
+	FILE* fp = out ? fopen(out, "w") : stdout;
+	if (!fp)
+		return 1;
+	fputs(bench.report(names).c_str(), fp);
+	if (out)
+		fclose(fp);
+	return err ? 1 : 0;
+}
+
+static int run_chunked(const x265_params& x, std::shared_ptr<video_buf_map> in, int chunks, bool compare, size_t n_jobs, const char* out)
+{
+	FILE* fp = out ? fopen(out, "w") : stdout;
+	if (!fp)
+		return 1;
+	std::vector<int> sof(in->nf);
+	for (int n = 0; n < in->nf; n++)
+		sof[n] = n;
+	threadpool pool;
+	pool.start(n_jobs, numa_on);
+	x265_sweep sweep(x, {});
+	int err = 0;
+	for (;;)
+	{
+		std::vector<size_t> c = sweep.c;
+		x265_key k;
+		if (!sweep.next(&k))
+			break;
+		// alone on the pool, its time is what the key takes without chunks
+		auto ref = std::make_shared<res>();
+		if (compare)
+		{
+			std::unique_ptr<context> ctx = k.ctx(ref, x.e.get(), in, sof);
+			ctx->keep_frames = 0;
+			pool.push(std::move(ctx));
+			pool.wait();
+		}
+		x265_chunked chunked(k, chunks);
+		if (chunked.run(x.e.get(), &pool, in, std::make_shared<res>(), ref->get_stats()))
+			err = 1;
+		fprintf(fp, "%s\n%s\n", key_name(x, sweep, c).c_str(), chunked.report().c_str());
+		fflush(fp);
+	}
+	pool.stop();
+	if (out)
+		fclose(fp);
+	return err;
+}
+
+static int run(int argc, char** argv)
+{
+	const char* input = 0, * params = 0, * out = 0;
+	int w = 0, h = 0;
+	std::string raw_format;
+	bool json = 0;
+	const char* search = 0;
+	double match = 0;
+	const char* metrics_to = 0;
+	int bench_runs = 0, bench_warmup = 1, proxy_ratio = 0;
+	int chunks = -1, chunks_compare = 0;
+	const char* cpus = 0;
+	const char* workers = 0;
+	size_t n_jobs = std::max(1u, std::thread::hardware_concurrency());
+	bool jobs_set = 0;
+	size_t lockstep = 1;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string a = argv[i];
+		bool has_value = i + 1 < argc;
+		if (a == "-s" && has_value)
+		{
+			if (sscanf(argv[++i], "%dx%d", &w, &h) != 2)
+				return usage(), 1;
+		}
+		else if (a == "-p" && has_value)
+			raw_format = argv[++i];
+		else if (a == "-j" && has_value)
+			n_jobs = std::max(1, atoi(argv[++i])), jobs_set = 1;
+		else if (a == "-f" && has_value)
+			json = std::string(argv[++i]) == "json";
+		else if (a == "-o" && has_value)
+			out = argv[++i];
+		else if (a == "-O" && has_value)
+			search = argv[++i];
+		else if (a == "-Q" && has_value)
+			match = atof(argv[++i]);
+		else if (a == "-M" && has_value)
+			metrics_to = argv[++i];
+		else if (a == "-T" && has_value)
+			trace_to = argv[++i], trace::enable(1);
+		else if (a == "-B" && has_value)
+		{
+			if (sscanf(argv[++i], "%d:%d", &bench_runs, &bench_warmup) < 1 || bench_runs < 1 || bench_warmup < 0)
+				return usage(), 1;
+		}
+		else if (a == "-P" && has_value)
+			cpus = argv[++i];
+		else if (a == "-W" && has_value)
+			workers = argv[++i];
+		else if (a == "-S")
+			sjf = 1;
+		else if (a == "-N" && has_value)
+		{
+			numa_on = 1;
+			if (int n = atoi(argv[++i]); n > 0)
+				numa::fake(n);
+		}
+		else if (a == "-L" && has_value)
+			lockstep = std::max(1, atoi(argv[++i]));
+		else if (a == "-X" && has_value)
+			proxy_ratio = std::max(1, atoi(argv[++i]));
+		else if (a == "-K" && has_value)
+		{
+			if (sscanf(argv[++i], "%d:%d", &chunks, &chunks_compare) < 1 || chunks < 0)
+				return usage(), 1;
+		}
+		else if (a[0] == '-')
+			return usage(), 1;
+		else if (!input)
+			input = argv[i];
+		else if (!params)
+			params = argv[i];
+		else
+			return usage(), 1;
+	}
+	if (!input || !params)
+		return usage(), 1;
+	metrics_exporter exporter;
+	if (metrics_to && exporter.start(metrics_to))
+	{
+		fprintf(stderr, "cannot export metrics to %s\n", metrics_to);
+		return 1;
+	}
+	vs_init();
+	x265_params x;
+	if (x.err)
+		return 1;
+	std::string text;
+	if (read_file(params, text))
+	{
+		fprintf(stderr, "cannot read %s\n", params);
+		return 1;
+	}
+	if (x.parse(text))
+	{
+		fprintf(stderr, "%s: %s\n", params, error_msg);
+		return 1;
+	}
+	if (workers)
+	{
+		auto e = std::make_unique<x265_remote_encoder>(workers);
+		if (e->err)
+		{
+			fprintf(stderr, "bad worker list %s\n", workers);
+			return 1;
+		}
+		n_jobs = e->size();
+		x.e = std::move(e);
+		numa_on = 0; // workers are other processes
+	}
+	// threads started from here on inherit it, workers and the encoders' own
+	if (cpus && pin_cpus(cpus))
+	{
+		fprintf(stderr, "cannot pin to cpus %s\n", cpus);
+		return 1;
+	}
+	std::shared_ptr<video_buf_map> in;
+	if (std::string(input).starts_with("synthetic"))
+	{
+		int nf = 60;
+		sscanf(input, "synthetic:%d", &nf);
+		in = open_synthetic(std::max(1, nf), w ? w : 640, h ? h : 360, raw_format.empty() ? "YUV420P8" : raw_format);
+	}
+	else
+		in = std::string(input).ends_with(".vpy") ? open_vpy(input) : open_raw(input, w, h, raw_format);
+	if (!in)
+	{
+		fprintf(stderr, "cannot open %s\n", input);
+		return 1;
+	}
+	if (numa_on)
+	{
+		in = make_numa_map(in);
+		fprintf(stderr, "%zu numa nodes\n", numa::nodes().size());
+	}
+	if (bench_runs)
+		return run_bench(x, in, bench_runs, bench_warmup, out);
+	if (search)
+		return run_search(search, x, in, n_jobs, out);
+	if (chunks >= 0)
+		return run_chunked(x, in, chunks, chunks_compare != 0, n_jobs, out);
+	if (match > 0)
+	{
+		x265_match m(x, { 0 }, match);
+		threadpool pool;
+		pool.start(n_jobs, numa_on);
+		int err = m.run(x.e.get(), &pool, in);
+		pool.stop();
+		FILE* fp = out ? fopen(out, "w") : stdout;
+		if (!fp)
+			return 1;
+		fputs(m.report().c_str(), fp);
+		if (out)
+			fclose(fp);
+		return err ? 1 : 0;
+	}
+	auto all_frames = [](int nf)
+	{
+		std::vector<int> _(nf);
+		for (int n = 0; n < nf; n++)
+			_[n] = n;
+		return _;
+	};
+	std::shared_ptr<video_buf_map> sweep_in = in;
+	if (proxy_ratio > 1)
+	{
+		sweep_in = make_proxy_map(in, proxy_frames(in.get(), proxy_ratio));
+		fprintf(stderr, "proxy of %d frames out of %d\n", sweep_in->nf, in->nf);
+	}
+	std::vector<int> sof = all_frames(sweep_in->nf);
+	// a lockstep group runs its encoders on one worker, whose threads they share
+	if (!x.e->lockstep)
+		lockstep = 1;
+	else if (!jobs_set)
+		n_jobs = std::max<size_t>(1, n_jobs / lockstep);
+	// cross product of every candidate list, equivalent keys encode once,
+	// fed a few jobs ahead of the workers so memory stays bounded
+	std::vector<job> jobs;
+	res_store<x265_key> q;
+	threadpool pool;
+	pool.start(n_jobs, numa_on);
+	pool.set_sjf(sjf);
+	size_t ahead = n_jobs * (sjf ? 16 : 2);
+	x265_sweep sweep(x, {});
+	fprintf(stderr, "%.0lf combinations, %zu workers\n", sweep.count(), n_jobs);
+	std::unique_ptr<context> group;
+	for (;;)
+	{
+		std::vector<size_t> c = sweep.c;
+		x265_key k;
+		if (!sweep.next(&k))
+			break;
+		auto t = q.try_emplace(k);
+		if (!t.second)
+			continue;
+		jobs.push_back({ c, t.first, k });
+		std::unique_ptr<context> ctx = k.ctx(t.first, x.e.get(), sweep_in, sof);
+		ctx->keep_frames = 0;
+		if (!group)
+			group = std::move(ctx);
+		else
+			group->lockstep.push_back(std::move(ctx));
+		if (group->lockstep.size() + 1 < lockstep)
+			continue;
+		pool.wait(ahead);
+		pool.push(std::move(group));
+	}
+	if (group)
+		pool.push(std::move(group));
+	fprintf(stderr, "%zu keys\n", jobs.size());
+	pool.wait();
+	if (sweep_in != in)
+	{
+		std::vector<const stats*> all(jobs.size());
+		for (size_t n = 0; n < jobs.size(); n++)
+			all[n] = jobs[n].r->get_stats();
+		std::vector<bool> front = pareto_front(all);
+		fprintf(stderr, "%zu finalists on the whole clip\n", (size_t)std::count(front.begin(), front.end(), true));
+		for (size_t n = 0; n < jobs.size(); n++)
+			if (front[n])
+			{
+				jobs[n].full = std::make_shared<res>();
+				std::unique_ptr<context> ctx = jobs[n].k.ctx(jobs[n].full, x.e.get(), in, all_frames(in->nf));
+				ctx->keep_frames = 0;
+				pool.push(std::move(ctx));
+			}
+		pool.wait();
+	}
+	pool.stop();
+	if (double e = x.e->cost.error(); e > 0)
+		fprintf(stderr, "cost model: predictions off by a median factor of %.2f\n", e);
+	FILE* fp = out ? fopen(out, "w") : stdout;
+	if (!fp)
+		return 1;
+	write_results(fp, json, x, jobs);
+	if (out)
+		fclose(fp);
+	return 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	int ret;
+	try
+	{
+		ret = enqu::run(argc, argv);
+	}
+	catch (const char* msg)
+	{
+		fprintf(stderr, "%s\n", msg);
+		ret = 1;
+	}
+	if (enqu::trace_to && enqu::trace::dump(enqu::trace_to))
+		fprintf(stderr, "cannot write trace to %s\n", enqu::trace_to);
+	enqu::vs_finalize();
+	return ret;
+}
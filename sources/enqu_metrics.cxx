@@ -0,0 +1,247 @@
+#include "enqu.h"
+
+#include <filesystem>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#endif
+
+namespace enqu {
+
+struct registry
+{
+	std::mutex mutex;
+	std::vector<metric*> v;
+};
+
+// constructed by the first metric, so it outlives all of them
+static registry& get_registry()
+{
+	static registry _;
+	return _;
+}
+
+metric::metric(const char* name, const char* help, type_t type)
+	: name(name), help(help), type(type)
+{
+	registry& r = get_registry();
+	std::lock_guard lock(r.mutex);
+	r.v.push_back(this);
+}
+
+metric::~metric()
+{
+	registry& r = get_registry();
+	std::lock_guard lock(r.mutex);
+	r.v.erase(std::remove(r.v.begin(), r.v.end(), this), r.v.end());
+}
+
+std::vector<metric*> metric::all()
+{
+	registry& r = get_registry();
+	std::lock_guard lock(r.mutex);
+	return r.v;
+}
+
+metric_histogram::metric_histogram(const char* name, const char* help, std::vector<double> bounds_)
+	: metric(name, help, histogram)
+	, bounds(std::move(bounds_))
+	, bucket(std::make_unique<std::atomic<uint64_t>[]>(bounds.size() + 1))
+{
+}
+
+void metric_histogram::observe(double x)
+{
+	size_t i = std::lower_bound(bounds.begin(), bounds.end(), x) - bounds.begin();
+	bucket[i].fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(x, std::memory_order_relaxed);
+	count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void metric_histogram::get(std::vector<uint64_t>* bucket_, uint64_t* count_, double* sum_) const
+{
+	bucket_->resize(bounds.size() + 1);
+	uint64_t acc = 0;
+	for (size_t i = 0; i <= bounds.size(); i++)
+		(*bucket_)[i] = acc += bucket[i].load(std::memory_order_relaxed);
+	*count_ = acc;
+	*sum_ = sum.load(std::memory_order_relaxed);
+}
+
+namespace metrics {
+metric_gauge input_bytes("enqu_input_bytes", "input frames in memory, in every format converted to");
+metric_gauge preview_bytes("enqu_preview_bytes", "preview buffers and caches");
+metric_gauge result_bytes("enqu_result_bytes", "reconstructed frames held by results");
+metric_gauge pool_queued("enqu_pool_queued_jobs", "jobs waiting for a worker");
+metric_gauge pool_busy("enqu_pool_busy_workers", "workers running a job");
+metric_counter jobs_done("enqu_jobs_done_total", "jobs finished");
+metric_counter jobs_failed("enqu_jobs_failed_total", "jobs failed");
+metric_counter jobs_cancelled("enqu_jobs_cancelled_total", "jobs cancelled");
+metric_counter frames_encoded("enqu_frames_encoded_total", "frames out of the final pass");
+metric_counter bytes_encoded("enqu_encoded_bytes_total", "bitstream out of the final pass");
+metric_histogram job_seconds("enqu_job_seconds", "wall time of finished encodes", { 1, 2, 5, 10, 30, 60, 120, 300, 600 });
+metric_histogram frame_ms("enqu_frame_encode_ms", "encoder time per frame", { 1, 2, 5, 10, 20, 50, 100, 200, 500, 1000 });
+}
+
+std::string metrics_text()
+{
+	static const char* type_name[] = { "counter", "gauge", "histogram" };
+	std::string text;
+	char tmp[256];
+	for (metric* m : metric::all())
+	{
+		text += std::string("# HELP ") + m->name + ' ' + m->help + "\n# TYPE " + m->name + ' ' + type_name[m->type] + '\n';
+		switch (m->type)
+		{
+		case metric::counter:
+			sprintf(tmp, "%s %llu\n", m->name, (unsigned long long)static_cast<metric_counter*>(m)->get());
+			text += tmp;
+			break;
+		case metric::gauge:
+			sprintf(tmp, "%s %lld\n", m->name, (long long)static_cast<metric_gauge*>(m)->get());
+			text += tmp;
+			break;
+		case metric::histogram:
+		{
+			auto h = static_cast<metric_histogram*>(m);
+			std::vector<uint64_t> bucket;
+			uint64_t count;
+			double sum;
+			h->get(&bucket, &count, &sum);
+			for (size_t i = 0; i < bucket.size(); i++)
+			{
+				if (i < h->bounds.size())
+					sprintf(tmp, "%s_bucket{le=\"%g\"} %llu\n", m->name, h->bounds[i], (unsigned long long)bucket[i]);
+				else
+					sprintf(tmp, "%s_bucket{le=\"+Inf\"} %llu\n", m->name, (unsigned long long)bucket[i]);
+				text += tmp;
+			}
+			sprintf(tmp, "%s_sum %g\n%s_count %llu\n", m->name, sum, m->name, (unsigned long long)count);
+			text += tmp;
+			break;
+		}
+		}
+	}
+	return text;
+}
+
+// replaced whole, a scraper never reads half a file
+static void write_metrics(const std::string& path)
+{
+	std::string tmp = path + ".tmp", text = metrics_text();
+	FILE* fp = fopen(tmp.c_str(), "wb");
+	if (!fp)
+		return;
+	bool ok = fwrite(text.data(), 1, text.size(), fp) == text.size();
+	ok &= !fclose(fp);
+	std::error_code ec;
+	if (ok)
+		std::filesystem::rename(tmp, path, ec);
+}
+
+#ifndef _WIN32
+// one request per connection, whatever its path
+static void serve_metrics(int c)
+{
+	timeval tv = { 1, 0 };
+	setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	char request[4096];
+	size_t n = 0;
+	for (ssize_t _; n < sizeof(request) && (_ = recv(c, request + n, sizeof(request) - n, 0)) > 0;)
+	{
+		n += _;
+		if (std::string_view(request, n).find("\r\n\r\n") != std::string_view::npos)
+			break;
+	}
+	std::string body = metrics_text();
+	std::string text = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+	for (size_t i = 0; i < text.size();)
+	{
+		ssize_t _ = send(c, text.data() + i, text.size() - i, MSG_NOSIGNAL);
+		if (_ <= 0)
+			break;
+		i += _;
+	}
+	close(c);
+}
+#endif
+
+int metrics_exporter::start(const std::string& to)
+{
+	if (worker.joinable() || to.empty())
+		return -1;
+	stopped = 0;
+	if (to.find_first_not_of("0123456789") != std::string::npos)
+	{
+		worker = std::thread([this, path = to]
+		{
+			std::unique_lock lock(mutex);
+			do
+			{
+				lock.unlock();
+				write_metrics(path);
+				lock.lock();
+			} while (!cv.wait_for(lock, std::chrono::seconds(1), [this] { return stopped; }));
+		});
+		return 0;
+	}
+#ifdef _WIN32
+	return -1;
+#else
+	int port = std::stoi(to);
+	if (port <= 0 || port > 65535 || (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return -1;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	sockaddr_in a = {};
+	a.sin_family = AF_INET;
+	a.sin_port = htons(port);
+	a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (sockaddr*)&a, sizeof(a)) || listen(fd, 4))
+	{
+		close(fd);
+		fd = -1;
+		return -1;
+	}
+	worker = std::thread([this]
+	{
+		for (;;)
+		{
+			int c = accept(fd, 0, 0);
+			if (c >= 0)
+			{
+				serve_metrics(c);
+				continue;
+			}
+			std::lock_guard lock(mutex);
+			if (stopped)
+				break;
+		}
+	});
+	return 0;
+#endif
+}
+
+void metrics_exporter::stop()
+{
+	{
+		std::lock_guard lock(mutex);
+		stopped = 1;
+	}
+	cv.notify_all();
+#ifndef _WIN32
+	if (fd >= 0)
+		shutdown(fd, SHUT_RDWR); // wakes accept
+#endif
+	if (worker.joinable())
+		worker.join();
+#ifndef _WIN32
+	if (fd >= 0)
+		close(fd);
+#endif
+	fd = -1;
+}
+
+}
@@ -0,0 +1,513 @@
+#include "enqu.h"
+#include "enqu_quality.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define ENQU_SSE2
+#endif
+
+namespace enqu {
+
+/* kernels take byte strides; the simd paths need samples of at most 12 bits so that
+ * squares summed in pairs fit int32, which every x265 input format satisfies */
+
+template< typename T>
+static uint64_t row_sse(size_t w, const T* x, const T* y)
+{
+	uint64_t sse = 0;
+	size_t j = 0;
+#ifdef ENQU_SSE2
+	__m128i zero = _mm_setzero_si128(), acc = zero;
+	for (; j + 8 <= w; j += 8)
+	{
+		__m128i a, b;
+		if constexpr (sizeof(T) == 1)
+		{
+			a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(x + j)), zero);
+			b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(y + j)), zero);
+		}
+		else
+		{
+			a = _mm_loadu_si128((const __m128i*)(x + j));
+			b = _mm_loadu_si128((const __m128i*)(y + j));
+		}
+		__m128i d = _mm_sub_epi16(a, b);
+		__m128i m = _mm_madd_epi16(d, d);
+		acc = _mm_add_epi64(acc, _mm_add_epi64(_mm_unpacklo_epi32(m, zero), _mm_unpackhi_epi32(m, zero)));
+	}
+	uint64_t lanes[2];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	sse = lanes[0] + lanes[1];
+#endif
+	for (; j < w; j++)
+	{
+		int64_t d = (int64_t)x[j] - y[j];
+		sse += d * d;
+	}
+	return sse;
+}
+
+template< typename T>
+static double plane_sse(size_t h, size_t w, const uint8_t* a, size_t sa, const uint8_t* b, size_t sb)
+{
+	uint64_t sse = 0;
+	for (size_t i = 0; i < h; i++, a += sa, b += sb)
+		sse += row_sse(w, reinterpret_cast<const T*>(a), reinterpret_cast<const T*>(b));
+	return (double)sse;
+}
+
+// luminance and contrast-structure terms of one 8x8 window from its sums
+static void ssim_end(double s1, double s2, double ss, double s12, double c1, double c2, double* l, double* cs)
+{
+	double vars = ss * 64 - s1 * s1 - s2 * s2;
+	double covar = s12 * 64 - s1 * s2;
+	*l = (2 * s1 * s2 + c1) / (s1 * s1 + s2 * s2 + c1);
+	*cs = (2 * covar + c2) / (vars + c2);
+}
+
+// 4x4 block sums s1, s2, ss, s12 of block row by
+template< typename T>
+static void ssim_row(size_t by, size_t bw, const uint8_t* x, size_t sx, const uint8_t* y, size_t sy, std::array<int64_t, 4>* s)
+{
+	size_t bx = 0;
+#ifdef ENQU_SSE2
+	// two blocks per step, lanes hold pair sums: block 0 in lanes 0-1, block 1 in lanes 2-3
+	__m128i zero = _mm_setzero_si128(), one = _mm_set1_epi16(1);
+	for (; bx + 2 <= bw; bx += 2)
+	{
+		__m128i s1 = zero, s2 = zero, ss = zero, s12 = zero;
+		for (size_t i = 0; i < 4; i++)
+		{
+			const T* px = reinterpret_cast<const T*>(x + (by * 4 + i) * sx) + bx * 4;
+			const T* py = reinterpret_cast<const T*>(y + (by * 4 + i) * sy) + bx * 4;
+			__m128i a, b;
+			if constexpr (sizeof(T) == 1)
+			{
+				a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)px), zero);
+				b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)py), zero);
+			}
+			else
+			{
+				a = _mm_loadu_si128((const __m128i*)px);
+				b = _mm_loadu_si128((const __m128i*)py);
+			}
+			s1 = _mm_add_epi32(s1, _mm_madd_epi16(a, one));
+			s2 = _mm_add_epi32(s2, _mm_madd_epi16(b, one));
+			ss = _mm_add_epi32(ss, _mm_add_epi32(_mm_madd_epi16(a, a), _mm_madd_epi16(b, b)));
+			s12 = _mm_add_epi32(s12, _mm_madd_epi16(a, b));
+		}
+		int32_t v[4][4];
+		_mm_storeu_si128((__m128i*)v[0], s1);
+		_mm_storeu_si128((__m128i*)v[1], s2);
+		_mm_storeu_si128((__m128i*)v[2], ss);
+		_mm_storeu_si128((__m128i*)v[3], s12);
+		for (size_t k = 0; k < 4; k++)
+		{
+			s[bx][k] = (int64_t)v[k][0] + v[k][1];
+			s[bx + 1][k] = (int64_t)v[k][2] + v[k][3];
+		}
+	}
+#endif
+	for (; bx < bw; bx++)
+	{
+		int64_t s1 = 0, s2 = 0, ss = 0, s12 = 0;
+		for (size_t i = 0; i < 4; i++)
+		{
+			const T* px = reinterpret_cast<const T*>(x + (by * 4 + i) * sx) + bx * 4;
+			const T* py = reinterpret_cast<const T*>(y + (by * 4 + i) * sy) + bx * 4;
+			for (size_t j = 0; j < 4; j++)
+			{
+				int64_t a = px[j], b = py[j];
+				s1 += a;
+				s2 += b;
+				ss += a * a + b * b;
+				s12 += a * b;
+			}
+		}
+		s[bx] = { s1, s2, ss, s12 };
+	}
+}
+
+// mean ssim and mean contrast-structure over 8x8 windows at step 4
+template< typename T>
+static std::pair<double, double> plane_ssim(size_t h, size_t w, const uint8_t* x, size_t sx, const uint8_t* y, size_t sy, int bit_depth)
+{
+	double max = (1 << bit_depth) - 1;
+	double c1 = .01 * .01 * max * max * 64, c2 = .03 * .03 * max * max * 64 * 63;
+	size_t bh = h / 4, bw = w / 4;
+	if (bh < 2 || bw < 2)
+		return { 1, 1 };
+	std::vector<std::array<int64_t, 4>> r0(bw), r1(bw);
+	ssim_row<T>(0, bw, x, sx, y, sy, r0.data());
+	double acc = 0, acc_cs = 0;
+	for (size_t by = 1; by < bh; by++)
+	{
+		ssim_row<T>(by, bw, x, sx, y, sy, r1.data());
+		for (size_t bx = 0; bx + 1 < bw; bx++)
+		{
+			double s[4], l, cs;
+			for (size_t k = 0; k < 4; k++)
+				s[k] = (double)(r0[bx][k] + r0[bx + 1][k] + r1[bx][k] + r1[bx + 1][k]);
+			ssim_end(s[0], s[1], s[2], s[3], c1, c2, &l, &cs);
+			acc += l * cs;
+			acc_cs += cs;
+		}
+		std::swap(r0, r1);
+	}
+	double n = (double)(bh - 1) * (bw - 1);
+	return { acc / n, acc_cs / n };
+}
+
+// 2x2 mean, rounded
+template< typename T>
+static std::vector<T> downscale(size_t h, size_t w, const uint8_t* x, size_t sx)
+{
+	std::vector<T> ret((h / 2) * (w / 2));
+	for (size_t i = 0; i < h / 2; i++)
+	{
+		const T* p0 = reinterpret_cast<const T*>(x + 2 * i * sx), * p1 = reinterpret_cast<const T*>(x + (2 * i + 1) * sx);
+		for (size_t j = 0; j < w / 2; j++)
+			ret[i * (w / 2) + j] = (T)((p0[2 * j] + p0[2 * j + 1] + p1[2 * j] + p1[2 * j + 1] + 2) >> 2);
+	}
+	return ret;
+}
+
+/* ms-ssim over up to 5 dyadic scales with the usual weights, renormalized when the
+ * frame is too small for all of them: cs of every scale but the last, ssim of the last */
+template< typename T>
+static double plane_ms_ssim(size_t h, size_t w, const uint8_t* x, size_t sx, const uint8_t* y, size_t sy, int bit_depth)
+{
+	static const double weight[5] = { .0448, .2856, .3001, .2363, .1333 };
+	int scales = 1;
+	while (scales < 5 && (h >> scales) >= 16 && (w >> scales) >= 16)
+		scales++;
+	double total = 0;
+	for (int s = 0; s < scales; s++)
+		total += weight[s];
+	std::vector<T> dx, dy;
+	double acc = 0;
+	for (int s = 0; s < scales; s++)
+	{
+		auto _ = plane_ssim<T>(h, w, x, sx, y, sy, bit_depth);
+		double term = s + 1 < scales ? _.second : _.first;
+		acc += weight[s] / total * std::log(std::max(term, 1e-9));
+		if (s + 1 == scales)
+			break;
+		dx = downscale<T>(h, w, x, sx);
+		dy = downscale<T>(h, w, y, sy);
+		h /= 2, w /= 2;
+		x = (const uint8_t*)dx.data(), y = (const uint8_t*)dy.data();
+		sx = sy = w * sizeof(T);
+	}
+	return std::exp(acc);
+}
+
+frame_quality measure(const format& f, uint8_t* const* ref, const int* ref_stride, const uint8_t* dis)
+{
+	frame_quality q;
+	bool wide = f.bit_depth > 8;
+	size_t bps = wide ? 2 : 1, off = 0;
+	for (int p = 0; p < f.np && p < 3; p++)
+	{
+		size_t h = p ? f.h >> f.ssx : f.h, w = p ? f.w >> f.ssx : f.w;
+		q.sse[p] = wide ? plane_sse<uint16_t>(h, w, ref[p], ref_stride[p], dis + off, w * bps)
+			: plane_sse<uint8_t>(h, w, ref[p], ref_stride[p], dis + off, w * bps);
+		off += h * w * bps;
+	}
+	q.ssim = wide ? plane_ssim<uint16_t>(f.h, f.w, ref[0], ref_stride[0], dis, f.w * bps, f.bit_depth).first
+		: plane_ssim<uint8_t>(f.h, f.w, ref[0], ref_stride[0], dis, f.w * bps, f.bit_depth).first;
+	q.ms_ssim = wide ? plane_ms_ssim<uint16_t>(f.h, f.w, ref[0], ref_stride[0], dis, f.w * bps, f.bit_depth)
+		: plane_ms_ssim<uint8_t>(f.h, f.w, ref[0], ref_stride[0], dis, f.w * bps, f.bit_depth);
+	q.valid = 1;
+	return q;
+}
+
+template< typename T>
+static void row_heat(size_t w, const T* x, const T* y, int shift, uint8_t* out)
+{
+	size_t j = 0;
+#ifdef ENQU_SSE2
+	if (shift >= 0)
+	{
+		__m128i zero = _mm_setzero_si128(), count = _mm_cvtsi32_si128(shift);
+		for (; j + 8 <= w; j += 8)
+		{
+			__m128i a, b;
+			if constexpr (sizeof(T) == 1)
+			{
+				a = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(x + j)), zero);
+				b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(y + j)), zero);
+			}
+			else
+			{
+				a = _mm_loadu_si128((const __m128i*)(x + j));
+				b = _mm_loadu_si128((const __m128i*)(y + j));
+			}
+			__m128i d = _mm_or_si128(_mm_subs_epu16(a, b), _mm_subs_epu16(b, a));
+			_mm_storel_epi64((__m128i*)(out + j), _mm_packus_epi16(_mm_sll_epi16(d, count), zero));
+		}
+	}
+#endif
+	for (; j < w; j++)
+	{
+		int d = std::abs((int)x[j] - (int)y[j]);
+		out[j] = (uint8_t)std::min(255, shift >= 0 ? d << shift : d >> -shift);
+	}
+}
+
+template< typename T>
+static void plane_heat(const format& f, int type, const uint8_t* x, size_t sx, const uint8_t* y, size_t sy, uint8_t* out)
+{
+	size_t h = f.h, w = f.w;
+	if (type == heat_abs)
+	{
+		// 1/16 of the range saturates
+		for (size_t i = 0; i < h; i++)
+			row_heat(w, reinterpret_cast<const T*>(x + i * sx), reinterpret_cast<const T*>(y + i * sy), 12 - f.bit_depth, out + i * w);
+		return;
+	}
+	double max = (1 << f.bit_depth) - 1;
+	double c1 = .01 * .01 * max * max * 64, c2 = .03 * .03 * max * max * 64 * 63;
+	size_t bh = h / 4, bw = w / 4;
+	if (bh < 2 || bw < 2)
+	{
+		std::fill_n(out, h * w, 0);
+		return;
+	}
+	// 1 - ssim of the window starting at each 4x4 block, the last row and column repeat
+	std::vector<std::array<int64_t, 4>> r0(bw), r1(bw);
+	std::vector<uint8_t> v(bw);
+	ssim_row<T>(0, bw, x, sx, y, sy, r0.data());
+	for (size_t by = 0; by < bh; by++)
+	{
+		if (by + 1 < bh)
+		{
+			ssim_row<T>(by + 1, bw, x, sx, y, sy, r1.data());
+			for (size_t bx = 0; bx + 1 < bw; bx++)
+			{
+				double s[4], l, cs;
+				for (size_t k = 0; k < 4; k++)
+					s[k] = (double)(r0[bx][k] + r0[bx + 1][k] + r1[bx][k] + r1[bx + 1][k]);
+				ssim_end(s[0], s[1], s[2], s[3], c1, c2, &l, &cs);
+				v[bx] = (uint8_t)std::clamp((1 - l * cs) * 4 * 255, 0., 255.);
+			}
+			v[bw - 1] = v[bw - 2];
+			std::swap(r0, r1);
+		}
+		for (size_t i = by * 4; i < (by + 1 < bh ? by * 4 + 4 : h); i++)
+			for (size_t j = 0; j < w; j++)
+				out[i * w + j] = v[std::min(j / 4, bw - 1)];
+	}
+}
+
+void heatmap(const format& f, int type, uint8_t* const* a, const int* sa, uint8_t* const* b, const int* sb, uint8_t* out)
+{
+	if (f.bit_depth > 8)
+		plane_heat<uint16_t>(f, type, a[0], sa[0], b[0], sb[0], out);
+	else
+		plane_heat<uint8_t>(f, type, a[0], sa[0], b[0], sb[0], out);
+}
+
+static double psnr(double sse, double samples, int bit_depth)
+{
+	double max = (1 << bit_depth) - 1;
+	if (sse <= 0)
+		return 100.;
+	return std::min(100., 10. * std::log10(max * max * samples / sse));
+}
+
+void aggregate(stats* st, const format& f, const frame_quality* fq, size_t n)
+{
+	double samples[3] = {}, total_sse = 0, total_samples = 0, acc_psnr[3] = {}, acc_ssim = 0, acc_ms_ssim = 0;
+	for (int p = 0; p < f.np && p < 3; p++)
+		samples[p] = (double)(p ? f.h >> f.ssx : f.h) * (p ? f.w >> f.ssx : f.w);
+	size_t valid = 0;
+	for (size_t i = 0; i < n; i++)
+	{
+		const frame_quality& q = fq[i];
+		if (!q.valid)
+			continue;
+		for (int p = 0; p < f.np && p < 3; p++)
+		{
+			acc_psnr[p] += psnr(q.sse[p], samples[p], f.bit_depth);
+			total_sse += q.sse[p];
+			total_samples += samples[p];
+		}
+		acc_ssim += q.ssim;
+		acc_ms_ssim += q.ms_ssim;
+		valid++;
+	}
+	st->frame.assign(fq, fq + n);
+	if (!valid)
+		return;
+	for (int p = 0; p < 3; p++)
+		st->psnr[p] = p < f.np ? acc_psnr[p] / valid : 0;
+	st->psnr[3] = psnr(total_sse, total_samples, f.bit_depth);
+	st->ssim = acc_ssim / valid;
+	st->ms_ssim = acc_ms_ssim / valid;
+}
+
+double frame_psnr(const format& f, const frame_quality& q)
+{
+	double sse = 0, samples = 0;
+	for (int p = 0; p < f.np && p < 3; p++)
+	{
+		sse += q.sse[p];
+		samples += (double)(p ? f.h >> f.ssx : f.h) * (p ? f.w >> f.ssx : f.w);
+	}
+	return psnr(sse, samples, f.bit_depth);
+}
+
+meter::meter(const format& f_, video_buf_map* in_, const std::vector<int>& sof_, res* r_)
+	: f(f_), in(in_), sof(sof_), r(r_), fq(sof_.size())
+{
+	worker = std::thread([this]
+	{
+		for (;;)
+		{
+			std::unique_lock lock(mutex);
+			cv.wait(lock, [this] { return closed || !q.empty(); });
+			if (q.empty())
+				break;
+			size_t n = q.front();
+			q.pop();
+			lock.unlock();
+			uint8_t* p[3];
+			int stride[3];
+			if (!in->planes(f, sof[n], p, stride))
+				fq[n] = measure(f, p, stride, r->buf[n]);
+		}
+	});
+}
+
+meter::~meter()
+{
+	{
+		std::lock_guard lock(mutex);
+		q = {};
+	}
+	close();
+}
+
+void meter::close()
+{
+	{
+		std::lock_guard lock(mutex);
+		closed = 1;
+	}
+	cv.notify_one();
+	if (worker.joinable())
+		worker.join();
+}
+
+void meter::push(size_t n)
+{
+	std::lock_guard lock(mutex);
+	q.push(n);
+	cv.notify_one();
+}
+
+void meter::finish(stats* st)
+{
+	close();
+	aggregate(st, f, fq.data(), fq.size());
+}
+
+// least squares polynomial y(x) of degree min(3, n - 1), coefficients low first
+static std::vector<double> polyfit(const std::vector<std::pair<double, double>>& p)
+{
+	size_t d = std::min<size_t>(3, p.size() - 1) + 1;
+	std::vector<std::vector<double>> m(d, std::vector<double>(d + 1));
+	for (auto& _ : p)
+	{
+		double xi[7] = { 1 };
+		for (size_t k = 1; k + 1 < 2 * d; k++)
+			xi[k] = xi[k - 1] * _.first;
+		for (size_t r = 0; r < d; r++)
+		{
+			for (size_t c = 0; c < d; c++)
+				m[r][c] += xi[r + c];
+			m[r][d] += xi[r] * _.second;
+		}
+	}
+	for (size_t c = 0; c < d; c++)
+	{
+		size_t pivot = c;
+		for (size_t r = c + 1; r < d; r++)
+			if (std::abs(m[r][c]) > std::abs(m[pivot][c]))
+				pivot = r;
+		std::swap(m[c], m[pivot]);
+		if (m[c][c] == 0)
+			return {};
+		for (size_t r = 0; r < d; r++)
+			if (r != c)
+			{
+				double f = m[r][c] / m[c][c];
+				for (size_t k = c; k <= d; k++)
+					m[r][k] -= f * m[c][k];
+			}
+	}
+	std::vector<double> coef(d);
+	for (size_t c = 0; c < d; c++)
+		coef[c] = m[c][d] / m[c][c];
+	return coef;
+}
+
+static double integral(const std::vector<double>& coef, double lo, double hi)
+{
+	double acc = 0;
+	for (size_t k = 0; k < coef.size(); k++)
+		acc += coef[k] / (k + 1) * (std::pow(hi, k + 1) - std::pow(lo, k + 1));
+	return acc;
+}
+
+// mean of fit b minus fit a over the overlap of their x ranges
+static int bd(const std::vector<std::pair<double, double>>& a, const std::vector<std::pair<double, double>>& b, double* delta)
+{
+	if (a.size() < 2 || b.size() < 2)
+		return -1;
+	auto range = [](const std::vector<std::pair<double, double>>& p)
+	{
+		auto _ = std::minmax_element(p.begin(), p.end());
+		return std::make_pair(_.first->first, _.second->first);
+	};
+	auto ra = range(a), rb = range(b);
+	double lo = std::max(ra.first, rb.first), hi = std::min(ra.second, rb.second);
+	if (!(lo < hi))
+		return -1;
+	// fitted over the overlap mapped to [0, 1], the normal equations stay well conditioned
+	std::vector<std::pair<double, double>> ta = a, tb = b;
+	for (auto* p : { &ta, &tb })
+		for (auto& _ : *p)
+			_.first = (_.first - lo) / (hi - lo);
+	std::vector<double> fa = polyfit(ta), fb = polyfit(tb);
+	if (fa.empty() || fb.empty())
+		return -1;
+	*delta = integral(fb, 0, 1) - integral(fa, 0, 1);
+	return 0;
+}
+
+int bd_rate(std::vector<std::pair<double, double>> a, std::vector<std::pair<double, double>> b, double* rate)
+{
+	// log rate over psnr
+	for (auto* p : { &a, &b })
+		for (auto& _ : *p)
+			_ = { _.second, std::log10(_.first) };
+	double d;
+	if (bd(a, b, &d))
+		return -1;
+	*rate = (std::pow(10, d) - 1) * 100;
+	return 0;
+}
+
+int bd_psnr(std::vector<std::pair<double, double>> a, std::vector<std::pair<double, double>> b, double* psnr)
+{
+	for (auto* p : { &a, &b })
+		for (auto& _ : *p)
+			_.first = std::log10(_.first);
+	return bd(a, b, psnr);
+}
+
+}
@@ -0,0 +1,47 @@
+namespace enqu {
+
+/* objective quality of a reconstruction against its source,
+ * ref planes as given by video_buf_map::planes, dis contiguous as in res */
+frame_quality measure(const format& f, uint8_t* const* ref, const int* ref_stride, const uint8_t* dis);
+
+// per plane psnr (mean over frames), global psnr (from total mse), mean ssim and ms-ssim
+// of the valid frames into st, which keeps all n
+void aggregate(stats* st, const format& f, const frame_quality* fq, size_t n);
+double frame_psnr(const format& f, const frame_quality& q);
+
+/* per pixel luma error of b against a into out, w * h bytes from 0 (equal) to 255:
+ * heat_abs the absolute difference, heat_ssim 1 - ssim of the surrounding 8x8 window */
+enum heat_t { heat_abs = 1, heat_ssim };
+void heatmap(const format& f, int type, uint8_t* const* a, const int* sa, uint8_t* const* b, const int* sb, uint8_t* out);
+
+/* measures frames on its own thread as the encoder publishes them, so quality costs the
+ * encode no wall time beyond the frames still queued when it ends */
+class meter
+{
+	format f;
+	video_buf_map* in;
+	std::vector<int> sof;
+	res* r;
+	std::vector<frame_quality> fq;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::queue<size_t> q;
+	bool closed = 0;
+	std::thread worker;
+	void close();
+public:
+	meter(const format& f, video_buf_map* in, const std::vector<int>& sof, res* r);
+	~meter();
+	// frame n (index into sof) of r is written
+	void push(size_t n);
+	// measures what is left and aggregates into st
+	void finish(stats* st);
+};
+
+/* bjontegaard deltas of curve b against a, points are (bitrate, psnr), at least 2 per curve
+ * with overlapping range; rate: mean bitrate difference in % at equal psnr, psnr: mean psnr
+ * difference in dB at equal bitrate. cubic fits as usual, lower degree under 4 points */
+int bd_rate(std::vector<std::pair<double, double>> a, std::vector<std::pair<double, double>> b, double* rate);
+int bd_psnr(std::vector<std::pair<double, double>> a, std::vector<std::pair<double, double>> b, double* psnr);
+
+}
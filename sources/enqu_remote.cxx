@@ -0,0 +1,849 @@
+#include "enqu.h"
+#include "enqu_x265.h"
+
+#include <random>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
+#include <unistd.h>
+extern char** environ;
+#endif
+
+namespace enqu {
+
+#ifndef _WIN32
+
+/* a message is its type and 64 bit payload size, then the payload in host byte order; both
+ * ends are builds of the same source for the same architecture, hello checks the version.
+ * msg_need asks for an inline segment again, which the worker dropped */
+enum msg_t : uint32_t { msg_hello = 1, msg_segment, msg_job, msg_cancel, msg_state, msg_frame, msg_done, msg_need };
+static constexpr uint32_t protocol_version = 2;
+
+struct msg
+{
+	uint32_t type = 0;
+	std::string data;
+	size_t pos = 0; // read position
+	msg(uint32_t type = 0) : type(type) {}
+	template< typename T>
+	void put(const T& x)
+	{
+		data.append((const char*)&x, sizeof(T));
+	}
+	void put(const std::string& s)
+	{
+		put((uint32_t)s.size());
+		data += s;
+	}
+	void put(const void* p, size_t n)
+	{
+		data.append((const char*)p, n);
+	}
+	const char* bytes(size_t n)
+	{
+		if (data.size() - pos < n)
+			throw "short message";
+		pos += n;
+		return data.data() + pos - n;
+	}
+	template< typename T>
+	void get(T& x)
+	{
+		memcpy((void*)&x, bytes(sizeof(T)), sizeof(T));
+	}
+	void get(std::string& s)
+	{
+		uint32_t n;
+		get(n);
+		s.assign(bytes(n), n);
+	}
+};
+
+static int send_all(int fd, const void* p, size_t n)
+{
+	for (size_t i = 0; i < n;)
+	{
+		ssize_t _ = send(fd, (const char*)p + i, n - i, MSG_NOSIGNAL);
+		if (_ <= 0)
+		{
+			if (_ < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		i += _;
+	}
+	return 0;
+}
+
+static int recv_all(int fd, void* p, size_t n)
+{
+	for (size_t i = 0; i < n;)
+	{
+		ssize_t _ = recv(fd, (char*)p + i, n - i, 0);
+		if (_ <= 0)
+		{
+			if (_ < 0 && errno == EINTR)
+				continue;
+			return -1;
+		}
+		i += _;
+	}
+	return 0;
+}
+
+static int send_msg(int fd, const msg& m)
+{
+	uint64_t h[2] = { m.type, m.data.size() }; // segments pass 4 GiB
+	return send_all(fd, h, sizeof(h)) || send_all(fd, m.data.data(), m.data.size()) ? -1 : 0;
+}
+
+// -1 once the peer is gone
+static int recv_msg(int fd, msg& m)
+{
+	uint64_t h[2];
+	if (recv_all(fd, h, sizeof(h)) || h[1] > SIZE_MAX)
+		return -1;
+	m.type = (uint32_t)h[0];
+	m.pos = 0;
+	m.data.resize((size_t)h[1]);
+	return recv_all(fd, m.data.data(), m.data.size());
+}
+
+// 1 if fd has data within ms, -1 on error
+static int readable(int fd, int ms)
+{
+	pollfd p = { fd, POLLIN, 0 };
+	int n = poll(&p, 1, ms);
+	return n < 0 ? (errno == EINTR ? 0 : -1) : n;
+}
+
+static void put_stats(msg& m, const stats& st)
+{
+	m.put(st.bitrate);
+	m.put(st.fps);
+	m.put(st.time);
+	m.put(st.pass_time);
+	m.put(st.cpu_time);
+	m.put(st.cpu_fps);
+	m.put(st.cycles);
+	m.put(st.instructions);
+	m.put(st.rss_delta);
+	m.put(st.psnr);
+	m.put(st.ssim);
+	m.put(st.ms_ssim);
+	m.put((uint32_t)st.frame.size());
+	m.put(st.frame.data(), st.frame.size() * sizeof(frame_quality));
+	m.put((uint32_t)st.info.size());
+	m.put(st.info.data(), st.info.size() * sizeof(frame_info));
+	m.put(st.str);
+}
+
+static void get_stats(msg& m, stats& st)
+{
+	m.get(st.bitrate);
+	m.get(st.fps);
+	m.get(st.time);
+	m.get(st.pass_time);
+	m.get(st.cpu_time);
+	m.get(st.cpu_fps);
+	m.get(st.cycles);
+	m.get(st.instructions);
+	m.get(st.rss_delta);
+	m.get(st.psnr);
+	m.get(st.ssim);
+	m.get(st.ms_ssim);
+	uint32_t n;
+	m.get(n);
+	st.frame.resize(n);
+	memcpy((void*)st.frame.data(), m.bytes(n * sizeof(frame_quality)), n * sizeof(frame_quality));
+	m.get(n);
+	st.info.resize(n);
+	memcpy((void*)st.info.data(), m.bytes(n * sizeof(frame_info)), n * sizeof(frame_info));
+	m.get(st.str);
+}
+
+// a posix shared memory object mapped whole, unlinked by its creator
+struct x265_remote_encoder::segment
+{
+	std::string name;
+	uint8_t* p = 0;
+	size_t size = 0;
+	bool owner = 0;
+	segment() = default;
+	segment(const segment&) = delete;
+	~segment()
+	{
+		if (p)
+			munmap(p, size);
+		if (owner)
+			shm_unlink(name.c_str());
+	}
+	static std::string unique_name()
+	{
+		static std::atomic<size_t> seq = 0;
+		return "/enqu-" + std::to_string(getpid()) + '-' + std::to_string(seq++);
+	}
+	int create(size_t size_)
+	{
+		name = unique_name();
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if (fd < 0)
+			return -1;
+		owner = 1;
+		size = std::max<size_t>(size_, 1);
+		if (ftruncate(fd, size) == 0)
+			p = (uint8_t*)mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			p = 0;
+		return p ? 0 : -1;
+	}
+	int open(const std::string& name_, bool write)
+	{
+		name = name_;
+		int fd = shm_open(name.c_str(), write ? O_RDWR : O_RDONLY, 0);
+		if (fd < 0)
+			return -1;
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+			p = (uint8_t*)mmap(0, size = st.st_size, write ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if (p == MAP_FAILED)
+			p = 0;
+		return p ? 0 : -1;
+	}
+};
+
+struct x265_remote_encoder::worker
+{
+	std::string host, port; // empty host: a local process
+	int fd = -1, pid = -1;
+	bool busy = 0, shared = 0;
+	uint64_t seq = 0; // jobs sent
+	std::set<std::string> sent; // input segments sent inline
+	std::unique_ptr<segment> out; // reconstructions, if shared
+	~worker()
+	{
+		stop();
+	}
+	int start(const segment& probe, uint64_t token);
+	void stop();
+	int run(context* ctx, const segment& in, const format& of, const std::atomic<bool>& abort);
+};
+
+// the enqu-worker next to the running executable, else the one in PATH
+static std::string worker_path()
+{
+	char self[4096];
+	ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+	if (n > 0)
+	{
+		std::string path(self, n);
+		path = path.substr(0, path.rfind('/') + 1) + "enqu-worker";
+		if (access(path.c_str(), X_OK) == 0)
+			return path;
+	}
+	return "enqu-worker";
+}
+
+int x265_remote_encoder::worker::start(const segment& probe, uint64_t token)
+{
+	if (host.empty())
+	{
+		int sv[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv))
+			return -1;
+		// the child's end as fd 3, dup2 clears close on exec
+		posix_spawn_file_actions_t fa;
+		posix_spawn_file_actions_init(&fa);
+		posix_spawn_file_actions_adddup2(&fa, sv[1], 3);
+		static const std::string path = worker_path();
+		char* argv[] = { (char*)path.c_str(), (char*)"-f", (char*)"3", 0 };
+		pid_t child;
+		int err = posix_spawnp(&child, path.c_str(), &fa, 0, argv, environ);
+		posix_spawn_file_actions_destroy(&fa);
+		close(sv[1]);
+		if (err)
+		{
+			close(sv[0]);
+			return -1;
+		}
+		fd = sv[0];
+		pid = child;
+	}
+	else
+	{
+		addrinfo hints = {}, * ai;
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		if (getaddrinfo(host.c_str(), port.c_str(), &hints, &ai))
+			return -1;
+		for (addrinfo* a = ai; a && fd < 0; a = a->ai_next)
+		{
+			fd = socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+			if (fd >= 0 && connect(fd, a->ai_addr, a->ai_addrlen))
+				close(fd), fd = -1;
+		}
+		freeaddrinfo(ai);
+		if (fd < 0)
+			return -1;
+		int one = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	}
+	// a worker that maps the probe and reads the token shares memory with this process
+	msg m(msg_hello);
+	m.put(protocol_version);
+	m.put(probe.name);
+	m.put(token);
+	if (send_msg(fd, m) || recv_msg(fd, m))
+		return stop(), -1;
+	uint32_t version;
+	uint8_t shared_;
+	try
+	{
+		m.get(version);
+		m.get(shared_);
+	}
+	catch (const char*)
+	{
+		return stop(), -1;
+	}
+	if (m.type != msg_hello || version != protocol_version)
+		return stop(), -1;
+	shared = shared_;
+	sent.clear();
+	out.reset();
+	return 0;
+}
+
+void x265_remote_encoder::worker::stop()
+{
+	if (fd >= 0)
+		close(fd); // the worker reads the end and exits
+	fd = -1;
+	if (pid > 0)
+	{
+		int status;
+		waitpid(pid, &status, 0);
+		if (WIFSIGNALED(status))
+			fprintf(stderr, "enqu-worker %d killed by signal %d\n", pid, WTERMSIG(status));
+	}
+	pid = -1;
+}
+
+int x265_remote_encoder::worker::run(context* ctx, const segment& in, const format& of, const std::atomic<bool>& abort)
+{
+	const x265_key* k = static_cast<const x265_key*>(ctx->k.get());
+	res& r = *ctx->r;
+	size_t frame_size = of.frame_size(), nf = ctx->sof.size();
+	if (shared && ctx->keep_frames && (!out || out->size < frame_size * nf))
+	{
+		out = std::make_unique<segment>();
+		if (out->create(frame_size * nf))
+			return out.reset(), -1;
+	}
+	auto send_segment = [&]
+	{
+		msg m(msg_segment);
+		m.put(in.name);
+		m.put(in.p, in.size);
+		sent.insert(in.name);
+		return send_msg(fd, m);
+	};
+	if (!shared && !sent.count(in.name) && send_segment())
+		return stop(), -1;
+	uint64_t job = ++seq;
+	msg m(msg_job);
+	m.put(job);
+	m.put(in.name);
+	m.put(of.id);
+	m.put(of.h);
+	m.put(of.w);
+	m.put(of.bit_depth);
+	m.put(of.np);
+	m.put(of.ssx);
+	m.put(ctx->in->nf);
+	m.put(ctx->in->fps_num);
+	m.put(ctx->in->fps_den);
+	m.put((uint32_t)nf);
+	m.put(ctx->sof.data(), nf * sizeof(int));
+	m.put((uint8_t)ctx->keep_frames);
+	m.put((uint8_t)ctx->share_first_pass);
+	m.put((uint8_t)ctx->measure);
+	m.put(shared && ctx->keep_frames ? out->name : std::string());
+	m.put(k->str());
+	if (send_msg(fd, m))
+		return stop(), -1;
+	bool cancelled = 0;
+	try
+	{
+		for (;;)
+		{
+			int n = readable(fd, 100);
+			if (n < 0)
+				return stop(), -1;
+			if (!n)
+			{
+				if (!cancelled && (abort || r.get_state() == res::cancelled))
+				{
+					msg c(msg_cancel);
+					c.put(job);
+					if (send_msg(fd, c))
+						return stop(), -1;
+					cancelled = 1;
+				}
+				continue;
+			}
+			if (recv_msg(fd, m))
+				return stop(), -1;
+			uint64_t id;
+			m.get(id);
+			if (id != job)
+				continue;
+			if (m.type == msg_need)
+			{
+				if (send_segment())
+					return stop(), -1;
+			}
+			else if (m.type == msg_state)
+			{
+				int s;
+				m.get(s);
+				r.set_state(s);
+			}
+			else if (m.type == msg_frame)
+			{
+				uint32_t i;
+				m.get(i);
+				if (i >= nf || r.empty())
+					continue;
+				memcpy(r.data()[i], shared ? (const char*)out->p + frame_size * i : m.bytes(frame_size), frame_size);
+				r.publish(i);
+			}
+			else if (m.type == msg_done)
+			{
+				int s;
+				m.get(s);
+				if (s != res::done)
+					return s == res::cancelled ? (r.cancel(), 0) : -1;
+				auto st = std::make_unique<stats>();
+				get_stats(m, *st);
+				r.stats = std::move(st);
+				if (!ctx->keep_frames)
+					r.drop_frames();
+				metrics::frames_encoded.add(nf);
+				r.set_state(res::done);
+				return 0;
+			}
+		}
+	}
+	catch (const char*)
+	{
+		return stop(), -1;
+	}
+}
+
+x265_remote_encoder::x265_remote_encoder(const std::string& spec)
+{
+	name = "x265 remote";
+	for (size_t pos = 0; pos <= spec.size();)
+	{
+		size_t end = std::min(spec.find(',', pos), spec.size());
+		std::string item = spec.substr(pos, end - pos);
+		pos = end + 1;
+		size_t colon = item.rfind(':'), star = item.find('*');
+		int n = 1;
+		if (colon == std::string::npos)
+			n = atoi(item.c_str()), item.clear();
+		else if (star != std::string::npos)
+			n = atoi(item.c_str() + star + 1), item.resize(star);
+		if (n <= 0)
+		{
+			err = -1;
+			return;
+		}
+		for (int i = 0; i < n; i++)
+		{
+			auto& w = workers.emplace_back(std::make_unique<worker>());
+			if (!item.empty())
+			{
+				w->host = item.substr(0, colon);
+				w->port = item.substr(colon + 1);
+			}
+		}
+	}
+	std::random_device rd;
+	token = (uint64_t)rd() << 32 | rd();
+	probe = std::make_unique<segment>();
+	if (probe->create(sizeof(token)))
+		err = -1;
+	else
+		memcpy(probe->p, &token, sizeof(token));
+}
+
+x265_remote_encoder::~x265_remote_encoder()
+{
+	workers.clear();
+}
+
+std::shared_ptr<x265_remote_encoder::segment> x265_remote_encoder::input_acquire(const std::shared_ptr<video_buf_map>& in, const format& of)
+{
+	std::lock_guard lock(inputs_mutex);
+	for (auto it = inputs.begin(); it != inputs.end();)
+		it = it->second.first.expired() ? inputs.erase(it) : std::next(it);
+	auto& e = inputs[{ in.get(), of.id }];
+	if (e.second)
+		return e.second;
+	// contiguous frames in of, whatever the planes of in point into
+	auto s = std::make_shared<segment>();
+	size_t frame_size = of.frame_size();
+	if (s->create(frame_size * in->nf))
+		return inputs.erase({ in.get(), of.id }), nullptr;
+	int bps = (of.bit_depth + 7) >> 3;
+	for (int n = 0; n < in->nf; n++)
+	{
+		uint8_t* a[3], * b[3];
+		int sa[3], sb[3];
+		if (in->planes(of, n, a, sa))
+			return inputs.erase({ in.get(), of.id }), nullptr;
+		of.planes(s->p + frame_size * n, b, sb);
+		for (int c = 0; c < of.np; c++)
+			for (int y = 0; y < (c ? of.h >> of.ssx : of.h); y++)
+				memcpy(b[c] + (size_t)sb[c] * y, a[c] + (size_t)sa[c] * y, (size_t)(c ? of.w >> of.ssx : of.w) * bps);
+	}
+	e = { in, s };
+	return s;
+}
+
+int x265_remote_encoder::encode(context* ctx, threadpool*)
+{
+	const x265_key* k = static_cast<const x265_key*>(ctx->k.get());
+	res& r = *ctx->r;
+	if (err || r.get_state() != res::queued)
+		return err;
+	format of;
+	if (ctx->in->get_format(k->get<x265_key::format_id>(), &of) || r.resize(of, ctx->sof.size()))
+		return -1;
+	std::shared_ptr<segment> in = input_acquire(ctx->in, of);
+	if (!in)
+		return -1;
+	worker* w = 0;
+	{
+		std::unique_lock lock(mutex);
+		cv.wait(lock, [&]
+		{
+			for (auto& _ : workers)
+				if (!_->busy)
+					return w = _.get(), 1;
+			return 0;
+		});
+		w->busy = 1;
+	}
+	trace_span span("remote");
+	int ret = w->fd >= 0 || !w->start(*probe, token) ? w->run(ctx, *in, of, m_abort) : -1;
+	{
+		std::lock_guard lock(mutex);
+		w->busy = 0;
+	}
+	cv.notify_one();
+	return ret;
+}
+
+// input frames in one format, read from memory the map does not own
+struct video_buf_map_mem : video_buf_map
+{
+	std::shared_ptr<void> owner;
+	std::vector<uint8_t*> frames;
+	video_buf_map_mem(const format& f_, int nf_, uint8_t* p, std::shared_ptr<void> owner)
+		: owner(std::move(owner))
+	{
+		f = f_;
+		nf = nf_;
+		for (int n = 0; n < nf; n++)
+			frames.push_back(p + f.frame_size() * n);
+	}
+	uint8_t** src(const format& of) { return of.id == f.id ? frames.data() : 0; }
+	uint8_t* out(int, int, int) { return 0; }
+	uint8_t* out(int, int, uint8_t*, const format&) { return 0; }
+	int get_format(int id, format* of)
+	{
+		if (id != f.id)
+			return -1;
+		*of = f;
+		return 0;
+	}
+};
+
+// value of the [lib] section of a key's text, default if it has none
+static std::string key_lib(const std::string& text)
+{
+	size_t i = text.find("\n[lib]\n");
+	if (i == std::string::npos)
+		return "default";
+	i += 7;
+	return text.substr(i, text.find('\n', i) - i);
+}
+
+int x265_worker_serve(int fd, const std::vector<std::string>* libs)
+{
+	x265_params x;
+	if (x.err)
+		return -1;
+	// by segment name, the last few kept mapped for first pass reuse; job that used them last
+	std::map<std::string, std::pair<uint64_t, std::shared_ptr<video_buf_map>>> inputs;
+	// inline segments received, until the next job naming them takes them into inputs
+	std::map<std::string, std::pair<std::shared_ptr<std::string>, size_t>> blobs; // data, offset
+	std::unique_ptr<x265_remote_encoder::segment> out;
+	msg m;
+	try
+	{
+		if (recv_msg(fd, m) || m.type != msg_hello)
+			return -1;
+		uint32_t version;
+		std::string probe_name;
+		uint64_t token, t = 0;
+		m.get(version);
+		m.get(probe_name);
+		m.get(token);
+		x265_remote_encoder::segment probe;
+		bool shared = !probe.open(probe_name, 0) && probe.size >= sizeof(t) && (memcpy(&t, probe.p, sizeof(t)), t == token);
+		msg hello(msg_hello);
+		hello.put(protocol_version);
+		hello.put((uint8_t)shared);
+		if (send_msg(fd, hello) || version != protocol_version)
+			return -1;
+		for (;;)
+		{
+			if (recv_msg(fd, m))
+				return 0;
+			if (m.type == msg_segment)
+			{
+				std::string name;
+				m.get(name);
+				blobs[name] = { std::make_shared<std::string>(std::move(m.data)), m.pos };
+				m.data.clear();
+				inputs.erase(name);
+				continue;
+			}
+			if (m.type != msg_job)
+				continue;
+			uint64_t job;
+			std::string in_name, out_name, text;
+			format f;
+			int nf;
+			int64_t fps_num, fps_den;
+			uint32_t count;
+			uint8_t keep_frames, share_first_pass, measure;
+			m.get(job);
+			m.get(in_name);
+			m.get(f.id);
+			m.get(f.h);
+			m.get(f.w);
+			m.get(f.bit_depth);
+			m.get(f.np);
+			m.get(f.ssx);
+			m.get(nf);
+			m.get(fps_num);
+			m.get(fps_den);
+			m.get(count);
+			std::vector<int> sof(count);
+			memcpy(sof.data(), m.bytes(count * sizeof(int)), count * sizeof(int));
+			m.get(keep_frames);
+			m.get(share_first_pass);
+			m.get(measure);
+			m.get(out_name);
+			m.get(text);
+			auto done = [&](int s, const stats* st)
+			{
+				msg d(msg_done);
+				d.put(job);
+				d.put(s);
+				if (st)
+					put_stats(d, *st);
+				return send_msg(fd, d);
+			};
+			auto& [used, in] = inputs[in_name];
+			used = job;
+			if (!in)
+			{
+				if (inputs.size() > 8)
+					inputs.erase(std::min_element(inputs.begin(), inputs.end(), [](auto& a, auto& b) { return a.second.first < b.second.first; }));
+				size_t size = f.frame_size() * nf;
+				// dropped with the inputs above, the host sends it again
+				if (!shared && !blobs.count(in_name))
+				{
+					msg need(msg_need);
+					need.put(job);
+					need.put(in_name);
+					if (send_msg(fd, need))
+						return -1;
+					std::string name;
+					do
+					{
+						if (recv_msg(fd, m))
+							return 0;
+						if (m.type == msg_segment)
+						{
+							m.get(name);
+							blobs[name] = { std::make_shared<std::string>(std::move(m.data)), m.pos };
+							m.data.clear();
+						}
+					} while (name != in_name);
+				}
+				if (auto it = blobs.find(in_name); it != blobs.end() && it->second.first->size() - it->second.second >= size)
+				{
+					auto& [data, pos] = it->second;
+					in = std::make_shared<video_buf_map_mem>(f, nf, (uint8_t*)data->data() + pos, data);
+				}
+				else if (auto s = std::make_shared<x265_remote_encoder::segment>(); shared && !s->open(in_name, 0) && s->size >= size)
+					in = std::make_shared<video_buf_map_mem>(f, nf, s->p, s);
+				blobs.erase(in_name);
+			}
+			if (in)
+			{
+				in->fps_num = fps_num;
+				in->fps_den = fps_den;
+			}
+			if (!out_name.empty() && (!out || out->name != out_name))
+			{
+				out = std::make_unique<x265_remote_encoder::segment>();
+				if (out->open(out_name, 1))
+					out.reset();
+			}
+			std::string lib = libs ? key_lib(text) : std::string();
+			if (libs && lib != "default" && std::find(libs->begin(), libs->end(), lib) == libs->end())
+			{
+				fprintf(stderr, "enqu-worker: lib %s not allowed\n", lib.c_str());
+				if (done(res::failed, 0))
+					return -1;
+				continue;
+			}
+			x265_params px;
+			// a value this worker reads differently (a lib it lacks) would encode something else under the host's key
+			if (!in || (!out_name.empty() && !out) || px.parse(text)
+				|| static_cast<x265_key*>(px.keygen(0).get())->str() != text)
+			{
+				inputs.erase(in_name);
+				if (done(res::failed, 0))
+					return -1;
+				continue;
+			}
+			auto pk = px.keygen(0);
+			auto r = std::make_shared<res>();
+			std::unique_ptr<context> ctx = static_cast<x265_key*>(pk.get())->ctx(r, x.e.get(), in, sof);
+			ctx->keep_frames = keep_frames;
+			ctx->share_first_pass = share_first_pass;
+			ctx->measure = measure;
+			std::atomic<bool> finished = 0;
+			int err = 0;
+			std::thread t([&] { err = x.e->encode(ctx.get(), 0); finished = 1; });
+			// forwards state changes and frames as the encoder publishes them, until it returns
+			int state = res::queued;
+			std::vector<bool> sent(keep_frames ? count : 0);
+			size_t frame_size = f.frame_size();
+			bool gone = 0;
+			for (;;)
+			{
+				bool end = finished;
+				int s = r->get_state();
+				if (s != state && s < res::done && !gone)
+				{
+					msg u(msg_state);
+					u.put(job);
+					u.put(s);
+					gone = send_msg(fd, u) != 0;
+					state = s;
+				}
+				for (uint32_t n = 0; n < sent.size() && !gone; n++)
+					if (uint8_t* p = sent[n] ? 0 : r->frame(n))
+					{
+						msg u(msg_frame);
+						u.put(job);
+						u.put(n);
+						if (out)
+							memcpy(out->p + frame_size * n, p, frame_size);
+						else
+							u.put(p, frame_size);
+						gone = send_msg(fd, u) != 0;
+						sent[n] = 1;
+					}
+				if (end)
+					break;
+				if (gone)
+				{
+					r->cancel();
+					std::this_thread::sleep_for(std::chrono::milliseconds(10));
+					continue;
+				}
+				int n = readable(fd, 10);
+				if (n == 0)
+					continue;
+				msg c;
+				if (n < 0 || recv_msg(fd, c))
+					gone = 1, r->cancel();
+				else if (c.type == msg_cancel)
+					r->cancel();
+			}
+			t.join();
+			if (gone)
+				return 0;
+			if (err)
+				r->set_state(res::failed);
+			if (done(r->get_state(), r->get_stats()))
+				return -1;
+		}
+	}
+	catch (const char* error)
+	{
+		fprintf(stderr, "enqu-worker: %s\n", error);
+		return -1;
+	}
+}
+
+#else
+
+struct x265_remote_encoder::segment
+{
+};
+
+struct x265_remote_encoder::worker
+{
+};
+
+x265_remote_encoder::x265_remote_encoder(const std::string&)
+{
+	name = "x265 remote";
+	err = -1;
+}
+
+x265_remote_encoder::~x265_remote_encoder()
+{
+}
+
+int x265_remote_encoder::encode(context*, threadpool*)
+{
+	return -1;
+}
+
+std::shared_ptr<x265_remote_encoder::segment> x265_remote_encoder::input_acquire(const std::shared_ptr<video_buf_map>&, const format&)
+{
+	return nullptr;
+}
+
+int x265_worker_serve(int, const std::vector<std::string>*)
+{
+	return -1;
+}
+
+#endif
+
+}
@@ -0,0 +1,107 @@
+#include "enqu.h"
+
+namespace enqu::trace {
+
+std::atomic<bool> on = 0;
+
+struct event
+{
+	const char* name;
+	int64_t begin, dur, arg;
+	int tid;
+};
+
+/* owned by one thread at a time, which alone writes it; the mutex is only contended by dump.
+ * a thread that exits frees its ring for the next one, keeping the events */
+struct ring
+{
+	static constexpr size_t size = 4096;
+	std::mutex mutex;
+	event e[size];
+	size_t n = 0; // written in all
+	bool used = 0;
+};
+
+static std::mutex rings_mutex;
+static std::vector<std::unique_ptr<ring>> rings;
+static std::atomic<int> next_tid = 1;
+
+struct thread_ring
+{
+	ring* r = 0;
+	int tid = next_tid++;
+	ring* get()
+	{
+		if (r)
+			return r;
+		std::lock_guard lock(rings_mutex);
+		for (auto& _ : rings)
+			if (!_->used)
+			{
+				r = _.get();
+				break;
+			}
+		if (!r)
+			r = rings.emplace_back(std::make_unique<ring>()).get();
+		r->used = 1;
+		return r;
+	}
+	~thread_ring()
+	{
+		if (!r)
+			return;
+		std::lock_guard lock(rings_mutex);
+		r->used = 0;
+	}
+};
+
+static thread_local thread_ring self;
+
+void enable(bool x)
+{
+	on.store(x, std::memory_order_relaxed);
+}
+
+int64_t now()
+{
+	static const auto t0 = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - t0).count();
+}
+
+void record(const char* name, int64_t begin, int64_t dur, int64_t arg)
+{
+	ring* r = self.get();
+	std::lock_guard lock(r->mutex);
+	r->e[r->n++ % ring::size] = { name, begin, dur, arg, self.tid };
+}
+
+int dump(const std::string& path)
+{
+	std::vector<event> all;
+	{
+		std::lock_guard lock(rings_mutex);
+		for (auto& r : rings)
+		{
+			std::lock_guard lock(r->mutex);
+			for (size_t i = r->n > ring::size ? r->n - ring::size : 0; i < r->n; i++)
+				all.push_back(r->e[i % ring::size]);
+		}
+	}
+	std::sort(all.begin(), all.end(), [](const event& a, const event& b) { return a.begin < b.begin; });
+	FILE* fp = fopen(path.c_str(), "wb");
+	if (!fp)
+		return -1;
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	for (size_t i = 0; i < all.size(); i++)
+	{
+		const event& _ = all[i];
+		fprintf(fp, "{\"name\":\"%s\",\"cat\":\"enqu\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld", _.name, _.tid, (long long)_.begin, (long long)_.dur);
+		if (_.arg >= 0)
+			fprintf(fp, ",\"args\":{\"n\":%lld}", (long long)_.arg);
+		fprintf(fp, "}%s\n", i + 1 < all.size() ? "," : "");
+	}
+	fprintf(fp, "]}\n");
+	return fclose(fp) ? -1 : 0;
+}
+
+}
@@ -0,0 +1,106 @@
+#include "enqu.h"
+#include "enqu_x265.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace enqu {
+
+static void usage()
+{
+	fprintf(stderr,
+		"usage: enqu-worker -f fd | -l [addr:]port [lib...]\n"
+		"  -f fd          serve the connected socket fd, as started by a local x265_remote_encoder\n"
+		"  -l [addr:]port listen on addr (default 127.0.0.1), a process per connection; each\n"
+		"                 connection of a host:port worker list of enqu-cli -W or ENQU_WORKERS.\n"
+		"                 Connections are not authenticated and run any key sent: do not bind\n"
+		"                 to an untrusted network. Keys may name the listed x265 libraries\n"
+		"                 besides default, others fail\n");
+}
+
+#ifndef _WIN32
+static int listen_on(const std::string& spec, const std::vector<std::string>& libs)
+{
+	size_t colon = spec.rfind(':');
+	std::string addr = colon == std::string::npos ? "127.0.0.1" : spec.substr(0, colon);
+	int port = atoi(spec.c_str() + (colon == std::string::npos ? 0 : colon + 1));
+	sockaddr_in a = {};
+	a.sin_family = AF_INET;
+	a.sin_port = htons(port);
+	int fd;
+	if (port <= 0 || port > 65535 || inet_pton(AF_INET, addr.c_str(), &a.sin_addr) != 1 || (fd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+		return usage(), 1;
+	int one = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (sockaddr*)&a, sizeof(a)) || listen(fd, 16))
+	{
+		fprintf(stderr, "cannot listen on %s:%d\n", addr.c_str(), port);
+		return 1;
+	}
+	// children are not waited for
+	signal(SIGCHLD, SIG_IGN);
+	for (;;)
+	{
+		int c = accept(fd, 0, 0);
+		if (c < 0)
+			continue;
+		// vapoursynth starts threads, so only after the fork
+		if (fork() == 0)
+		{
+			close(fd);
+			int ret = 1;
+			try
+			{
+				vs_init();
+				ret = x265_worker_serve(c, &libs) ? 1 : 0;
+			}
+			catch (const char* msg)
+			{
+				fprintf(stderr, "%s\n", msg);
+			}
+			_exit(ret);
+		}
+		close(c);
+	}
+}
+#endif
+
+static int run(int argc, char** argv)
+{
+#ifdef _WIN32
+	return usage(), 1;
+#else
+	if (argc < 3)
+		return usage(), 1;
+	std::string a = argv[1];
+	if (a == "-l")
+		return listen_on(argv[2], std::vector<std::string>(argv + 3, argv + argc));
+	if (a != "-f" || argc != 3)
+		return usage(), 1;
+	vs_init();
+	return x265_worker_serve(atoi(argv[2])) ? 1 : 0;
+#endif
+}
+
+}
+
+int main(int argc, char** argv)
+{
+	int ret;
+	try
+	{
+		ret = enqu::run(argc, argv);
+	}
+	catch (const char* msg)
+	{
+		fprintf(stderr, "%s\n", msg);
+		ret = 1;
+	}
+	enqu::vs_finalize();
+	return ret;
+}
@@ -1,205 +1,147 @@
 #include "enqu.h"
 #include "enqu_x265.h"
+#include "enqu_quality.h"
 
 #if defined(_WIN32)
 #define X265_API_IMPORTS
 #endif
 #include <x265.h>
 
+#include <filesystem>
+#include <random>
+#include <cstdarg>
+#include <cmath>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dlfcn.h>
+#endif
+
 namespace enqu {
 
-struct x265_key : tuple_key_t<std::tuple<
-	int, float, int, int, int, int,
-	int, int, int, bool_t,
-	int, float, float, bool_t, int, bool_t, float, int, int, int,
-	int, int, int, int, int, int, bool_t, bool_t, bool_t,
-	std::array<int, 2>, float, int, float, float, bool_t, std::array<bool_t, 2>, bool_t, int, bool_t, bool_t,
-	std::array<int, 2>, std::array<int, 2>, int, int, int, int, bool_t, bool_t, bool_t, bool_t,
-	bool_t, std::tuple<int, int, int>, std::tuple<int, int, int>,
-	std::tuple<bool_t, int, int>,
-	bool_t, bool_t, bool_t, int,
-	bool_t, bool_t, std::array<bool_t, 2>, int>>
-{
-	enum id {
-		format_id, bitrate, keyint, min_keyint, gop_lookahead, rc_lookahead,
-		bframes, bframe_bias, b_adapt, b_pyramid,
-		aq_mode, aq_strength, qp_adaptation_range, aq_motion, qg_size, cutree, qcomp, qpstep, cbqpoffs, crqpoffs,
-		max_cu_size, min_cu_size, max_tu_size, tu_intra_depth, tu_inter_depth, limit_tu, weightp, weightb, tskip,
-		rd, psy_rd, rdoq_level, psy_rdoq, dynamic_rd, ssim_rd, rd_refine, early_skip, rskip, tskip_fast, splitrd_skip,
-		max_merge, ref, limit_refs, me, subme, merange, rect, amp, limit_modes, temporal_mvp,
-		hme, hme_search, hme_range,
-		deblock,
-		sao, sao_non_deblock, limit_sao, selective_sao,
-		strong_intra_smoothing, b_intra, fast_intra, rdpenalty,
-	};
-	x265_key() = default;
-	x265_key(const tuple_t& _)
-		: tuple_key_t(_)
-	{
-	}
-	static void defaults(std::vector<std::any>* v)
-	{
-		v[format_id].emplace_back((int)pfYUV420P8);
-		v[format_id].emplace_back((int)pfYUV420P10);
-		v[bitrate].emplace_back(200.f);
-		v[max_cu_size].emplace_back(32);
-		v[min_cu_size].emplace_back(8);
-		v[max_tu_size].emplace_back(32);
-		v[tu_intra_depth].emplace_back(1);
-		v[tu_inter_depth].emplace_back(1);
-		v[limit_tu].emplace_back(0);
-		v[weightp].emplace_back(0_b);
-		v[weightb].emplace_back(0_b);
-		v[tskip].emplace_back(0_b);
-		v[rd].emplace_back(std::array<int, 2>{ 6, 6 });
-		v[psy_rd].emplace_back(1.f);
-		v[rdoq_level].emplace_back(2);
-		v[psy_rdoq].emplace_back(5.f);
-		v[dynamic_rd].emplace_back(0.f);
-		v[ssim_rd].emplace_back(0_b);
-		v[rd_refine].emplace_back(std::array<bool_t, 2>{ 0_b, 0_b });
-		v[early_skip].emplace_back(1_b);
-		v[rskip].emplace_back(0);
-		v[tskip_fast].emplace_back(0_b);
-		v[splitrd_skip].emplace_back(0_b);
-		v[max_merge].emplace_back(std::array<int, 2>{ 2, 2 });
-		v[ref].emplace_back(std::array<int, 2>{ 5, 5 });
-		v[limit_refs].emplace_back(1);
-		v[me].emplace_back(1);
-		v[subme].emplace_back(2);
-		v[merange].emplace_back(57);
-		v[rect].emplace_back(0_b);
-		v[amp].emplace_back(0_b);
-		v[limit_modes].emplace_back(0_b);
-		v[temporal_mvp].emplace_back(1_b);
-		v[hme].emplace_back(0_b);
-		v[hme_search].emplace_back(std::make_tuple(1, 1, 3));
-		v[hme_range].emplace_back(std::make_tuple(16, 16, 16));
-		v[strong_intra_smoothing].emplace_back(0_b);
-		v[b_intra].emplace_back(0_b);
-		v[fast_intra].emplace_back(std::array<bool_t, 2>{ 1_b, 1_b });
-		v[rdpenalty].emplace_back(0);
-		v[keyint].emplace_back(250);
-		v[min_keyint].emplace_back(0);
-		v[gop_lookahead].emplace_back(0);
-		v[rc_lookahead].emplace_back(20);
-		v[bframes].emplace_back(5);
-		v[bframe_bias].emplace_back(0);
-		v[b_adapt].emplace_back(2);
-		v[b_pyramid].emplace_back(1_b);
-		v[aq_mode].emplace_back(3);
-		v[aq_strength].emplace_back(1.f);
-		v[qp_adaptation_range].emplace_back(1.f);
-		v[aq_motion].emplace_back(0_b);
-		v[qg_size].emplace_back(16);
-		v[cutree].emplace_back(0_b);
-		v[qcomp].emplace_back(.6f);
-		v[qpstep].emplace_back(4);
-		v[cbqpoffs].emplace_back(0);
-		v[crqpoffs].emplace_back(0);
-		v[deblock].emplace_back(std::make_tuple(0_b, 0, 0));
-		v[sao].emplace_back(1_b);
-		v[sao_non_deblock].emplace_back(1_b);
-		v[limit_sao].emplace_back(0_b);
-		v[selective_sao].emplace_back(0);
-	}
-	bool operator<(const key& x_) const
-	{
-		const x265_key* x = static_cast<const x265_key*>(&x_);
-#define P(N) { if (get<N>() < x->get<N>()) return 1; if (x->get<N>() < get<N>()) return 0; }
-		P(format_id);
-		P(bitrate);
-		P(keyint);
-		P(min_keyint);
-		P(gop_lookahead);
-		P(rc_lookahead);
-		P(bframes);
-		P(bframe_bias);
-		P(b_adapt);
-		P(b_pyramid);
-		P(aq_mode);
-		P(aq_strength);
-		P(qp_adaptation_range);
-		P(aq_motion);
-		P(qg_size);
-		P(cutree);
-		P(qcomp);
-		P(qpstep);
-		P(cbqpoffs);
-		P(crqpoffs);
-		P(max_cu_size);
-		P(min_cu_size);
-		P(max_tu_size);
-		P(tu_intra_depth);
-		P(tu_inter_depth);
-		P(limit_tu);
-		P(weightp);
-		P(weightb);
-		P(tskip);
-		P(rd);
-		P(rdoq_level);
-		if (get<rdoq_level>())
-			P(psy_rdoq);
-		P(dynamic_rd);
-		P(ssim_rd);
-		if (!get<ssim_rd>())
-			P(psy_rd);
-		P(rd_refine);
-		P(early_skip);
-		P(rskip);
-		P(tskip_fast);
-		P(splitrd_skip);
-		P(max_merge);
-		P(ref);
-		P(limit_refs);
-		P(subme);
-		P(rect);
-		P(amp);
-		P(limit_modes);
-		P(temporal_mvp);
-		P(hme);
-		if (get<hme>())
-		{
-			P(hme_search);
-			P(hme_range);
-		}
-		else
-		{
-			P(me);
-			P(merange);
-		}
-		P(deblock);
-		P(sao);
-		P(sao_non_deblock);
-		P(limit_sao);
-		P(selective_sao);
-		P(strong_intra_smoothing);
-		P(b_intra);
-		P(fast_intra);
-		P(rdpenalty);
-#undef P
+// cleanup() is global to the library, deferred until the last encoder of the process goes
+static std::mutex apis_mutex;
+static std::set<const ::x265_api*> apis;
+static size_t live_encoders = 0;
+
+// loaded libraries are never unloaded, their apis stay valid for the process
+struct lib_entry
+{
+	std::string path;
+	decltype(&::x265_api_query) query;
+};
+static std::mutex libs_mutex;
+static std::vector<lib_entry> libs = { { "default", ::x265_api_query } };
+
+// 0 if the library has no api for bit_depth or fills structs of another layout
+static const ::x265_api* checked_api(decltype(&::x265_api_query) query, int bit_depth)
+{
+	int err = 0;
+	const ::x265_api* api = query(bit_depth, X265_BUILD, &err);
+	if (!api || api->sizeof_param != sizeof(::x265_param) || api->sizeof_picture != sizeof(::x265_picture)
+		|| api->sizeof_analysis_data != sizeof(::x265_analysis_data))
 		return 0;
+	return api;
+}
+
+static const ::x265_api* lib_api(int id, int bit_depth)
+{
+	decltype(&::x265_api_query) query;
+	{
+		std::lock_guard lock(libs_mutex);
+		if (id < 0 || id >= (int)libs.size())
+			return 0;
+		query = libs[id].query;
 	}
-	std::unique_ptr<context> ctx(res& res, encoder* e) const
+	return checked_api(query, bit_depth);
+}
+
+// id of the library at path, loaded on first use; -1 with error_msg set if unusable
+static int lib_load(const std::string& path)
+{
+	std::lock_guard lock(libs_mutex);
+	for (size_t i = 0; i < libs.size(); i++)
+		if (libs[i].path == path)
+			return (int)i;
+	void* query;
+	std::string why;
+#ifdef _WIN32
+	HMODULE h = LoadLibraryA(path.c_str());
+	if (!h)
+		why = "error " + std::to_string(GetLastError());
+	query = h ? (void*)GetProcAddress(h, "x265_api_query") : 0;
+#else
+	int flags = RTLD_NOW | RTLD_LOCAL;
+#ifdef RTLD_DEEPBIND
+	flags |= RTLD_DEEPBIND; // its own symbols before those of the linked x265
+#endif
+	void* h = dlopen(path.c_str(), flags);
+	if (const char* e = h ? 0 : dlerror())
+		why = e;
+	query = h ? dlsym(h, "x265_api_query") : 0;
+#endif
+	auto q = (decltype(&::x265_api_query))query;
+	if (!q || (!checked_api(q, 8) && !checked_api(q, 10) && !checked_api(q, 12)))
 	{
-		return std::make_unique<context>(static_cast<const enqu::key*>(this), res, e);
+		// error_msg written under libs_mutex, keys parsed on pool threads load libraries too
+		if (!h)
+			snprintf(error_msg, sizeof(error_msg), "cannot load %s: %s", path.c_str(), why.c_str());
+		else if (!q)
+			snprintf(error_msg, sizeof(error_msg), "%s: no x265_api_query", path.c_str());
+		else
+			snprintf(error_msg, sizeof(error_msg), "%s: not built with the structs of x265 build %d", path.c_str(), X265_BUILD);
+#ifdef _WIN32
+		if (h)
+			FreeLibrary(h);
+#else
+		if (h)
+			dlclose(h);
+#endif
+		return -1;
 	}
-};
+	libs.push_back({ path, q });
+	return (int)libs.size() - 1;
+}
 
-struct x265_encoder : encoder
+template<>
+std::string p2str<x265_lib>(const std::any& x)
 {
-	x265_encoder();
-	~x265_encoder();
-	int encode(context*, threadpool*);
-	static void param_apply_key(::x265_param*, const x265_key*, int);
-};
+	std::lock_guard lock(libs_mutex);
+	size_t id = std::any_cast<int>(x);
+	return id < libs.size() ? libs[id].path : std::string();
+}
+
+template<>
+int str2p<x265_lib>(const char** str, void* x)
+{
+	int n = 0;
+	char buf[1024] = {};
+	if (sscanf(*str, "%1023[^\n]\n%n", buf, &n) != 1 || !n)
+		return 0;
+	int id = lib_load(buf);
+	if (id < 0)
+		return 0;
+	*(int*)x = id;
+	*str += n;
+	return n;
+}
 
 x265_encoder::x265_encoder()
 {
+	lockstep = 1;
+	std::lock_guard lock(apis_mutex);
+	live_encoders++;
 }
 
 x265_encoder::~x265_encoder()
 {
+	std::lock_guard lock(apis_mutex);
+	if (--live_encoders)
+		return;
+	for (const ::x265_api* api : apis)
+		api->cleanup();
+	apis.clear();
 }
 
 void x265_encoder::param_apply_key(::x265_param* p, const x265_key* k, int pass)
@@ -304,225 +246,1329 @@ static int f2f(const format& f, int& csp)
 	return 0;
 }
 
-int x265_encoder::encode(context* ctx, threadpool*)
+// per first pass stats, concurrent encodes must not share x265_2pass.log
+static std::string stat_file_name(const void* job)
+{
+	static const unsigned salt = std::random_device{}();
+	char tmp[64];
+	sprintf(tmp, "enqu_%08x_%p.log", salt, job);
+	return (std::filesystem::temp_directory_path() / tmp).string();
+}
+
+x265_encoder::first_pass::~first_pass()
+{
+	std::remove(stat.c_str());
+	std::remove((stat + ".cutree").c_str());
+}
+
+/* cu decisions of one picture from its analysis data, which keeps one entry per cu
+ * (depthBytes in all), z order within each ctu and ctus in raster order */
+static int read_cu(const x265_analysis_data& a, bool intra, const format& f, int ctu, cu_map* m)
+{
+	enum { pred_intra = 2, pred_skip = 5 }; // x265 PredMode, bi-predicted cus are stored as 4
+	uint32_t np = (ctu / 4) * (ctu / 4);
+	int cw = (f.w + ctu - 1) / ctu, ch = (f.h + ctu - 1) / ctu, b = ctu / 8;
+	const uint8_t* depth = intra ? (a.intraData ? a.intraData->depth : 0) : (a.interData ? a.interData->depth : 0);
+	const uint8_t* modes = intra || !a.interData ? 0 : a.interData->modes;
+	if (!depth || (!intra && !modes) || a.numPartitions != np || a.numCUsInFrame != (uint32_t)(cw * ch))
+		return -1;
+	m->w = (f.w + 7) / 8;
+	m->h = (f.h + 7) / 8;
+	m->v.assign((size_t)m->w * m->h, 0);
+	size_t e = 0;
+	for (int c = 0; c < cw * ch; c++)
+		for (uint32_t part = 0; part < np; e++)
+		{
+			if (e >= a.depthBytes || depth[e] > 3 || (ctu >> depth[e]) < 8)
+				return -1;
+			int d = depth[e];
+			int mode = intra || modes[e] == pred_intra ? cu_map::intra : modes[e] == pred_skip ? cu_map::skip : cu_map::inter;
+			uint32_t x4 = 0, y4 = 0; // first 4x4 unit
+			for (int i = 0; i < 8; i++)
+			{
+				x4 |= (part >> (2 * i) & 1) << i;
+				y4 |= (part >> (2 * i + 1) & 1) << i;
+			}
+			int x0 = c % cw * b + x4 / 2, y0 = c / cw * b + y4 / 2, side = (ctu >> d) / 8;
+			for (int y = y0; y < std::min(y0 + side, m->h); y++)
+				for (int x = x0; x < std::min(x0 + side, m->w); x++)
+					m->v[(size_t)y * m->w + x] = (uint8_t)(d | mode << 2);
+			part += np >> (2 * d);
+		}
+	return 0;
+}
+
+// key fields read by the first pass only, the second pass values cleared
+static x265_key first_pass_key(const x265_key& k)
+{
+	x265_key _ = k;
+	std::get<x265_key::max_merge>(_._)[1] = 0;
+	std::get<x265_key::ref>(_._)[1] = 0;
+	std::get<x265_key::fast_intra>(_._)[1] = 0;
+	std::get<x265_key::rd>(_._)[1] = 0;
+	std::get<x265_key::rd_refine>(_._)[1] = 0;
+	return _;
+}
+
+/* first pass stats shared by keys that only differ in the second pass, on the same input.
+ * own: the caller runs the first pass and reports it through first_pass_done, else the
+ * returned stats are complete (waits while another job produces them, unless !wait: then
+ * the caller gets a first pass of its own outside the cache) */
+std::shared_ptr<x265_encoder::first_pass> x265_encoder::first_pass_acquire(const x265_key& k, const std::shared_ptr<video_buf_map>& in, bool* own, bool wait)
+{
+	auto id = std::make_pair(in.get(), first_pass_key(k));
+	std::unique_lock lock(cache_mutex);
+	for (;;)
+	{
+		auto it = cache.find(id);
+		if (it != cache.end() && it->second->in.lock() != in) // freed input at a reused address
+		{
+			cache.erase(it);
+			it = cache.end();
+		}
+		if (it == cache.end())
+			break;
+		std::shared_ptr<first_pass> fp = it->second;
+		if (!wait && !fp->state)
+		{
+			fp = std::make_shared<first_pass>();
+			fp->stat = stat_file_name(fp.get());
+			*own = 1;
+			return fp;
+		}
+		cache_cv.wait(lock, [&] { return fp->state; });
+		if (fp->state > 0)
+		{
+			*own = 0;
+			return fp;
+		}
+		if (cache.count(id) && cache[id] == fp)
+			cache.erase(id);
+	}
+	// bounded, finished entries go oldest first; files are removed with the last user
+	while (cache.size() >= 64)
+	{
+		auto oldest = cache.end();
+		for (auto it = cache.begin(); it != cache.end(); it++)
+			if (it->second->state && (oldest == cache.end() || it->second->seq < oldest->second->seq))
+				oldest = it;
+		if (oldest == cache.end())
+			break;
+		cache.erase(oldest);
+	}
+	auto fp = std::make_shared<first_pass>();
+	fp->in = in;
+	fp->seq = seq++;
+	fp->stat = stat_file_name(fp.get());
+	cache[id] = fp;
+	*own = 1;
+	return fp;
+}
+
+void x265_encoder::first_pass_done(first_pass* fp, bool ok, double time, const cpu_usage& use)
 {
-	const x265_key* k = static_cast<const x265_key*>(ctx->k);
-	int id = k->get<x265_key::format_id>();
-	ctx->r.resize(id, std::make_pair(g_f.w, g_f.h), g_sof.size());
+	std::lock_guard lock(cache_mutex);
+	if (fp->state)
+		return;
+	fp->state = ok ? 1 : -1;
+	fp->time = time;
+	fp->use = use;
+	cache_cv.notify_all();
+}
+
+/* one job of a lockstep group (context::lockstep): the encoder of the pass running, fed a
+ * picture per step so that the group's encoders take each frame in turn while it is in cache */
+struct x265_encoder::member
+{
+	context* ctx;
+	const x265_key* k;
+	std::unique_ptr<meter> m;
+	std::shared_ptr<first_pass> fp;
+	bool own = 1; // runs the first pass of fp
+	bool reused = 0; // fp was run by another job before, its time is added
+	bool failed = 0;
+	std::vector<frame_info> info;
+	std::vector<cu_map> cu;
+	std::string cu_file;
+	std::vector<int> slot; // output poc to index into sof
+	size_t acc_bytes = 0;
+	double ms[2] = {}; // encoder time per pass, shares out the group's cpu time
+	const ::x265_api* api = 0;
+	::x265_encoder* e = 0;
+	::x265_param p;
 	x265_picture pic_in, pic_out;
+	copy_f copy = 0;
+	int i = 0, j = 0; // pictures in, out
+	int open(int pass);
+	int step(int pass, const std::atomic<bool>& abort);
+	void close()
+	{
+		if (e)
+			api->encoder_close(e);
+		e = 0;
+	}
+};
+
+int x265_encoder::member::open(int pass)
+{
+	res& r = *ctx->r;
+	video_buf_map& in = *ctx->in;
+	const format& f = r.f;
+	int csp;
+	if (!r.set_state(pass ? res::pass2 : res::pass1) || f2f(f, csp) || !(api = lib_api(k->get<x265_key::lib>(), f.bit_depth)))
+		return -1;
+	{
+		std::lock_guard lock(apis_mutex);
+		apis.insert(api);
+	}
+	copy = f.bit_depth == 8 ? enqu::copy<uint8_t> : enqu::copy<uint16_t>;
+	//api->param_default_preset(&p, "ultrafast", 0);
+	api->param_default(&p);
+	p.internalCsp = csp;
+	p.sourceBitDepth = f.bit_depth;
+	p.sourceWidth = f.w;
+	p.sourceHeight = f.h;
+	p.totalFrames = in.nf;
+	p.frameNumThreads = 1;
+	p.lookaheadSlices = 0;
+	p.numaPools = "none"; // no pools, its threads stay on the worker's numa node
+	p.bEnableWavefront = 0;
+	p.fpsNum = (uint32_t)in.fps_num;
+	p.fpsDenom = (uint32_t)in.fps_den;
+	p.bEnablePsnr = 0;
+	p.bAllowNonConformance = 1;
+	p.bCopyPicToFrame = 1;
+	p.logLevel = X265_LOG_NONE;
+	p.csvLogLevel = 1; // frameData.wallTime is only filled from level 1, no csv without csvfn
+	p.rc.statFileName = (char*)fp->stat.c_str();
+	if (pass)
+		p.rc.bStatRead = 2;
+	else
+		p.rc.bStatWrite = 1;
+	api->picture_init(&p, &pic_in);
+	pic_in.colorSpace = csp;
+	pic_in.bitDepth = f.bit_depth;
+	param_apply_key(&p, k, pass);
+	// the analysis is read back from each output picture, the file is a by-product
+	if (pass && ctx->collect_cu)
+	{
+		p.analysisSave = cu_file.c_str();
+		p.analysisSaveReuseLevel = 10;
+	}
+	{
+		trace_span span("encoder_open");
+		e = api->encoder_open(&p);
+	}
+	i = j = 0;
+	return e ? 0 : -1;
+}
+
+// feeds the next picture, none once all are in, and takes the output; 1 once it is all out
+int x265_encoder::member::step(int pass, const std::atomic<bool>& abort)
+{
+	res& r = *ctx->r;
+	video_buf_map& in = *ctx->in;
+	const format& f = r.f;
+	x265_picture* ppic_in = 0;
+	if (i < in.nf)
+	{
+		if (in.planes(f, i, (uint8_t**)pic_in.planes, pic_in.stride))
+			return -1;
+		ppic_in = &pic_in;
+		i++;
+	}
 	x265_nal* p_nal;
 	uint32_t i_nal;
-	size_t acc_bytes = 0;
+	int n = api->encoder_encode(e, &p_nal, &i_nal, ppic_in, &pic_out);
+	if (n < 0 || abort || r.get_state() == res::cancelled)
+		return -1;
+	j += n;
+	if (n)
+		ms[pass] += pic_out.frameData.wallTime;
+	// a flush without output: nothing is left
+	bool end = j >= in.nf || (!ppic_in && !n);
+	if (!pass)
+		return end;
+	for (uint32_t i = 0; i < i_nal; i++)
+	{
+		acc_bytes += p_nal[i].sizeBytes;
+		metrics::bytes_encoded.add(p_nal[i].sizeBytes);
+	}
+	if (n)
+	{
+		size_t n = pic_out.poc >= 0 && pic_out.poc < in.nf ? slot[pic_out.poc] : -1;
+		if (n < ctx->sof.size())
+		{
+			{
+				trace_span span("copy", n);
+				copy(f.h, f.w, f.np, f.ssx, f.ssx, r.data()[n], (uint8_t**)pic_out.planes, pic_out.stride);
+			}
+			r.publish(n);
+			if (ctx->measure)
+				m->push(n);
+			metrics::frames_encoded.add();
+			const x265_frame_stats& fs = pic_out.frameData;
+			metrics::frame_ms.observe(fs.wallTime);
+			// fs.poc restarts at each idr, the output's is the frame index
+			info[n] = { pic_out.poc, (uint32_t)fs.bits, (float)fs.qp, (float)fs.wallTime, fs.sliceType };
+			if (!cu.empty() && read_cu(pic_out.analysisData, IS_X265_TYPE_I(pic_out.sliceType), f, p.maxCUSize, &cu[n]))
+				cu[n] = {};
+		}
+	}
+	return end;
+}
+
+static cpu_usage scaled(const cpu_usage& a, double s)
+{
+	return { a.cpu * s, (uint64_t)(a.cycles * s), (uint64_t)(a.instructions * s), a.peak_rss };
+}
+
+/* a job and its lockstep group, which share the input and frames. one thread drives every
+ * encoder a picture at a time, their own threads encode side by side. cpu time can only be
+ * read for the group, each job is charged in proportion to its encoder's time per frame */
+int x265_encoder::encode(context* ctx, threadpool*)
+{
+	std::vector<context*> group = { ctx };
+	for (auto& _ : ctx->lockstep)
+		group.push_back(_.get());
+	std::vector<std::unique_ptr<member>> all;
+	for (context* c : group)
+	{
+		const x265_key* k = static_cast<const x265_key*>(c->k.get());
+		res& r = *c->r;
+		video_buf_map& in = *c->in;
+		if (r.get_state() != res::queued)
+			continue;
+		format of;
+		if (in.get_format(k->get<x265_key::format_id>(), &of) || r.resize(of, c->sof.size()))
+		{
+			r.set_state(res::failed);
+			continue;
+		}
+		auto m = std::make_unique<member>();
+		m->ctx = c;
+		m->k = k;
+		m->m = std::make_unique<meter>(r.f, &in, c->sof, &r);
+		m->info.resize(c->sof.size());
+		m->cu.resize(c->collect_cu ? c->sof.size() : 0);
+		m->cu_file = c->collect_cu ? stat_file_name(&r) + ".cu" : std::string();
+		m->slot.assign(in.nf, -1);
+		for (size_t n = 0; n < c->sof.size(); n++)
+			if (c->sof[n] >= 0 && c->sof[n] < in.nf)
+				m->slot[c->sof[n]] = (int)n;
+		all.push_back(std::move(m));
+	}
+	cpu_meter cm; // after the metrics threads, which are not the encode's
+	// first passes shared within the group are run once by its first job; outside it a running
+	// one is not waited for, whose owner may be waiting on a first pass of this group
+	auto same = [](const x265_key& a, const x265_key& b) { return !(a < b) && !(b < a); };
+	for (size_t n = 0; n < all.size(); n++)
+	{
+		member& m = *all[n];
+		if (!m.ctx->share_first_pass)
+		{
+			m.fp = std::make_shared<first_pass>();
+			m.fp->stat = stat_file_name(m.fp.get());
+			continue;
+		}
+		for (size_t i = 0; i < n && !m.fp; i++)
+			if (all[i]->own && all[i]->ctx->share_first_pass && all[i]->ctx->in == m.ctx->in && same(first_pass_key(*all[i]->k), first_pass_key(*m.k)))
+				m.fp = all[i]->fp, m.own = 0;
+		if (!m.fp)
+			m.fp = first_pass_acquire(*m.k, m.ctx->in, &m.own, group.size() == 1), m.reused = !m.own;
+	}
+	double pass0_time = 0;
+	cpu_usage pass0_use;
 	time_point_t t0 = std::chrono::high_resolution_clock::now();
 	for (int pass = 0; pass < 2; pass++)
 	{
-		const format& f = ctx->r.f;
-		int csp;
-		if (f2f(f, csp))
-			return -1;
-		const ::x265_api* api = x265_api_query(f.bit_depth, 179, 0);
-		if (!api)
-			return -1;
-		int css = f.bit_depth == 8 ? 0 : 1;
-		copy_f copy = !css ? enqu::copy<uint8_t> : enqu::copy<uint16_t>;
-		::x265_param p;
-		//api->param_default_preset(&p, "ultrafast", 0);
-		api->param_default(&p);
-		p.internalCsp = csp;
-		p.sourceBitDepth = f.bit_depth;
-		p.sourceWidth = f.w;
-		p.sourceHeight = f.h;
-		p.totalFrames = g_nf;
-		p.frameNumThreads = 1;
-		p.lookaheadSlices = 0;
-		p.numaPools = "none";
-		p.bEnableWavefront = 0;
-		p.fpsNum = 24000;
-		p.fpsDenom = 1001;
-		p.bEnablePsnr = 0;
-		p.bAllowNonConformance = 1;
-		p.bCopyPicToFrame = 1;
-		p.logLevel = X265_LOG_NONE;
-		if (pass)
-			p.rc.bStatRead = 2;
-		else
-			p.rc.bStatWrite = 1;
-		api->picture_init(&p, &pic_in);
-		pic_in.colorSpace = csp;
-		pic_in.bitDepth = f.bit_depth;
-		pic_in.stride[0] = f.w << css;
-		pic_in.stride[2] = pic_in.stride[1] = pic_in.stride[0] >> f.ssx;
-		int u_off = pic_in.stride[0] * f.h;
-		int v_off = u_off + (pic_in.stride[1] * f.h >> f.ssx);
-		param_apply_key(&p, k, pass);
-		::x265_encoder* e = api->encoder_open(&p);
-		if (!e)
-			return -1;
-		uint8_t** pp = g_buf->src(f);
-		::x265_picture* ppic_in = &pic_in, * ppic_out = &pic_out;
-		for (int i = 0, j = 0; j < g_nf;)
+		trace_span span(pass ? "pass 1" : "pass 0");
+		std::vector<member*> run;
+		for (auto& m : all)
 		{
-			if (ppic_in)
+			if (!pass && !m->own)
+				continue;
+			if (m->failed || (pass && m->fp->state < 0))
+			{
+				m->failed = 1;
+				continue;
+			}
+			if (m->open(pass))
 			{
-				if (i < g_nf)
+				m->close();
+				m->failed = 1;
+				continue;
+			}
+			run.push_back(m.get());
+		}
+		while (!run.empty())
+			for (size_t n = 0; n < run.size();)
+			{
+				int s = run[n]->step(pass, m_abort);
+				if (!s)
 				{
-					uint8_t* p = *pp++;
-					ppic_in->planes[0] = p;
-					ppic_in->planes[1] = p + u_off;
-					ppic_in->planes[2] = p + v_off;
-					i++;
+					n++;
+					continue;
 				}
-				else
-					ppic_in = 0;
+				run[n]->failed = s < 0;
+				run[n]->close();
+				run.erase(run.begin() + n);
 			}
-			int n = api->encoder_encode(e, &p_nal, &i_nal, ppic_in, ppic_out);
-			if (n < 0 || m_abort)
-			{
-				api->encoder_close(e);
+		if (pass)
+			break;
+		pass0_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+		pass0_use = cm.read();
+		// an equal share where the encoder reported no time
+		double ms = 0, owners = 0;
+		for (auto& m : all)
+			if (m->own)
+				ms += m->ms[0], owners++;
+		for (auto& m : all)
+			if (m->own)
+				first_pass_done(m->fp.get(), !m->failed, pass0_time, scaled(pass0_use, ms > 0 ? m->ms[0] / ms : 1 / owners));
+	}
+	double wall = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+	cpu_usage use = cm.read(), pass1_use = { use.cpu - pass0_use.cpu, use.cycles - pass0_use.cycles, use.instructions - pass0_use.instructions, use.peak_rss };
+	double ms = 0, done = 0;
+	for (auto& m : all)
+		if (!m->failed)
+			ms += m->ms[1], done++;
+	int err = 0;
+	for (auto& m : all)
+	{
+		context* c = m->ctx;
+		res& r = *c->r;
+		video_buf_map& in = *c->in;
+		if (m->own)
+			first_pass_done(m->fp.get(), 0, 0);
+		if (c->collect_cu)
+			std::remove(m->cu_file.c_str());
+		if (m->failed)
+		{
+			if (c == ctx)
+				err = -1;
+			else
+				r.set_state(res::failed);
+			continue;
+		}
+		// a reused first pass is still paid for, fps stays comparable
+		double elapsed_encode_time = wall + (m->reused ? m->fp->time : 0);
+		r.stats = stats::default_stats(m->acc_bytes, elapsed_encode_time, in.nf, (double)in.fps_num / in.fps_den);
+		metrics::job_seconds.observe(elapsed_encode_time);
+		cpu_usage u = scaled(pass1_use, ms > 0 ? m->ms[1] / ms : 1 / done);
+		u.cpu += m->fp->use.cpu;
+		u.cycles += m->fp->use.cycles;
+		u.instructions += m->fp->use.instructions;
+		stats& st = *r.stats;
+		st.pass_time[0] = m->reused ? m->fp->time : pass0_time;
+		st.pass_time[1] = elapsed_encode_time - st.pass_time[0];
+		st.cpu_time = u.cpu;
+		st.cpu_fps = u.cpu > 0 ? in.nf / u.cpu : 0;
+		st.cycles = u.cycles;
+		st.instructions = u.instructions;
+		st.rss_delta = u.peak_rss;
+		m->m->finish(r.stats.get());
+		r.stats->info = std::move(m->info);
+		r.stats->cu = std::move(m->cu);
+		r.stats->update_str();
+		if (!c->keep_frames)
+			r.drop_frames();
+		r.set_state(res::done);
+	}
+	return err;
+}
+
+x265_params::x265_params()
+{
+	name = "x265";
+	e = std::make_unique<enqu::x265_encoder>();
+	if (e->err)
+	{
+		err = -1;
+		return;
+	}
+	key_t::defaults(v);
+}
+
+int x265_params::find(const std::string& name)
+{
+	for (int i = 0; i < key_t::tuple_size; i++)
+		if (name == p[i].name)
+			return i;
+	return -1;
+}
+
+int x265_params::parse(const std::string& text)
+{
+	int i = -1;
+	std::string values;
+	auto flush = [&]
+	{
+		int err = i >= 0 && !values.empty() ? update_params(i, values) : 0;
+		values.clear();
+		return err;
+	};
+	size_t pos = 0;
+	while (pos < text.size())
+	{
+		size_t end = text.find('\n', pos);
+		if (end == std::string::npos)
+			end = text.size();
+		std::string line = text.substr(pos, end - pos);
+		pos = end + 1;
+		if (!line.empty() && line.back() == '\r')
+			line.pop_back();
+		if (line.empty() || line[0] == '#')
+			continue;
+		if (line[0] == '[')
+		{
+			if (flush())
 				return -1;
+			std::string name = line.substr(1, line.find(']') - 1);
+			if ((i = find(name)) < 0)
+				return snprintf(error_msg, sizeof(error_msg), "unknown parameter %s", name.c_str()), -1;
+			continue;
+		}
+		if (i < 0)
+			return snprintf(error_msg, sizeof(error_msg), "value %s outside a [parameter] section", line.c_str()), -1;
+		values += line + '\n';
+	}
+	return flush();
+}
+
+x265_sweep::x265_sweep(const x265_params& x, std::vector<int> axes_, size_t j)
+	: axes(std::move(axes_))
+	, c(x.ctrl[j], x.ctrl[j] + x265_key::tuple_size)
+{
+	if (axes.empty())
+		for (int i = 0; i < x265_key::tuple_size; i++)
+			if (x.v[i].size() > 1)
+				axes.push_back(i);
+	for (int i = 0; i < x265_key::tuple_size; i++)
+		v[i] = x.v[i];
+	for (int i : axes)
+		c[i] = 0;
+}
+
+double x265_sweep::count() const
+{
+	double n = 1;
+	for (int i : axes)
+		n *= v[i].size();
+	return n;
+}
+
+bool x265_sweep::next(x265_key* k)
+{
+	if (end)
+		return 0;
+	*k = x265_key(x265_key::keygen_impl(c.data(), v, std::make_index_sequence<x265_key::tuple_size>{}));
+	size_t n = 0;
+	for (; n < axes.size() && ++c[axes[n]] == v[axes[n]].size(); n++)
+		c[axes[n]] = 0;
+	end = n == axes.size();
+	return 1;
+}
+
+x265_search::x265_search(const x265_params& x, std::vector<int> axes_, size_t j, const objective& o)
+	: axes(std::move(axes_))
+	, o(o)
+{
+	if (axes.empty())
+		for (int i = 0; i < x265_key::tuple_size; i++)
+			if (x.v[i].size() > 1 && i != x265_key::format_id && i != x265_key::bitrate)
+				axes.push_back(i);
+	for (int i = 0; i < x265_key::tuple_size; i++)
+		v[i] = x.v[i];
+	r.c.assign(x.ctrl[j], x.ctrl[j] + x265_key::tuple_size);
+}
+
+x265_search::~x265_search()
+{
+	stop();
+	for (auto& _ : stores)
+		_.second.clear();
+}
+
+void x265_search::stop()
+{
+	b.stop();
+}
+
+x265_search::result x265_search::get() const
+{
+	std::lock_guard lock(mutex);
+	return r;
+}
+
+x265_key x265_search::key(const std::vector<size_t>& c) const
+{
+	return x265_key(x265_key::keygen_impl(c.data(), v, std::make_index_sequence<x265_key::tuple_size>{}));
+}
+
+void x265_search::log(const char* fmt, ...)
+{
+	char tmp[1024];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(tmp, sizeof(tmp), fmt, args);
+	va_end(args);
+	std::lock_guard lock(mutex);
+	r.log += tmp;
+	r.log += '\n';
+}
+
+// encodes points on the first nf frames in parallel, equal keys once per length
+std::vector<std::shared_ptr<res>> x265_search::evaluate(encoder* e, threadpool* pool, const std::shared_ptr<video_buf_map>& in, int nf,
+	const std::vector<std::vector<size_t>>& points)
+{
+	res_store<x265_key>& store = stores[nf];
+	std::shared_ptr<video_buf_map> map = make_prefix_map(in, nf);
+	std::vector<int> sof(nf);
+	for (int n = 0; n < nf; n++)
+		sof[n] = n;
+	std::vector<std::shared_ptr<res>> jobs;
+	for (auto& c : points)
+	{
+		x265_key k = key(c);
+		auto t = store.try_emplace(k);
+		jobs.push_back(t.first);
+		if (!t.second)
+			continue;
+		std::unique_ptr<context> ctx = k.ctx(t.first, e, map, sof);
+		ctx->keep_frames = 0;
+		b.push(pool, std::move(ctx));
+		std::lock_guard lock(mutex);
+		r.encodes++;
+	}
+	b.wait(jobs);
+	return jobs;
+}
+
+int x265_search::run(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in)
+{
+	std::vector<size_t> c = get().c;
+	auto aborted = [this] { return b.stopped(); };
+	auto start = evaluate(e, pool, in, in->nf, { c });
+	if (aborted())
+		return -1;
+	double best = o.score(start[0]->get_stats());
+	{
+		std::lock_guard lock(mutex);
+		r.score = best;
+		if (const stats* st = start[0]->get_stats())
+			r.st = *st;
+	}
+	log("start %.4lf", best);
+	for (int round = 0; round < max_rounds; round++)
+	{
+		bool moved = 0;
+		for (int i : axes)
+		{
+			std::vector<size_t> alive(v[i].size());
+			for (size_t n = 0; n < alive.size(); n++)
+				alive[n] = n;
+			int nf = in->nf;
+			for (size_t n = alive.size(); n > 1 && nf / 2 >= min_frames; n = (n + 1) / 2)
+				nf /= 2;
+			std::shared_ptr<res> winner;
+			size_t value = c[i];
+			for (;;)
+			{
+				std::vector<std::vector<size_t>> points(alive.size(), c);
+				for (size_t n = 0; n < alive.size(); n++)
+					points[n][i] = alive[n];
+				auto batch = evaluate(e, pool, in, nf, points);
+				if (aborted())
+					return -1;
+				std::vector<size_t> order(alive.size());
+				for (size_t n = 0; n < order.size(); n++)
+					order[n] = n;
+				std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b)
+				{
+					return o.score(batch[a]->get_stats()) > o.score(batch[b]->get_stats());
+				});
+				if (nf == in->nf)
+				{
+					winner = batch[order[0]];
+					value = alive[order[0]];
+					break;
+				}
+				// keep the better half, the last survivor goes straight to full length
+				std::vector<size_t> next;
+				for (size_t n = 0; n < (order.size() + 1) / 2; n++)
+					next.push_back(alive[order[n]]);
+				alive = next;
+				nf = alive.size() == 1 ? in->nf : std::min(nf * 2, in->nf);
 			}
-			j += n;
-			if (!pass)
+			double score = o.score(winner->get_stats());
+			if (value == c[i] || score <= best)
 				continue;
-			for (int i = 0; i < i_nal; i++)
-				acc_bytes += p_nal[i].sizeBytes;
-			if (ppic_out && n)
+			c[i] = value;
+			best = score;
+			moved = 1;
 			{
-				size_t n = std::distance(g_sof.begin(), std::find(g_sof.begin(), g_sof.end(), ppic_out->poc));
-				if (n < g_sof.size())
-					copy(f.h, f.w, f.np, f.ssx, f.ssx, ctx->r.data()[n], (uint8_t**)ppic_out->planes, ppic_out->stride);
+				std::lock_guard lock(mutex);
+				r.c = c;
+				r.score = best;
+				r.st = *winner->get_stats();
 			}
+			log("%s = %s: %.4lf", x265_params::p[i].name, x265_params::p[i].p2str(v[i][value]).c_str(), best);
 		}
-		api->encoder_close(e);
-		api->cleanup();
+		if (!moved)
+			break;
 	}
-	double elapsed_encode_time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
-	ctx->r.stats = stats::default_stats(acc_bytes, elapsed_encode_time);
+	log("done, %zu encodes", get().encodes);
 	return 0;
 }
 
-struct x265_ctrl : ctrl
+x265_sensitivity::x265_sensitivity(const x265_params& x, size_t j)
+	: c(x.ctrl[j], x.ctrl[j] + x265_key::tuple_size)
+{
+	for (int i = 0; i < x265_key::tuple_size; i++)
+		v[i] = x.v[i];
+}
+
+x265_sensitivity::~x265_sensitivity()
+{
+	store.clear();
+}
+
+void x265_sensitivity::submit(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in, const std::vector<int>& sof)
+{
+	auto push = [&](const std::vector<size_t>& c)
+	{
+		x265_key k(x265_key::keygen_impl(c.data(), v, std::make_index_sequence<x265_key::tuple_size>{}));
+		auto t = store.try_emplace(k);
+		if (t.second)
+		{
+			std::unique_ptr<context> ctx = k.ctx(t.first, e, in, sof);
+			ctx->keep_frames = 0;
+			pool->push(std::move(ctx));
+		}
+		return t.first;
+	};
+	base = push(c);
+	for (int i = 0; i < x265_key::tuple_size; i++)
+	{
+		if (v[i].size() < 2)
+			continue;
+		std::vector<std::shared_ptr<res>> jobs;
+		for (size_t n = 0; n < v[i].size(); n++)
+		{
+			std::vector<size_t> c_ = c;
+			c_[i] = n;
+			jobs.push_back(push(c_));
+		}
+		fields.emplace_back(i, std::move(jobs));
+	}
+}
+
+bool x265_sensitivity::done() const
+{
+	for (auto& _ : fields)
+		for (auto& r : _.second)
+			if (r->get_state() < res::done)
+				return 0;
+	return 1;
+}
+
+std::vector<x265_sensitivity::impact> x265_sensitivity::ranking() const
 {
-	using key_t = x265_key;
-	std::vector<std::any> v[key_t::tuple_size];
-	size_t ctrl[3][key_t::tuple_size] = {};
-	size_t size() const { return key_t::tuple_size; }
-	std::unique_ptr<key> keygen(size_t i) const
+	std::vector<impact> ret;
+	const stats* b = base ? base->get_stats() : 0;
+	if (!b)
+		return ret;
+	double max[3] = {};
+	for (auto& _ : fields)
 	{
-		return std::make_unique<key_t>(key_t::keygen_impl(ctrl[i], v, std::make_index_sequence<key_t::tuple_size>{}));
+		impact x;
+		x.i = _.first;
+		x.done = 1;
+		double lo[3] = { b->bitrate, b->psnr[3], b->speed() }, hi[3] = { lo[0], lo[1], lo[2] };
+		for (auto& r : _.second)
+		{
+			x.done &= r->get_state() >= res::done;
+			if (const stats* st = r->get_stats())
+			{
+				double m[3] = { st->bitrate, st->psnr[3], st->speed() };
+				for (int n = 0; n < 3; n++)
+					lo[n] = std::min(lo[n], m[n]), hi[n] = std::max(hi[n], m[n]);
+			}
+		}
+		x.bitrate = b->bitrate > 0 ? 100 * (hi[0] - lo[0]) / b->bitrate : 0;
+		x.psnr = hi[1] - lo[1];
+		x.fps = b->speed() > 0 ? 100 * (hi[2] - lo[2]) / b->speed() : 0;
+		max[0] = std::max(max[0], x.bitrate);
+		max[1] = std::max(max[1], x.psnr);
+		max[2] = std::max(max[2], x.fps);
+		ret.push_back(x);
 	}
-	template< size_t I = 0>
-	void update_params(size_t i, const std::string& str)
+	for (impact& x : ret)
+		x.score = (max[0] > 0 ? x.bitrate / max[0] : 0) + (max[1] > 0 ? x.psnr / max[1] : 0) + (max[2] > 0 ? x.fps / max[2] : 0);
+	std::stable_sort(ret.begin(), ret.end(), [](const impact& a, const impact& b) { return a.score > b.score; });
+	return ret;
+}
+
+x265_match::x265_match(const x265_params& x, std::vector<size_t> configs_, double target)
+	: target(target)
+	, configs(std::move(configs_))
+	, r(configs.size())
+{
+	for (size_t j : configs)
+		keys.emplace_back(x265_key::keygen_impl(x.ctrl[j], x.v, std::make_index_sequence<x265_key::tuple_size>{}));
+}
+
+x265_match::~x265_match()
+{
+	stop();
+	proxy.clear();
+	full.clear();
+}
+
+void x265_match::stop()
+{
+	b.stop();
+}
+
+std::vector<x265_match::result> x265_match::get() const
+{
+	std::lock_guard lock(mutex);
+	return r;
+}
+
+static x265_key with_bitrate(x265_key k, double bitrate)
+{
+	std::get<x265_key::bitrate>(k._) = (float)bitrate;
+	return k;
+}
+
+int x265_match::run(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in)
+{
+	int nf = proxy_frames ? std::min(proxy_frames, in->nf) : std::min(in->nf, std::max(8, in->nf / 4));
+	std::shared_ptr<video_buf_map> map = make_prefix_map(in, nf);
+	auto sof = [](int nf)
+	{
+		std::vector<int> _(nf);
+		for (int n = 0; n < nf; n++)
+			_[n] = n;
+		return _;
+	};
+	std::vector<std::pair<double, double>> bracket(keys.size());
+	for (size_t j = 0; j < keys.size(); j++)
+	{
+		double b = keys[j].get<x265_key::bitrate>();
+		bracket[j] = { b / 8, b * 8 };
+	}
+	// each round probes every config at once, then keeps the pair of probes around the target
+	for (int round = 0; round < rounds; round++)
 	{
-		if constexpr (I < key_t::tuple_size)
+		std::vector<std::vector<std::pair<double, std::shared_ptr<res>>>> probe(keys.size());
+		std::vector<std::shared_ptr<res>> jobs;
+		for (size_t j = 0; j < keys.size(); j++)
+		{
+			auto [lo, hi] = bracket[j];
+			for (int n = 0; n <= probes + 1; n++)
+			{
+				double rate = lo * std::pow(hi / lo, (double)n / (probes + 1));
+				x265_key k = with_bitrate(keys[j], rate);
+				auto t = proxy.try_emplace(k);
+				if (t.second)
+				{
+					std::unique_ptr<context> ctx = k.ctx(t.first, e, map, sof(nf));
+					ctx->keep_frames = 0;
+					b.push(pool, std::move(ctx));
+				}
+				probe[j].emplace_back(rate, t.first);
+				jobs.push_back(t.first);
+			}
+		}
+		if (b.wait(jobs))
+			return -1;
+		for (size_t j = 0; j < keys.size(); j++)
 		{
-			if (i != I)
-				update_params<I + 1>(i, str);
+			auto& p = probe[j];
+			auto psnr = [](const std::shared_ptr<res>& r)
+			{
+				const stats* st = r->get_stats();
+				return st ? st->psnr[3] : 0.;
+			};
+			// first probe reaching the target, the bracket ends stay if none or the lowest does
+			size_t n = 0;
+			while (n < p.size() && psnr(p[n].second) < target)
+				n++;
+			if (n > 0 && n < p.size())
+				bracket[j] = { p[n - 1].first, p[n].first };
+			else if (n == p.size())
+				bracket[j] = { p.back().first, p.back().first * 8 };
 			else
-				update_params_impl<key_t::tuple_element_t<I>>(key_t::tuple_size, (size_t*)ctrl + i, v[i], p[i], str.c_str());
+				bracket[j] = { p.front().first / 8, p.front().first };
+			std::lock_guard lock(mutex);
+			r[j].lo = bracket[j].first;
+			r[j].hi = bracket[j].second;
 		}
 	}
-	static const par_t p[/*key_t::tuple_size*/];
-	QGridLayout* g;
-	QDialog* d;
-	QPlainTextEdit* t;
-	QSlider* s[key_t::tuple_size];
-	QLabel* s0[key_t::tuple_size], * s1[key_t::tuple_size];
-	int i = 0, j = 0;
-	x265_ctrl(QGridLayout* g, QWidget* parent)
-		: g(g)
-	{
-		name = "x265";
-		e = std::make_unique<enqu::x265_encoder>();
-		if (e->err)
+	// log rate interpolated inside the last bracket, from its measured ends
+	std::vector<std::shared_ptr<res>> jobs;
+	for (size_t j = 0; j < keys.size(); j++)
+	{
+		auto [lo, hi] = bracket[j];
+		auto measured = [&](double rate) -> const stats*
 		{
-			err = -1;
-			return;
+			std::shared_ptr<res> r = proxy.find(with_bitrate(keys[j], rate)); // kept alive by the store
+			return r ? r->get_stats() : 0;
+		};
+		const stats* a = measured(lo), * z = measured(hi);
+		double rate = std::sqrt(lo * hi);
+		if (a && z && z->psnr[3] > a->psnr[3])
+		{
+			double t = std::clamp((target - a->psnr[3]) / (z->psnr[3] - a->psnr[3]), 0., 1.);
+			rate = lo * std::pow(hi / lo, t);
 		}
-		key_t::defaults(v);
-		d = new QDialog(parent);
-		d->setWindowModality(Qt::ApplicationModal);
-		d->resize(256, 256);
-		t = new QPlainTextEdit(d);
-		t->setGeometry(QRect(0, 0, 256, 256));
-		QObject::connect(d, &QDialog::finished, [this](int)
+		x265_key k = with_bitrate(keys[j], rate);
+		auto t = full.try_emplace(k);
+		if (t.second)
 		{
-			std::string text = t->toPlainText().toStdString();
-			update_params(i, text);
-			s[i]->setRange(0, v[i].size() - 1);
-			update_slider(i);
-			g_layout->pixmap_update(g_si);
-		});
-		for (int i = 0; i < key_t::tuple_size; i++)
+			std::unique_ptr<context> ctx = k.ctx(t.first, e, in, sof(in->nf));
+			ctx->keep_frames = 0;
+			b.push(pool, std::move(ctx));
+		}
+		jobs.push_back(t.first);
+		std::lock_guard lock(mutex);
+		r[j].bitrate = rate;
+	}
+	if (b.wait(jobs))
+		return -1;
+	std::lock_guard lock(mutex);
+	for (size_t j = 0; j < keys.size(); j++)
+	{
+		if (const stats* st = jobs[j]->get_stats())
+			r[j].st = *st;
+		r[j].done = 1;
+	}
+	return 0;
+}
+
+std::string x265_match::report() const
+{
+	std::string ret;
+	char tmp[256];
+	std::vector<result> r = get();
+	for (size_t j = 0; j < r.size(); j++)
+	{
+		if (r[j].done)
+			sprintf(tmp, "%zu: psnr %.3lf at %.1lf kbps (asked %.1lf), %.2lf s, %.2lf fps\n", configs[j] + 2,
+				r[j].st.psnr[3], r[j].st.bitrate, r[j].bitrate, r[j].st.time, r[j].st.fps);
+		else
+			sprintf(tmp, "%zu: %.1lf - %.1lf kbps\n", configs[j] + 2, r[j].lo, r[j].hi);
+		ret += tmp;
+	}
+	return ret;
+}
+
+x265_bench::x265_bench(std::vector<x265_key> keys_)
+	: keys(std::move(keys_))
+	, r(keys.size())
+{
+}
+
+x265_bench::~x265_bench()
+{
+	stop();
+}
+
+void x265_bench::stop()
+{
+	b.stop();
+}
+
+std::vector<x265_bench::result> x265_bench::get() const
+{
+	std::lock_guard lock(mutex);
+	return r;
+}
+
+size_t x265_bench::fastest() const
+{
+	std::lock_guard lock(mutex);
+	size_t best = 0;
+	for (size_t j = 1; j < r.size(); j++)
+		if (r[j].s.median > r[best].s.median)
+			best = j;
+	return best;
+}
+
+int x265_bench::run(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in)
+{
+	std::vector<int> sof(in->nf);
+	for (int n = 0; n < in->nf; n++)
+		sof[n] = n;
+	int err = 0;
+	for (int round = 0; round < warmup + runs; round++)
+		for (size_t j = 0; j < keys.size(); j++)
 		{
-			auto q2 = new QSlider(Qt::Orientation::Horizontal);
-			q2->setTickPosition(QSlider::TickPosition::TicksBothSides);
-			q2->setRange(0, v[i].size() - 1);
-			q2->setFixedWidth(100);
-			auto q1 = new QLabel(p[i].name);
-			if (p[i].desc)
-				q1->setToolTip(p[i].desc);
-			q1->setFixedWidth(100);
-			auto q3 = new elabel();
-			q3->setBackgroundRole(QPalette::BrightText);
-			q3->setAutoFillBackground(true);
-			QObject::connect(q3, &elabel::pressed, [this, i]()
+			auto job = std::make_shared<res>();
+			std::unique_ptr<context> ctx = keys[j].ctx(job, e, in, sof);
+			ctx->keep_frames = 0;
+			ctx->share_first_pass = 0;
+			ctx->measure = 0;
+			b.push(pool, std::move(ctx));
+			if (b.wait({ job }))
+				return -1;
+			const stats* st = job->get_stats();
+			std::lock_guard lock(mutex);
+			if (job->get_state() != res::done || !st)
 			{
-				std::string text;
-				for (int j = 0; j < v[i].size(); j++)
-					text += p[i].p2str(v[i][j]) + '\n';
-				t->setPlainText(QString::fromStdString(text));
-				t->moveCursor(QTextCursor::MoveOperation::End);
-				t->setWindowTitle(QString::fromStdString(p[i].name));
-				this->i = i; // save
-				d->show();
-			});
-			QObject::connect(q2, &QAbstractSlider::sliderMoved, [this, i](int n)
+				r[j].failed++;
+				err = -1;
+				continue;
+			}
+			if (round < warmup)
+				continue;
+			r[j].fps.push_back(st->fps);
+			r[j].bitrate = st->bitrate;
+			r[j].s = summarize(r[j].fps);
+		}
+	size_t best = fastest();
+	std::lock_guard lock(mutex);
+	for (size_t j = 0; j < r.size(); j++)
+		r[j].p = j == best ? 1 : mann_whitney_p(r[j].fps, r[best].fps);
+	return err;
+}
+
+std::string x265_bench::report(const std::vector<std::string>& names) const
+{
+	std::string ret;
+	char tmp[512];
+	std::vector<result> r = get();
+	size_t best = fastest();
+	for (size_t j = 0; j < r.size(); j++)
+	{
+		const sample_summary& s = r[j].s;
+		sprintf(tmp, "%s: %.3lf fps, mad %.3lf, %.0lf%% ci %.3lf - %.3lf, %zu runs, %.1lf kbps", j < names.size() ? names[j].c_str() : "",
+			s.median, s.mad, s.level * 100, s.lo, s.hi, s.n, r[j].bitrate);
+		ret += tmp;
+		if (r[j].failed)
+			ret += ", " + std::to_string(r[j].failed) + " failed";
+		if (j == best)
+			ret += ", fastest\n";
+		else
+		{
+			sprintf(tmp, ", %+.2lf%% p %.4lf%s\n", r[best].s.median > 0 ? (s.median / r[best].s.median - 1) * 100 : 0., r[j].p,
+				r[j].p > alpha ? " not significant" : "");
+			ret += tmp;
+		}
+	}
+	return ret;
+}
+
+x265_chunked::x265_chunked(const x265_key& k, int chunks)
+	: chunks(chunks)
+	, k(k)
+{
+}
+
+x265_chunked::~x265_chunked()
+{
+	stop();
+}
+
+void x265_chunked::stop()
+{
+	b.stop();
+}
+
+x265_chunked::result x265_chunked::get() const
+{
+	std::lock_guard lock(mutex);
+	return r;
+}
+
+int x265_chunked::run(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in, std::shared_ptr<res> whole, const stats* ref)
+{
+	format of;
+	int nf = in->nf;
+	if (in->get_format(k.get<x265_key::format_id>(), &of) || whole->resize(of, nf) || !whole->set_state(res::pass2))
+		return -1;
+	std::vector<int> cut = scene_cuts(in.get());
+	std::vector<int> bounds = chunk_bounds(cut, nf, chunks > 0 ? chunks : (int)pool->size(), min_frames);
+	std::vector<chunk> c;
+	for (size_t i = 0; i + 1 < bounds.size(); i++)
+		c.push_back({ bounds[i], bounds[i + 1] - bounds[i], 0, std::binary_search(cut.begin(), cut.end(), bounds[i]) });
+	{
+		std::lock_guard lock(mutex);
+		r = {};
+		r.c = c;
+		r.target = k.get<x265_key::bitrate>();
+		jobs.clear();
+		for (size_t i = 0; i < c.size(); i++)
+			jobs.push_back(std::make_shared<res>());
+	}
+	time_point_t t0 = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < c.size(); i++)
+	{
+		std::vector<int> sof(c[i].nf);
+		for (int n = 0; n < c[i].nf; n++)
+			sof[n] = n;
+		std::unique_ptr<context> ctx = k.ctx(jobs[i], e, make_range_map(in, c[i].first, c[i].nf), sof);
+		ctx->share_first_pass = 0;
+		b.push(pool, std::move(ctx));
+	}
+	if (b.wait(jobs))
+	{
+		whole->cancel();
+		return -1;
+	}
+	double time = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - t0).count();
+	auto st = std::make_unique<stats>();
+	std::vector<frame_quality> fq;
+	double bits = 0, join_bits = 0, frame_bits = 0;
+	size_t frame_size = of.frame_size();
+	for (size_t i = 0; i < c.size(); i++)
+	{
+		const stats* s = jobs[i]->get_stats();
+		if (!s)
+		{
+			whole->set_state(res::failed);
+			return -1;
+		}
+		for (int n = 0; n < c[i].nf; n++)
+			if (uint8_t* p = jobs[i]->frame(n))
 			{
-				update_string(i, n);
-				ctrl[j][i] = n;
-				g_layout->pixmap_update(g_si);
-			});
-			s0[i] = q1;
-			s[i] = q2;
-			s1[i] = q3;
-			g->addWidget(q1, i, 0);
-			g->addWidget(q2, i, 1);
-			g->addWidget(q3, i, 2);
+				memcpy(whole->data()[c[i].first + n], p, frame_size);
+				whole->publish(c[i].first + n);
+			}
+		bits += s->bitrate * c[i].nf;
+		c[i].bitrate = s->bitrate;
+		if (s->frame.size() == (size_t)c[i].nf)
+			fq.insert(fq.end(), s->frame.begin(), s->frame.end());
+		else
+			fq.resize(fq.size() + c[i].nf);
+		for (int n = 0; n < c[i].nf; n++)
+		{
+			frame_info fi = n < (int)s->info.size() ? s->info[n] : frame_info();
+			if (fi.poc >= 0)
+				fi.poc += c[i].first;
+			st->info.push_back(fi);
+			frame_bits += fi.bits;
 		}
+		// frame 0 of a chunk is its idr
+		if (!c[i].at_cut && !s->info.empty())
+			join_bits += s->info[0].bits;
+		for (int p = 0; p < 2; p++)
+			st->pass_time[p] = std::max(st->pass_time[p], s->pass_time[p]);
+		st->cpu_time += s->cpu_time;
+		st->cycles += s->cycles;
+		st->instructions += s->instructions;
+		st->rss_delta = std::max(st->rss_delta, s->rss_delta);
 	}
-	void update_string(int i, int j)
+	st->bitrate = bits / nf;
+	st->time = time;
+	st->fps = nf / time;
+	st->cpu_fps = st->cpu_time > 0 ? nf / st->cpu_time : 0;
+	aggregate(st.get(), of, fq.data(), fq.size());
+	double psnr[2] = {};
+	int count[2] = {};
+	for (int n = 0; n < nf; n++)
 	{
-		if (s1[i])
-			s1[i]->setText(QString::fromStdString(p[i].p2str(v[i][j])));
+		if (!fq[n].valid)
+			continue;
+		bool near = std::any_of(bounds.begin() + 1, bounds.end() - 1, [n](int j) { return n >= j - 4 && n < j + 4; });
+		psnr[near] += frame_psnr(of, fq[n]);
+		count[near]++;
 	}
-	void update_slider(int i)
 	{
-		if (s[i])
+		std::lock_guard lock(mutex);
+		r.c = c;
+		r.bitrate = st->bitrate;
+		r.psnr = st->psnr[3];
+		r.join_bits = frame_bits > 0 ? join_bits / frame_bits : 0;
+		r.other_psnr = count[0] ? psnr[0] / count[0] : 0;
+		r.join_psnr = count[1] ? psnr[1] / count[1] : 0;
+		r.time = time;
+		// stitched, the chunks' frames go with the last holder of their results
+		jobs.clear();
+		if (ref)
+		{
+			r.ref = 1;
+			r.ref_bitrate = ref->bitrate;
+			r.ref_psnr = ref->psnr[3];
+			r.ref_time = ref->time;
+		}
+		r.done = 1;
+	}
+	st->update_str();
+	st->str += '\n' + report();
+	whole->stats = std::move(st);
+	whole->set_state(res::done);
+	return 0;
+}
+
+std::string x265_chunked::report() const
+{
+	std::lock_guard lock(mutex);
+	std::string ret;
+	char tmp[512];
+	size_t at_cut = std::count_if(r.c.begin() + std::min<size_t>(1, r.c.size()), r.c.end(), [](const chunk& _) { return _.at_cut; });
+	sprintf(tmp, "%zu chunks, %zu of %zu joins at scene cuts\n", r.c.size(), at_cut, r.c.empty() ? 0 : r.c.size() - 1);
+	ret += tmp;
+	double lo = 1e9, hi = -1e9;
+	for (size_t i = 0; i < r.c.size(); i++)
+	{
+		const chunk& c = r.c[i];
+		if (r.done)
 		{
-			int n = ctrl[j][i];
-			s[i]->setSliderPosition(n);
-			bool enabled = v[i].size() > 1;
-			if (s[i]->isEnabled() == !enabled)
-				s[i]->setDisabled(!enabled);
-			update_string(i, n);
+			double error = r.target > 0 ? (c.bitrate / r.target - 1) * 100 : 0;
+			lo = std::min(lo, error);
+			hi = std::max(hi, error);
+			sprintf(tmp, "%d-%d: %.1lf kbps, %+.2lf%%\n", c.first, c.first + c.nf - 1, c.bitrate, error);
 		}
+		else
+			sprintf(tmp, "%d-%d: %s\n", c.first, c.first + c.nf - 1, i < jobs.size() ? res::state_name(jobs[i]->get_state()) : "");
+		ret += tmp;
 	}
-	void update(int j_)
+	if (!r.done)
+		return ret;
+	sprintf(tmp, "bitrate %.1lf kbps, target %.0lf, error %+.2lf%% (chunks %+.2lf%% to %+.2lf%%)\n", r.bitrate, r.target,
+		r.target > 0 ? (r.bitrate / r.target - 1) * 100 : 0., lo, hi);
+	ret += tmp;
+	sprintf(tmp, "idr at joins off cuts %.2lf%% of the bits, psnr within 4 frames of a join %.3lf, elsewhere %.3lf\n",
+		r.join_bits * 100, r.join_psnr, r.other_psnr);
+	ret += tmp;
+	if (r.ref)
 	{
-		j = j_;
-		for (int i = 0; i < key_t::tuple_size; i++)
-			update_slider(i);
+		sprintf(tmp, "against unchunked: bitrate %+.2lf%%, psnr %+.3lf dB, %.2lfx faster\n", r.ref_bitrate > 0 ? (r.bitrate / r.ref_bitrate - 1) * 100 : 0.,
+			r.ref_psnr > 0 && r.psnr > 0 ? r.psnr - r.ref_psnr : 0., r.time > 0 ? r.ref_time / r.time : 0.);
+		ret += tmp;
 	}
-};
+	return ret;
+}
+
+x265_ladder::x265_ladder(const x265_params& x)
+{
+	for (size_t j = 0; j < 3; j++)
+		c[j].assign(x.ctrl[j], x.ctrl[j] + x265_key::tuple_size);
+	for (int i = 0; i < x265_key::tuple_size; i++)
+		v[i] = x.v[i];
+}
+
+x265_ladder::~x265_ladder()
+{
+	store.clear();
+}
+
+// rungs interleaved across configs, so partial curves grow together
+void x265_ladder::submit(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in, const std::vector<int>& sof)
+{
+	for (size_t n = 0; n < v[x265_key::bitrate].size(); n++)
+		for (size_t j = 0; j < 3; j++)
+		{
+			std::vector<size_t> c_ = c[j];
+			c_[x265_key::bitrate] = n;
+			x265_key k(x265_key::keygen_impl(c_.data(), v, std::make_index_sequence<x265_key::tuple_size>{}));
+			auto t = store.try_emplace(k);
+			if (t.second)
+			{
+				std::unique_ptr<context> ctx = k.ctx(t.first, e, in, sof);
+				ctx->keep_frames = 0;
+				pool->push(std::move(ctx));
+			}
+			rungs[j].push_back(t.first);
+		}
+}
+
+bool x265_ladder::done() const
+{
+	for (auto& _ : rungs)
+		for (auto& r : _)
+			if (r->get_state() < res::done)
+				return 0;
+	return 1;
+}
+
+std::vector<std::pair<double, double>> x265_ladder::curve(size_t j) const
+{
+	std::vector<std::pair<double, double>> ret;
+	for (auto& r : rungs[j])
+		if (const stats* st = r->get_stats())
+			ret.emplace_back(st->bitrate, st->psnr[3]);
+	return ret;
+}
+
+std::string x265_ladder::report() const
+{
+	std::string ret;
+	char tmp[256];
+	for (size_t j = 0; j < 3; j++)
+	{
+		sprintf(tmp, "%zu:", j + 2);
+		ret += tmp;
+		for (auto& r : rungs[j])
+		{
+			if (const stats* st = r->get_stats())
+				sprintf(tmp, " %.1lf/%.3lf", st->bitrate, st->psnr[3]);
+			else
+				sprintf(tmp, " %s", res::state_name(r->get_state()));
+			ret += tmp;
+		}
+		ret += '\n';
+	}
+	for (size_t j = 1; j < 3; j++)
+	{
+		double rate, psnr;
+		if (bd_rate(curve(0), curve(j), &rate) || bd_psnr(curve(0), curve(j), &psnr))
+			sprintf(tmp, "%zu vs 2: not enough overlapping rungs\n", j + 2);
+		else
+			sprintf(tmp, "%zu vs 2: bd-rate %+.2lf%%, bd-psnr %+.3lf dB\n", j + 2, rate, psnr);
+		ret += tmp;
+	}
+	return ret;
+}
+
+template< size_t... index>
+static std::string key_str(const x265_key& k, std::index_sequence<index...>)
+{
+	std::string s;
+	auto field = [&](size_t i, auto x)
+	{
+		s += std::string("[") + x265_params::p[i].name + "]\n";
+		if constexpr (std::is_floating_point_v<decltype(x)>)
+		{
+			char tmp[40];
+			sprintf(tmp, "%.9g", (double)x);
+			s += tmp;
+		}
+		else
+			s += x265_params::p[i].p2str(x);
+		s += '\n';
+	};
+	(field(index, k.get<index>()), ...);
+	return s;
+}
 
-std::unique_ptr<ctrl> make_x265_ctrl(QGridLayout* g, QWidget* parent)
+std::string x265_key::str() const
 {
-	return std::make_unique<x265_ctrl>(g, parent);
+	return key_str(*this, std::make_index_sequence<tuple_size>{});
+}
+
+std::vector<std::string> x265_key::features() const
+{
+	std::vector<std::string> _;
+	std::string s = str(), name;
+	for (size_t i = 0, j; i < s.size(); i = j + 1)
+	{
+		j = s.find('\n', i);
+		std::string line = s.substr(i, j - i);
+		if (line.size() > 1 && line[0] == '[')
+			name = line.substr(1, line.size() - 2);
+		else
+			_.push_back(name + '=' + line);
+	}
+	return _;
 }
 
 #define X(T) enqu::p2str<x265_key::tuple_element_t<x265_key::T>>, enqu::str2p<x265_key::tuple_element_t<x265_key::T>>
-const par_t x265_ctrl::p[] = {
+const par_t x265_params::p[] = {
 { "format", enqu::p2str<format>, enqu::str2p<format> },
 { "bitrate", X(bitrate) },
 { "keyint", X(keyint) },
@@ -585,142 +1631,9 @@ const par_t x265_ctrl::p[] = {
 { "b_intra", X(b_intra) },
 { "fast_intra", X(fast_intra) },
 { "rdpenalty", X(rdpenalty) },
+{ "lib", enqu::p2str<x265_lib>, enqu::str2p<x265_lib>, "x265 shared library to encode with, a path or default for the one linked. Libraries are loaded once and must fill the same structs as the x265.h enqu was built against (same X265_BUILD); with several bit depths per library its x265_api_query picks them as usual" },
 };
 #undef X
-static_assert(x265_key::tuple_size == sizeof(x265_ctrl::p) / sizeof(par_t));
-
-class x265_layout : public layout
-{
-	QScrollArea* scroll;
-	QGridLayout* grid;
-	std::unique_ptr<enqu::ctrl> ctrl;
-	std::map<x265_key, res> q;
-	std::unique_ptr<threadpool> pool;
-	int cj = -1;
-public:
-	x265_layout(QTabWidget*);
-	~x265_layout()
-	{
-	}
-	int pixmap_update(int);
-	void input_changed();
-	bool event(QObject*, QEvent*);
-protected:
-	void process(int);
-	void cj_changed(int);
-};
-
-std::unique_ptr<layout> make_x265_layout(QTabWidget* tab)
-{
-	return std::make_unique<x265_layout>(tab);
-}
-
-void x265_layout::cj_changed(int n)
-{
-	int _cj = std::abs(cj);
-	if (n)
-	{
-		if (cj < 0)
-			scroll->setDisabled(0);
-		if (_cj != n)
-			ctrl->update(n - 1);
-		cj = n;
-	}
-	else
-	{
-		if (cj > 0)
-			scroll->setDisabled(1);
-		cj = -_cj;
-	}
-	pixmap_update(g_si);
-}
-
-x265_layout::x265_layout(QTabWidget* stack)
-	: layout(stack)
-{
-	pool = std::make_unique<threadpool>();
-	pool->start(1);
-	scroll = new QScrollArea;
-	QWidget* w = new QWidget;
-	grid = new QGridLayout(w);
-	grid->setSizeConstraint(QLayout::SetMinAndMaxSize);
-	ctrl = make_x265_ctrl(grid, scroll);
-	if (ctrl->err)
-		ctrl.reset();
-	else
-		ctrl->update(0);
-	scroll->setDisabled(true);
-	scroll->setWidget(w);
-	stack->addTab(scroll, "");
-}
-
-bool x265_layout::event(QObject* obj, QEvent* event)
-{
-	int type = event->type();
-	if (type == QEvent::KeyPress)
-	{
-		QKeyEvent* key_event = static_cast<QKeyEvent*>(event);
-		int key = key_event->key(), modifiers = key_event->modifiers();
-		switch (key)
-		{
-		case Qt::Key_1:
-			cj_changed(0);
-			break;
-		case Qt::Key_2:
-			cj_changed(1);
-			break;
-		case Qt::Key_3:
-			cj_changed(2);
-			break;
-		case Qt::Key_4:
-			cj_changed(3);
-			break;
-		case Qt::Key_F5:
-			if (cj > 0 && g_buf) process(0);
-			break;
-		default:
-			return 0;
-		}
-		return 1;
-	}
-	return 0;
-}
-
-void x265_layout::input_changed()
-{
-	q.clear();
-}
-
-int x265_layout::pixmap_update(int si)
-{
-	if (cj < 0)
-		return enqu::pixmap_update(si);
-	auto pk = ctrl->keygen(cj - 1);
-	auto& k = *static_cast<x265_key*>(pk.get());
-	if (!q.count(k) || q.at(k).empty())
-	{
-		QPixmap px;
-		g_pixmap->setPixmap(px);
-		g_stats->setText(QString());
-	}
-	else
-	{
-		auto v = &q.at(k);
-		int w = g_of.w, h = g_of.h;
-		g_pixmap->setPixmap(QPixmap::fromImage(QImage((const uchar*)g_buf->out(h, w, v->buf[si], v->f), w, h, QImage::Format_RGB32)));
-		if (v->stats)
-			g_stats->setText(QString::fromStdString(v->stats->str));
-	}
-	return 0;
-}
-
-void x265_layout::process(int)
-{
-	auto pk = ctrl->keygen(cj - 1);
-	auto& k = *static_cast<x265_key*>(pk.get());
-	auto t = q.try_emplace(k);
-	if (t.second)
-		pool->push(t.first->first.ctx(t.first->second, ctrl->e.get()));
-}
+static_assert(x265_key::tuple_size == sizeof(x265_params::p) / sizeof(par_t));
 
 }
@@ -1,3 +1,487 @@
+struct x265_param;
+struct x265_api;
+
 namespace enqu {
-std::unique_ptr<layout> make_x265_layout(QTabWidget*);
+
+/* tag of the lib field: x265 shared libraries loaded at runtime by path and known by an id,
+ * 0 the one linked ("default"). p2str / str2p map between the two, str2p loads the library
+ * and refuses one whose public structs differ from the x265.h compiled against */
+struct x265_lib;
+
+struct x265_key : tuple_key_t<std::tuple<
+	int, float, int, int, int, int,
+	int, int, int, bool_t,
+	int, float, float, bool_t, int, bool_t, float, int, int, int,
+	int, int, int, int, int, int, bool_t, bool_t, bool_t,
+	std::array<int, 2>, float, int, float, float, bool_t, std::array<bool_t, 2>, bool_t, int, bool_t, bool_t,
+	std::array<int, 2>, std::array<int, 2>, int, int, int, int, bool_t, bool_t, bool_t, bool_t,
+	bool_t, std::tuple<int, int, int>, std::tuple<int, int, int>,
+	std::tuple<bool_t, int, int>,
+	bool_t, bool_t, bool_t, int,
+	bool_t, bool_t, std::array<bool_t, 2>, int,
+	int>>
+{
+	enum id {
+		format_id, bitrate, keyint, min_keyint, gop_lookahead, rc_lookahead,
+		bframes, bframe_bias, b_adapt, b_pyramid,
+		aq_mode, aq_strength, qp_adaptation_range, aq_motion, qg_size, cutree, qcomp, qpstep, cbqpoffs, crqpoffs,
+		max_cu_size, min_cu_size, max_tu_size, tu_intra_depth, tu_inter_depth, limit_tu, weightp, weightb, tskip,
+		rd, psy_rd, rdoq_level, psy_rdoq, dynamic_rd, ssim_rd, rd_refine, early_skip, rskip, tskip_fast, splitrd_skip,
+		max_merge, ref, limit_refs, me, subme, merange, rect, amp, limit_modes, temporal_mvp,
+		hme, hme_search, hme_range,
+		deblock,
+		sao, sao_non_deblock, limit_sao, selective_sao,
+		strong_intra_smoothing, b_intra, fast_intra, rdpenalty,
+		lib,
+	};
+	x265_key() = default;
+	x265_key(const tuple_t& _)
+		: tuple_key_t(_)
+	{
+	}
+	static void defaults(std::vector<std::any>* v)
+	{
+		v[format_id].emplace_back((int)pfYUV420P8);
+		v[format_id].emplace_back((int)pfYUV420P10);
+		v[bitrate].emplace_back(200.f);
+		v[max_cu_size].emplace_back(32);
+		v[min_cu_size].emplace_back(8);
+		v[max_tu_size].emplace_back(32);
+		v[tu_intra_depth].emplace_back(1);
+		v[tu_inter_depth].emplace_back(1);
+		v[limit_tu].emplace_back(0);
+		v[weightp].emplace_back(0_b);
+		v[weightb].emplace_back(0_b);
+		v[tskip].emplace_back(0_b);
+		v[rd].emplace_back(std::array<int, 2>{ 6, 6 });
+		v[psy_rd].emplace_back(1.f);
+		v[rdoq_level].emplace_back(2);
+		v[psy_rdoq].emplace_back(5.f);
+		v[dynamic_rd].emplace_back(0.f);
+		v[ssim_rd].emplace_back(0_b);
+		v[rd_refine].emplace_back(std::array<bool_t, 2>{ 0_b, 0_b });
+		v[early_skip].emplace_back(1_b);
+		v[rskip].emplace_back(0);
+		v[tskip_fast].emplace_back(0_b);
+		v[splitrd_skip].emplace_back(0_b);
+		v[max_merge].emplace_back(std::array<int, 2>{ 2, 2 });
+		v[ref].emplace_back(std::array<int, 2>{ 5, 5 });
+		v[limit_refs].emplace_back(1);
+		v[me].emplace_back(1);
+		v[subme].emplace_back(2);
+		v[merange].emplace_back(57);
+		v[rect].emplace_back(0_b);
+		v[amp].emplace_back(0_b);
+		v[limit_modes].emplace_back(0_b);
+		v[temporal_mvp].emplace_back(1_b);
+		v[hme].emplace_back(0_b);
+		v[hme_search].emplace_back(std::make_tuple(1, 1, 3));
+		v[hme_range].emplace_back(std::make_tuple(16, 16, 16));
+		v[strong_intra_smoothing].emplace_back(0_b);
+		v[b_intra].emplace_back(0_b);
+		v[fast_intra].emplace_back(std::array<bool_t, 2>{ 1_b, 1_b });
+		v[rdpenalty].emplace_back(0);
+		v[keyint].emplace_back(250);
+		v[min_keyint].emplace_back(0);
+		v[gop_lookahead].emplace_back(0);
+		v[rc_lookahead].emplace_back(20);
+		v[bframes].emplace_back(5);
+		v[bframe_bias].emplace_back(0);
+		v[b_adapt].emplace_back(2);
+		v[b_pyramid].emplace_back(1_b);
+		v[aq_mode].emplace_back(3);
+		v[aq_strength].emplace_back(1.f);
+		v[qp_adaptation_range].emplace_back(1.f);
+		v[aq_motion].emplace_back(0_b);
+		v[qg_size].emplace_back(16);
+		v[cutree].emplace_back(0_b);
+		v[qcomp].emplace_back(.6f);
+		v[qpstep].emplace_back(4);
+		v[cbqpoffs].emplace_back(0);
+		v[crqpoffs].emplace_back(0);
+		v[deblock].emplace_back(std::make_tuple(0_b, 0, 0));
+		v[sao].emplace_back(1_b);
+		v[sao_non_deblock].emplace_back(1_b);
+		v[limit_sao].emplace_back(0_b);
+		v[selective_sao].emplace_back(0);
+		v[lib].emplace_back(0);
+	}
+	bool operator<(const key& x_) const
+	{
+		const x265_key* x = static_cast<const x265_key*>(&x_);
+#define P(N) { if (get<N>() < x->get<N>()) return 1; if (x->get<N>() < get<N>()) return 0; }
+		P(format_id);
+		P(lib);
+		P(bitrate);
+		P(keyint);
+		P(min_keyint);
+		P(gop_lookahead);
+		P(rc_lookahead);
+		P(bframes);
+		P(bframe_bias);
+		P(b_adapt);
+		P(b_pyramid);
+		P(aq_mode);
+		P(aq_strength);
+		P(qp_adaptation_range);
+		P(aq_motion);
+		P(qg_size);
+		P(cutree);
+		P(qcomp);
+		P(qpstep);
+		P(cbqpoffs);
+		P(crqpoffs);
+		P(max_cu_size);
+		P(min_cu_size);
+		P(max_tu_size);
+		P(tu_intra_depth);
+		P(tu_inter_depth);
+		P(limit_tu);
+		P(weightp);
+		P(weightb);
+		P(tskip);
+		P(rd);
+		P(rdoq_level);
+		if (get<rdoq_level>())
+			P(psy_rdoq);
+		P(dynamic_rd);
+		P(ssim_rd);
+		if (!get<ssim_rd>())
+			P(psy_rd);
+		P(rd_refine);
+		P(early_skip);
+		P(rskip);
+		P(tskip_fast);
+		P(splitrd_skip);
+		P(max_merge);
+		P(ref);
+		P(limit_refs);
+		P(subme);
+		P(rect);
+		P(amp);
+		P(limit_modes);
+		P(temporal_mvp);
+		P(hme);
+		if (get<hme>())
+		{
+			P(hme_search);
+			P(hme_range);
+		}
+		else
+		{
+			P(me);
+			P(merange);
+		}
+		P(deblock);
+		P(sao);
+		P(sao_non_deblock);
+		P(limit_sao);
+		P(selective_sao);
+		P(strong_intra_smoothing);
+		P(b_intra);
+		P(fast_intra);
+		P(rdpenalty);
+#undef P
+		return 0;
+	}
+	std::unique_ptr<context> ctx(std::shared_ptr<res> r, encoder* e, std::shared_ptr<video_buf_map> in, const std::vector<int>& sof) const
+	{
+		return std::make_unique<context>(std::make_unique<x265_key>(*this), std::move(r), e, std::move(in), sof);
+	}
+	// every field as a [name] section, as x265_params::parse reads, floats exact
+	std::string str() const;
+	std::vector<std::string> features() const;
+};
+
+struct x265_encoder : encoder
+{
+	x265_encoder();
+	~x265_encoder();
+	int encode(context*, threadpool*);
+	static void param_apply_key(::x265_param*, const x265_key*, int);
+private:
+	struct first_pass
+	{
+		std::weak_ptr<video_buf_map> in;
+		std::string stat;
+		int state = 0; // running, done, -1 failed
+		double time = 0;
+		cpu_usage use;
+		size_t seq = 0;
+		~first_pass();
+	};
+	std::mutex cache_mutex;
+	std::condition_variable cache_cv;
+	std::map<std::pair<const video_buf_map*, x265_key>, std::shared_ptr<first_pass>> cache;
+	size_t seq = 0;
+	std::shared_ptr<first_pass> first_pass_acquire(const x265_key&, const std::shared_ptr<video_buf_map>&, bool* own, bool wait = 1);
+	void first_pass_done(first_pass*, bool ok, double time, const cpu_usage& use = {});
+	struct member;
+};
+
+/* encodes in enqu-worker processes, so that an encoder crash or assert fails the job and not
+ * the session. the frames of each input and format are placed once in posix shared memory
+ * that local workers map read only, keys go as text over a socket and reconstructions come
+ * back in shared memory, stats serialized. workers on other machines (enqu-worker -l) get
+ * the same messages with the frames inline. a worker runs one job at a time, the pool wants
+ * one thread per worker; one that dies fails its job and is started again for the next.
+ * posix only, err is set elsewhere. block decisions (context::collect_cu) are not returned */
+struct x265_remote_encoder : encoder
+{
+	/* comma separated: a number of local workers, host:port of a listening enqu-worker,
+	 * host:port*n for n connections to it. local workers are the enqu-worker next to the
+	 * executable, else the one in PATH */
+	x265_remote_encoder(const std::string& spec);
+	~x265_remote_encoder();
+	int encode(context*, threadpool*);
+	size_t size() const { return workers.size(); }
+	struct worker;
+	struct segment;
+private:
+	std::vector<std::unique_ptr<worker>> workers;
+	std::mutex mutex;
+	std::condition_variable cv;
+	std::unique_ptr<segment> probe; // tells local workers from remote ones
+	uint64_t token = 0;
+	std::mutex inputs_mutex;
+	std::map<std::pair<const video_buf_map*, int>, std::pair<std::weak_ptr<video_buf_map>, std::shared_ptr<segment>>> inputs; // by input, format
+	std::shared_ptr<segment> input_acquire(const std::shared_ptr<video_buf_map>& in, const format& of);
+};
+
+// jobs of an x265_remote_encoder over the connected socket fd until it closes, 0 then;
+// with libs, keys naming a lib other than default and those fail without loading it (untrusted peers)
+int x265_worker_serve(int fd, const std::vector<std::string>* libs = 0);
+
+/* candidate lists of every key field and the 3 configs picked from them */
+struct x265_params : ctrl
+{
+	using key_t = x265_key;
+	std::vector<std::any> v[key_t::tuple_size];
+	size_t ctrl[3][key_t::tuple_size] = {};
+	size_t size() const { return key_t::tuple_size; }
+	std::unique_ptr<key> keygen(size_t i) const
+	{
+		return std::make_unique<key_t>(key_t::keygen_impl(ctrl[i], v, std::make_index_sequence<key_t::tuple_size>{}));
+	}
+	template< size_t I = 0>
+	int update_params(size_t i, const std::string& str)
+	{
+		if constexpr (I < key_t::tuple_size)
+		{
+			if (i != I)
+				return update_params<I + 1>(i, str);
+			return update_params_impl<key_t::tuple_element_t<I>>(key_t::tuple_size, (size_t*)ctrl + i, v[i], p[i], str.c_str());
+		}
+		return -1;
+	}
+	static const par_t p[/*key_t::tuple_size*/];
+	x265_params();
+	void update(int) {}
+	// index of the field named name, -1 if none
+	static int find(const std::string& name);
+	// [name] sections followed by values in str2p syntax, -1 with error_msg set on an unknown name or value
+	int parse(const std::string& text);
+};
+
+/* lazy cross product of the candidate lists of axes, the other fields held at ctrl[j];
+ * memory is the lists and one index per field however large the product */
+struct x265_sweep
+{
+	std::vector<int> axes;
+	std::vector<std::any> v[x265_key::tuple_size]; // copied, the lists may be edited meanwhile
+	std::vector<size_t> c; // next position, candidate index per field
+	// no axes means every field with more than one candidate
+	x265_sweep(const x265_params& x, std::vector<int> axes, size_t j = 0);
+	double count() const;
+	// key at the next position, false once exhausted
+	bool next(x265_key* k);
+private:
+	bool end = 0;
+};
+
+/* coordinate descent over the candidate lists from ctrl[j]. each step races every candidate
+ * of one axis in parallel by successive halving on growing prefixes of the clip, weak values
+ * are pruned on short encodes and only the survivors run full length */
+struct x265_search
+{
+	std::vector<int> axes;
+	std::vector<std::any> v[x265_key::tuple_size];
+	objective o;
+	int min_frames = 8; // shortest prefix raced
+	int max_rounds = 4; // passes over the axes, stops early once none moves
+	struct result
+	{
+		std::vector<size_t> c; // best so far, candidate index per field
+		double score = -1e9;
+		stats st;
+		size_t encodes = 0;
+		std::string log;
+	};
+	// no axes means every list but format and bitrate
+	x265_search(const x265_params& x, std::vector<int> axes, size_t j, const objective& o);
+	~x265_search();
+	// blocks until done or stopped, 0 if the search completed
+	int run(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in);
+	void stop();
+	result get() const;
+	x265_key key(const std::vector<size_t>& c) const;
+private:
+	batch b;
+	std::map<int, res_store<x265_key>> stores; // per prefix length
+	mutable std::mutex mutex;
+	result r;
+	std::vector<std::shared_ptr<res>> evaluate(encoder*, threadpool*, const std::shared_ptr<video_buf_map>&, int, const std::vector<std::vector<size_t>>&);
+	void log(const char* fmt, ...);
+};
+
+/* one at a time variations of every list from ctrl[j]; the impact of a field is the spread
+ * of each metric over its values, bitrate and fps relative to the base config */
+struct x265_sensitivity
+{
+	struct impact
+	{
+		int i;
+		double bitrate = 0, psnr = 0, fps = 0; // %, dB, %
+		double score = 0; // sum of the spreads, each over the largest among fields
+		bool done = 0;
+	};
+	x265_sensitivity(const x265_params& x, size_t j);
+	~x265_sensitivity();
+	// every variation at once, the encoder shares first passes between them where it can
+	void submit(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in, const std::vector<int>& sof);
+	// from the jobs finished so far, most influential first
+	std::vector<impact> ranking() const;
+	bool done() const;
+private:
+	std::vector<size_t> c;
+	std::vector<std::any> v[x265_key::tuple_size];
+	res_store<x265_key> store;
+	std::shared_ptr<res> base;
+	std::vector<std::pair<int, std::vector<std::shared_ptr<res>>>> fields; // field, job per candidate
+};
+
+/* bitrate at which each config reaches a target psnr: rounds of parallel probes bracket it on
+ * a prefix of the clip, then one full encode at the interpolated rate gives the real cost */
+struct x265_match
+{
+	double target;
+	int probes = 4; // per config and round, log spaced inside the bracket
+	int rounds = 3;
+	int proxy_frames = 0; // 0: a quarter of the clip, at least 8
+	struct result
+	{
+		double lo = 0, hi = 0; // bracket on the proxy
+		double bitrate = 0; // of the final encode
+		stats st;
+		bool done = 0;
+	};
+	x265_match(const x265_params& x, std::vector<size_t> configs, double target);
+	~x265_match();
+	// blocks until done or stopped, 0 if every config got its final encode
+	int run(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in);
+	void stop();
+	std::vector<result> get() const;
+	std::string report() const;
+private:
+	std::vector<size_t> configs;
+	std::vector<x265_key> keys;
+	batch b;
+	res_store<x265_key> proxy, full;
+	mutable std::mutex mutex;
+	std::vector<result> r;
+};
+
+/* encode speed of keys from repeated runs: warmup runs first, then runs one at a time on an
+ * otherwise idle pool, alternating between keys so that drift affects all of them alike. each
+ * run does both passes and no quality measurement; fps of each key is compared with the
+ * fastest by a mann-whitney test */
+struct x265_bench
+{
+	int runs = 10;
+	int warmup = 1; // per key, not reported
+	double alpha = .05; // differences with a larger p-value are flagged
+	struct result
+	{
+		std::vector<double> fps; // per run
+		sample_summary s;
+		double bitrate = 0;
+		double p = 1; // against the fastest, 1 for itself
+		int failed = 0;
+	};
+	x265_bench(std::vector<x265_key> keys);
+	~x265_bench();
+	// blocks until done or stopped, 0 if every run finished
+	int run(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in);
+	void stop();
+	std::vector<result> get() const;
+	size_t fastest() const;
+	// one line per key, median fps with mad and interval, difference to the fastest
+	std::string report(const std::vector<std::string>& names) const;
+private:
+	std::vector<x265_key> keys;
+	batch b;
+	mutable std::mutex mutex;
+	std::vector<result> r;
+};
+
+/* one key on every worker: the clip is split at scene cuts (evenly where there is none) into
+ * chunks encoded in parallel, each with both passes, then stitched in order into one result.
+ * each chunk starts with an idr and meets the bitrate on its own, the report tells the cost */
+struct x265_chunked
+{
+	int chunks = 0; // 0: one per worker
+	int min_frames = 24;
+	struct chunk
+	{
+		int first = 0, nf = 0;
+		double bitrate = 0; // kbps, once done
+		bool at_cut = 0; // starts a scene, where the encoder puts an idr anyway
+	};
+	struct result
+	{
+		std::vector<chunk> c;
+		double target = 0, bitrate = 0; // kbps
+		double psnr = 0;
+		double join_bits = 0; // share of the bits spent on the idr frames of joins off scene cuts
+		double join_psnr = 0, other_psnr = 0; // mean over frames within 4 of a join, the others
+		double time = 0; // s, wall
+		bool ref = 0; // an unchunked encode was given
+		double ref_bitrate = 0, ref_psnr = 0, ref_time = 0;
+		bool done = 0;
+	};
+	x265_chunked(const x265_key& k, int chunks = 0);
+	~x265_chunked();
+	/* blocks until done or stopped, 0 if every chunk finished. r gets the frames as they are
+	 * stitched and the stats, the report appended to their text; ref, a finished encode of the
+	 * key on the whole clip, is compared against */
+	int run(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in, std::shared_ptr<res> r, const stats* ref = 0);
+	void stop();
+	result get() const;
+	std::string report() const;
+private:
+	x265_key k;
+	batch b;
+	mutable std::mutex mutex;
+	result r;
+	std::vector<std::shared_ptr<res>> jobs; // by chunk
+};
+
+/* rate distortion curves of the 3 configs, each encoded at every value of the bitrate list */
+struct x265_ladder
+{
+	x265_ladder(const x265_params& x);
+	~x265_ladder();
+	void submit(encoder* e, threadpool* pool, std::shared_ptr<video_buf_map> in, const std::vector<int>& sof);
+	bool done() const;
+	// (bitrate, psnr) of the finished rungs of config j
+	std::vector<std::pair<double, double>> curve(size_t j) const;
+	// rungs of every config and bd-rate / bd-psnr of configs 3 and 4 against 2
+	std::string report() const;
+private:
+	std::vector<size_t> c[3];
+	std::vector<std::any> v[x265_key::tuple_size];
+	res_store<x265_key> store;
+	std::vector<std::shared_ptr<res>> rungs[3];
+};
+
 }
\ No newline at end of file
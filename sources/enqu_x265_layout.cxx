@@ -0,0 +1,838 @@
+#include "enqu.h"
+#include "enqu_x265.h"
+#include "enqu_quality.h"
+#include "main.h"
+
+namespace enqu {
+
+struct x265_ctrl : x265_params
+{
+	QGridLayout* g;
+	QDialog* d;
+	QPlainTextEdit* t;
+	QSlider* s[key_t::tuple_size];
+	QLabel* s0[key_t::tuple_size], * s1[key_t::tuple_size];
+	QCheckBox* a[key_t::tuple_size]; // sweep axes
+	QLabel* impact[key_t::tuple_size]; // sensitivity rank
+	int i = 0, j = 0;
+	x265_ctrl(QGridLayout* g, QWidget* parent)
+		: g(g)
+	{
+		if (err)
+			return;
+		d = new QDialog(parent);
+		d->setWindowModality(Qt::ApplicationModal);
+		d->resize(256, 256);
+		t = new QPlainTextEdit(d);
+		t->setGeometry(QRect(0, 0, 256, 256));
+		QObject::connect(d, &QDialog::finished, [this](int)
+		{
+			std::string text = t->toPlainText().toStdString();
+			if (update_params(i, text))
+				QMessageBox::warning(d, QObject::tr(""), error_msg);
+			s[i]->setRange(0, v[i].size() - 1);
+			update_slider(i);
+			g_layout->pixmap_update(g_si);
+		});
+		for (int i = 0; i < key_t::tuple_size; i++)
+		{
+			auto q2 = new QSlider(Qt::Orientation::Horizontal);
+			q2->setTickPosition(QSlider::TickPosition::TicksBothSides);
+			q2->setRange(0, v[i].size() - 1);
+			q2->setFixedWidth(100);
+			auto q1 = new QLabel(p[i].name);
+			if (p[i].desc)
+				q1->setToolTip(p[i].desc);
+			q1->setFixedWidth(100);
+			auto q3 = new elabel();
+			q3->setBackgroundRole(QPalette::BrightText);
+			q3->setAutoFillBackground(true);
+			QObject::connect(q3, &elabel::pressed, [this, i]()
+			{
+				std::string text;
+				for (int j = 0; j < v[i].size(); j++)
+					text += p[i].p2str(v[i][j]) + '\n';
+				t->setPlainText(QString::fromStdString(text));
+				t->moveCursor(QTextCursor::MoveOperation::End);
+				t->setWindowTitle(QString::fromStdString(p[i].name));
+				this->i = i; // save
+				d->show();
+			});
+			QObject::connect(q2, &QAbstractSlider::sliderMoved, [this, i](int n)
+			{
+				update_string(i, n);
+				ctrl[j][i] = n;
+				g_layout->pixmap_update(g_si);
+			});
+			auto q4 = new QCheckBox;
+			q4->setToolTip("sweep axis (none checked: every list)");
+			s0[i] = q1;
+			s[i] = q2;
+			s1[i] = q3;
+			a[i] = q4;
+			impact[i] = new QLabel;
+			g->addWidget(q1, i, 0);
+			g->addWidget(q2, i, 1);
+			g->addWidget(q3, i, 2);
+			g->addWidget(q4, i, 3);
+			g->addWidget(impact[i], i, 4);
+		}
+	}
+	void update_string(int i, int j)
+	{
+		if (s1[i])
+			s1[i]->setText(QString::fromStdString(p[i].p2str(v[i][j])));
+	}
+	void update_slider(int i)
+	{
+		if (s[i])
+		{
+			int n = ctrl[j][i];
+			s[i]->setSliderPosition(n);
+			bool enabled = v[i].size() > 1;
+			if (s[i]->isEnabled() == !enabled)
+				s[i]->setDisabled(!enabled);
+			update_string(i, n);
+		}
+	}
+	std::vector<int> sweep_axes() const
+	{
+		std::vector<int> axes;
+		for (int i = 0; i < key_t::tuple_size; i++)
+			if (a[i]->isChecked() && v[i].size() > 1)
+				axes.push_back(i);
+		return axes;
+	}
+	void update(int j_)
+	{
+		j = j_;
+		for (int i = 0; i < key_t::tuple_size; i++)
+			update_slider(i);
+	}
+};
+
+std::unique_ptr<ctrl> make_x265_ctrl(QGridLayout* g, QWidget* parent)
+{
+	return std::make_unique<x265_ctrl>(g, parent);
+}
+
+class x265_layout : public layout
+{
+	QScrollArea* scroll;
+	QGridLayout* grid;
+	std::unique_ptr<enqu::ctrl> ctrl;
+	res_store<x265_key> q;
+	std::unique_ptr<threadpool> pool;
+	int cj = -1;
+	std::pair<int, int> shown = { -1, -1 }; // state, ready count of the displayed entry
+	/* sweep, entries kept apart from q since their frames are dropped */
+	QTableWidget* table;
+	std::unique_ptr<x265_sweep> sweep;
+	res_store<x265_key> sq;
+	std::vector<std::shared_ptr<res>> rows; // by job, the table row stores its job
+	std::vector<int> row_state;
+	enum { col_state, col_eta, col_bitrate, col_fps, col_psnr, col_ssim, col_params };
+	/* search, blocking in its own thread while its jobs go through pool */
+	QComboBox* objective_box;
+	QDoubleSpinBox* floor_box;
+	QPlainTextEdit* search_log;
+	std::unique_ptr<x265_search> search;
+	std::thread search_thread;
+	std::atomic<bool> search_done = 0;
+	size_t search_j = 0;
+	std::unique_ptr<x265_sensitivity> sensitivity;
+	bool sensitivity_done = 0;
+	QPlainTextEdit* ladder_report;
+	std::unique_ptr<x265_ladder> ladder;
+	bool ladder_done = 0;
+	QDoubleSpinBox* target_box;
+	QPlainTextEdit* match_report;
+	std::unique_ptr<x265_match> match;
+	std::thread match_thread;
+	std::atomic<bool> match_done = 0;
+	/* chunked encode of the shown config over all workers, into q in place of its entry,
+	 * compared against the entry it replaces if that was done */
+	std::unique_ptr<x265_chunked> chunked;
+	std::thread chunked_thread;
+	std::atomic<bool> chunked_done = 0;
+	std::shared_ptr<res> chunked_ref;
+	/* error overlay of the shown frame against the source (heat_ref 0) or config heat_ref,
+	 * maps are cached per (type, reference, key, reference key, frame) up to heat_budget */
+	int heat = 0, heat_ref = 0;
+	using heat_id = std::tuple<int, int, x265_key, x265_key, int>;
+	std::map<heat_id, std::vector<uint8_t>> heat_cache;
+	std::deque<heat_id> heat_order;
+	size_t heat_bytes = 0;
+	static constexpr size_t heat_budget = 256 << 20;
+	int cu_view = 0; // 0 off, 1 depth, 2 mode; encodes started while on collect the decisions
+public:
+	x265_layout(QTabWidget*);
+	~x265_layout()
+	{
+		search_stop();
+		match_stop();
+		chunked_stop();
+		sensitivity.reset();
+		ladder.reset();
+		q.clear();
+		sq.clear();
+		pool.reset();
+		heat_reset();
+	}
+	int pixmap_update(int);
+	void input_changed();
+	bool event(QObject*, QEvent*);
+protected:
+	void process(int);
+	void cj_changed(int);
+	void sweep_reset();
+	void sweep_start();
+	void sweep_update();
+	void search_start();
+	void search_stop();
+	void search_update();
+	void sensitivity_start();
+	void sensitivity_update();
+	void ladder_start();
+	void ladder_update();
+	void match_start();
+	void match_stop();
+	void match_update();
+	void chunked_start();
+	void chunked_stop();
+	void chunked_update();
+	const std::vector<uint8_t>* heat_get(int si, const x265_key& k, res* r);
+	void overlay_update(int si, const x265_key& k, res* r);
+	void heat_reset();
+};
+
+std::unique_ptr<layout> make_x265_layout(QTabWidget* tab)
+{
+	return std::make_unique<x265_layout>(tab);
+}
+
+void x265_layout::cj_changed(int n)
+{
+	int _cj = std::abs(cj);
+	if (n)
+	{
+		if (cj < 0)
+			scroll->setDisabled(0);
+		if (_cj != n)
+			ctrl->update(n - 1);
+		cj = n;
+	}
+	else
+	{
+		if (cj > 0)
+			scroll->setDisabled(1);
+		cj = -_cj;
+	}
+	pixmap_update(g_si);
+}
+
+x265_layout::x265_layout(QTabWidget* stack)
+	: layout(stack)
+{
+	pool = std::make_unique<threadpool>();
+	scroll = new QScrollArea;
+	QWidget* w = new QWidget;
+	grid = new QGridLayout(w);
+	grid->setSizeConstraint(QLayout::SetMinAndMaxSize);
+	ctrl = make_x265_ctrl(grid, scroll);
+	if (ctrl->err)
+		ctrl.reset();
+	else
+		ctrl->update(0);
+	// ENQU_WORKERS: encode in worker processes, as enqu-cli -W
+	size_t n_jobs = std::max(1u, std::thread::hardware_concurrency());
+	if (const char* workers = getenv("ENQU_WORKERS"); workers && ctrl)
+	{
+		auto e = std::make_unique<x265_remote_encoder>(workers);
+		if (e->err)
+			QMessageBox::warning(0, QObject::tr(""), QString("bad worker list ") + workers);
+		else
+			n_jobs = e->size(), ctrl->e = std::move(e);
+	}
+	// ENQU_NUMA: workers on numa nodes and the input copied to them, as enqu-cli -N
+	bool numa = 0;
+	if (const char* nodes = getenv("ENQU_NUMA"); nodes && ctrl && !dynamic_cast<x265_remote_encoder*>(ctrl->e.get()))
+	{
+		numa = 1;
+		if (atoi(nodes) > 0)
+			numa::fake(atoi(nodes));
+	}
+	pool->start(n_jobs, numa);
+	pool->set_sjf(1);
+	scroll->setDisabled(true);
+	scroll->setWidget(w);
+	stack->addTab(scroll, "");
+	table = new QTableWidget;
+	table->setEditTriggers(QAbstractItemView::NoEditTriggers);
+	table->setSelectionBehavior(QAbstractItemView::SelectRows);
+	stack->addTab(table, "sweep");
+	QWidget* search_tab = new QWidget;
+	QGridLayout* search_grid = new QGridLayout(search_tab);
+	objective_box = new QComboBox;
+	objective_box->addItem("quality at bitrate");
+	objective_box->addItem("speed above psnr");
+	floor_box = new QDoubleSpinBox;
+	floor_box->setRange(0, 100);
+	floor_box->setValue(40);
+	QPushButton* start = new QPushButton("start");
+	QPushButton* stop = new QPushButton("stop");
+	QObject::connect(start, &QPushButton::clicked, [this] { if (ctrl && g_buf) search_start(); });
+	QObject::connect(stop, &QPushButton::clicked, [this] { search_stop(); });
+	search_log = new QPlainTextEdit;
+	search_log->setReadOnly(true);
+	search_grid->addWidget(objective_box, 0, 0);
+	search_grid->addWidget(floor_box, 0, 1);
+	search_grid->addWidget(start, 0, 2);
+	search_grid->addWidget(stop, 0, 3);
+	search_grid->addWidget(search_log, 1, 0, 1, 4);
+	stack->addTab(search_tab, "search");
+	QWidget* ladder_tab = new QWidget;
+	QGridLayout* ladder_grid = new QGridLayout(ladder_tab);
+	ladder_report = new QPlainTextEdit;
+	ladder_report->setReadOnly(true);
+	target_box = new QDoubleSpinBox;
+	target_box->setRange(0, 100);
+	target_box->setValue(40);
+	target_box->setToolTip("psnr the configs are matched at");
+	QPushButton* match_button = new QPushButton("match");
+	QObject::connect(match_button, &QPushButton::clicked, [this] { if (ctrl && g_buf) match_start(); });
+	match_report = new QPlainTextEdit;
+	match_report->setReadOnly(true);
+	ladder_grid->addWidget(ladder_report, 0, 0, 1, 2);
+	ladder_grid->addWidget(target_box, 1, 0);
+	ladder_grid->addWidget(match_button, 1, 1);
+	ladder_grid->addWidget(match_report, 2, 0, 1, 2);
+	stack->addTab(ladder_tab, "ladder");
+	QTimer* timer = new QTimer(scroll);
+	QObject::connect(timer, &QTimer::timeout, [this]
+	{
+		if (!ctrl)
+			return;
+		sweep_update();
+		search_update();
+		sensitivity_update();
+		ladder_update();
+		match_update();
+		chunked_update();
+		if (cj < 0)
+			return;
+		auto pk = ctrl->keygen(cj - 1);
+		auto r = q.find(*static_cast<x265_key*>(pk.get()));
+		if (r && shown != std::make_pair(r->get_state(), r->ready_count()))
+			pixmap_update(g_si);
+	});
+	timer->start(250);
+}
+
+bool x265_layout::event(QObject* obj, QEvent* event)
+{
+	int type = event->type();
+	if (type == QEvent::KeyPress)
+	{
+		QKeyEvent* key_event = static_cast<QKeyEvent*>(event);
+		int key = key_event->key(), modifiers = key_event->modifiers();
+		switch (key)
+		{
+		case Qt::Key_1:
+			cj_changed(0);
+			break;
+		case Qt::Key_2:
+			cj_changed(1);
+			break;
+		case Qt::Key_3:
+			cj_changed(2);
+			break;
+		case Qt::Key_4:
+			cj_changed(3);
+			break;
+		case Qt::Key_F5:
+			if (cj > 0 && g_buf) process(0);
+			break;
+		case Qt::Key_F6:
+			if (ctrl && g_buf) sweep_start();
+			break;
+		case Qt::Key_F7:
+			if (ctrl && g_buf) sensitivity_start();
+			break;
+		case Qt::Key_F8:
+			if (ctrl && g_buf) ladder_start();
+			break;
+		case Qt::Key_F9:
+			if (cj > 0 && g_buf) chunked_start();
+			break;
+		case Qt::Key_H:
+			heat = (heat + 1) % (heat_ssim + 1);
+			cu_view = 0;
+			pixmap_update(g_si);
+			break;
+		case Qt::Key_G:
+			cu_view = (cu_view + 1) % 3;
+			heat = 0;
+			pixmap_update(g_si);
+			break;
+		case Qt::Key_J:
+			heat_ref = (heat_ref + 1) % 4; // source, configs 2-4
+			pixmap_update(g_si);
+			break;
+		default:
+			return 0;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+void x265_layout::input_changed()
+{
+	search_stop();
+	match_stop();
+	chunked_stop();
+	sensitivity.reset();
+	ladder.reset();
+	q.clear();
+	sweep_reset();
+	heat_reset();
+}
+
+void x265_layout::heat_reset()
+{
+	metrics::preview_bytes.add(-(int64_t)heat_bytes);
+	heat_cache.clear();
+	heat_order.clear();
+	heat_bytes = 0;
+}
+
+// 0 until both frames are ready
+const std::vector<uint8_t>* x265_layout::heat_get(int si, const x265_key& k, res* r)
+{
+	x265_key kb;
+	std::shared_ptr<res> rb;
+	uint8_t* b[3];
+	int sb[3];
+	if (heat_ref)
+	{
+		auto pk = ctrl->keygen(heat_ref - 1);
+		kb = *static_cast<x265_key*>(pk.get());
+		rb = q.find(kb);
+		uint8_t* frame = rb ? rb->frame(si) : 0;
+		if (!frame || rb->f.w != r->f.w || rb->f.h != r->f.h || rb->f.bit_depth != r->f.bit_depth)
+			return 0;
+		rb->f.planes(frame, b, sb);
+	}
+	heat_id id(heat, heat_ref, k, kb, si);
+	if (auto it = heat_cache.find(id); it != heat_cache.end())
+		return &it->second;
+	if (!heat_ref && g_buf->planes(r->f, g_sof[si], b, sb))
+		return 0;
+	uint8_t* a[3];
+	int sa[3];
+	r->f.planes(r->frame(si), a, sa);
+	std::vector<uint8_t> map((size_t)r->f.w * r->f.h);
+	heatmap(r->f, heat, b, sb, a, sa, map.data());
+	heat_bytes += map.size();
+	metrics::preview_bytes.add(map.size());
+	while (heat_bytes > heat_budget && !heat_order.empty())
+	{
+		auto it = heat_cache.find(heat_order.front());
+		heat_bytes -= it->second.size();
+		metrics::preview_bytes.add(-(int64_t)it->second.size());
+		heat_cache.erase(it);
+		heat_order.pop_front();
+	}
+	heat_order.push_back(id);
+	return &heat_cache.emplace(id, std::move(map)).first->second;
+}
+
+void x265_layout::overlay_update(int si, const x265_key& k, res* r)
+{
+	static const QVector<QRgb> palette = []
+	{
+		// transparent where equal, through yellow to opaque red
+		QVector<QRgb> _(256);
+		for (int i = 0; i < 256; i++)
+			_[i] = qRgba(255, 255 - i, 0, std::min(255, i * 2));
+		return _;
+	}();
+	// indexed by depth | mode << 2: depth 0 clear to 3 red; intra red, inter green, skip clear
+	static const QVector<QRgb> cu_palette[2] = { []
+	{
+		QVector<QRgb> _(256);
+		const QRgb depth[4] = { qRgba(0, 0, 0, 0), qRgba(60, 200, 60, 60), qRgba(240, 220, 40, 100), qRgba(240, 50, 40, 140) };
+		for (int i = 0; i < 256; i++)
+			_[i] = depth[i & 3];
+		return _;
+	}(), []
+	{
+		QVector<QRgb> _(256);
+		const QRgb mode[3] = { qRgba(240, 50, 40, 120), qRgba(60, 200, 60, 60), qRgba(0, 0, 0, 0) };
+		for (int i = 0; i < 256; i++)
+			_[i] = mode[std::min(i >> 2, 2)];
+		return _;
+	}() };
+	if (cu_view)
+	{
+		const stats* st = r ? r->get_stats() : 0;
+		const cu_map* m = st && si < (int)st->cu.size() && !st->cu[si].v.empty() ? &st->cu[si] : 0;
+		if (!m)
+		{
+			g_overlay->setPixmap(QPixmap());
+			return;
+		}
+		QImage image(m->v.data(), m->w, m->h, m->w, QImage::Format_Indexed8);
+		image.setColorTable(cu_palette[cu_view - 1]);
+		g_overlay->setPixmap(QPixmap::fromImage(image));
+		g_overlay->setTransform(QTransform::fromScale(8. * g_of.w / g_f.w, 8. * g_of.h / g_f.h));
+		g_overlay->setPos((double)g_crop.x * g_of.w / g_f.w, (double)g_crop.y * g_of.h / g_f.h);
+		return;
+	}
+	const std::vector<uint8_t>* map = heat && r && r->frame(si) ? heat_get(si, k, r) : 0;
+	if (!map)
+	{
+		g_overlay->setPixmap(QPixmap());
+		return;
+	}
+	int w = r->f.w, h = r->f.h;
+	QImage image(map->data(), w, h, w, QImage::Format_Indexed8);
+	image.setColorTable(palette);
+	g_overlay->setPixmap(QPixmap::fromImage(image));
+	g_overlay->setTransform(QTransform::fromScale((double)g_of.w / g_f.w, (double)g_of.h / g_f.h));
+	g_overlay->setPos((double)g_crop.x * g_of.w / g_f.w, (double)g_crop.y * g_of.h / g_f.h);
+}
+
+void x265_layout::sweep_reset()
+{
+	sq.clear();
+	sweep.reset();
+	rows.clear();
+	row_state.clear();
+	table->setRowCount(0);
+}
+
+int x265_layout::pixmap_update(int si)
+{
+	if (cj < 0)
+	{
+		g_overlay->setPixmap(QPixmap());
+		g_timeline->set(nullptr);
+		return enqu::pixmap_update(si);
+	}
+	trace_span span("render", si);
+	auto pk = ctrl->keygen(cj - 1);
+	auto& k = *static_cast<x265_key*>(pk.get());
+	std::shared_ptr<res> r = q.find(k); // pinned while drawn
+	uint8_t* frame = r ? r->frame(si) : 0;
+	shown = r ? std::make_pair(r->get_state(), r->ready_count()) : std::make_pair(-1, -1);
+	if (!frame)
+		g_pixmap->setPixmap(QPixmap());
+	else
+	{
+		int w = g_of.w, h = g_of.h;
+		g_pixmap->setPixmap(QPixmap::fromImage(QImage((const uchar*)crop_out(g_buf.get(), si, h, w, frame, r->f), w, h, QImage::Format_RGB32)));
+	}
+	overlay_update(si, k, r.get());
+	g_timeline->set(r);
+	std::string text;
+	if (const stats* st = r ? r->get_stats() : 0)
+		text = st->str;
+	else if (r)
+		text = std::string(res::state_name(shown.first)) + ' ' + std::to_string(shown.second) + '/' + std::to_string(r->empty() ? 0 : r->buf.size());
+	if (cu_view)
+		text += std::string("\ncu ") + (cu_view == 1 ? "depth" : "mode") + (r && r->get_stats() && r->get_stats()->cu.empty() ? " (not collected, encode with it on)" : "");
+	if (heat)
+		text += std::string("\nheat ") + (heat == heat_abs ? "abs" : "ssim") + " vs " + (heat_ref ? "config " + std::to_string(heat_ref + 1) : std::string("source"));
+	g_stats->setText(QString::fromStdString(text));
+	return 0;
+}
+
+void x265_layout::process(int)
+{
+	auto pk = ctrl->keygen(cj - 1);
+	auto& k = *static_cast<x265_key*>(pk.get());
+	auto t = q.try_emplace(k);
+	if (t.second)
+	{
+		std::unique_ptr<context> ctx = k.ctx(t.first, ctrl->e.get(), g_buf, g_sof);
+		ctx->collect_cu = cu_view != 0;
+		pool->push(std::move(ctx));
+	}
+	pixmap_update(g_si);
+}
+
+void x265_layout::sweep_start()
+{
+	sweep_reset();
+	auto x = static_cast<x265_ctrl*>(ctrl.get());
+	sweep = std::make_unique<x265_sweep>(*x, x->sweep_axes(), std::max(cj, 1) - 1);
+	QStringList header = { "state", "eta", "bitrate", "fps", "psnr", "ssim" };
+	for (int i : sweep->axes)
+		header << x265_params::p[i].name;
+	table->setColumnCount(header.size());
+	table->setHorizontalHeaderLabels(header);
+}
+
+static QTableWidgetItem* number(double x)
+{
+	auto _ = new QTableWidgetItem;
+	_->setData(Qt::DisplayRole, x);
+	return _;
+}
+
+/* feeds the pool jobs ahead, enough for it to pick the shortest first, and refreshes the rows
+ * whose state moved and the predicted seconds until the others are done */
+void x265_layout::sweep_update()
+{
+	if (!sweep)
+		return;
+	table->setSortingEnabled(false);
+	size_t window = std::max(1u, std::thread::hardware_concurrency()) * 16;
+	x265_key k;
+	for (std::vector<size_t> c = sweep->c; pool->pending() < window && sweep->next(&k); c = sweep->c)
+	{
+		auto t = sq.try_emplace(k);
+		if (!t.second)
+			continue;
+		if (auto r = q.find(k); r && r->get_state() < res::failed) // already encoded by hand
+			t.first = r;
+		else
+		{
+			std::unique_ptr<context> ctx = k.ctx(t.first, ctrl->e.get(), g_buf, g_sof);
+			ctx->keep_frames = 0;
+			pool->push(std::move(ctx));
+		}
+		int row = table->rowCount();
+		table->insertRow(row);
+		auto _ = new QTableWidgetItem(res::state_name(res::queued));
+		_->setData(Qt::UserRole, (int)rows.size());
+		table->setItem(row, col_state, _);
+		for (size_t n = 0; n < sweep->axes.size(); n++)
+		{
+			int i = sweep->axes[n];
+			table->setItem(row, col_params + n, new QTableWidgetItem(QString::fromStdString(x265_params::p[i].p2str(sweep->v[i][c[i]]))));
+		}
+		rows.push_back(t.first);
+		row_state.push_back(-1);
+	}
+	bool changed = 0;
+	std::map<const res*, double> eta = pool->eta();
+	for (int row = 0; row < table->rowCount(); row++)
+	{
+		size_t j = table->item(row, col_state)->data(Qt::UserRole).toInt();
+		int state = rows[j]->get_state();
+		if (auto it = eta.find(rows[j].get()); it != eta.end() && state < res::done)
+			table->setItem(row, col_eta, number(std::round(it->second)));
+		else if (table->item(row, col_eta))
+			delete table->takeItem(row, col_eta);
+		if (state == row_state[j])
+			continue;
+		row_state[j] = state;
+		changed = 1;
+		table->item(row, col_state)->setText(res::state_name(state));
+		if (const stats* st = rows[j]->get_stats())
+		{
+			table->setItem(row, col_bitrate, number(st->bitrate));
+			table->setItem(row, col_fps, number(st->speed()));
+			table->setItem(row, col_psnr, number(st->psnr[3]));
+			table->setItem(row, col_ssim, number(st->ssim));
+		}
+	}
+	if (changed)
+	{
+		std::vector<const stats*> st(rows.size());
+		for (size_t j = 0; j < rows.size(); j++)
+			st[j] = rows[j]->get_stats();
+		std::vector<bool> front = pareto_front(st);
+		for (int row = 0; row < table->rowCount(); row++)
+		{
+			size_t j = table->item(row, col_state)->data(Qt::UserRole).toInt();
+			QBrush brush = front[j] ? QBrush(QColor(255, 230, 150)) : QBrush();
+			for (int col = 0; col < table->columnCount(); col++)
+				if (QTableWidgetItem* _ = table->item(row, col))
+					_->setBackground(brush);
+		}
+	}
+	table->setSortingEnabled(true);
+}
+
+// from the current config (2-4) over the checked lists, the best key found replaces it
+void x265_layout::search_start()
+{
+	search_stop();
+	auto x = static_cast<x265_ctrl*>(ctrl.get());
+	objective o;
+	o.type = objective_box->currentIndex() ? objective::speed : objective::quality;
+	o.floor = floor_box->value();
+	search_j = std::max(cj, 1) - 1;
+	search = std::make_unique<x265_search>(*x, x->sweep_axes(), search_j, o);
+	search_done = 0;
+	search_log->setPlainText(QString());
+	search_thread = std::thread([this, in = g_buf]
+	{
+		search->run(ctrl->e.get(), pool.get(), in);
+		search_done = 1;
+	});
+}
+
+void x265_layout::search_stop()
+{
+	if (!search)
+		return;
+	search->stop();
+	if (search_thread.joinable())
+		search_thread.join();
+	search.reset();
+}
+
+void x265_layout::search_update()
+{
+	if (!search)
+		return;
+	x265_search::result r = search->get();
+	QString text = QString::fromStdString(r.log);
+	if (text != search_log->toPlainText())
+		search_log->setPlainText(text);
+	if (!search_done)
+		return;
+	search_thread.join();
+	// by value, the lists may have been edited meanwhile
+	auto x = static_cast<x265_ctrl*>(ctrl.get());
+	for (int i : search->axes)
+	{
+		std::string value = x265_params::p[i].p2str(search->v[i][r.c[i]]);
+		for (size_t n = 0; n < x->v[i].size(); n++)
+			if (x265_params::p[i].p2str(x->v[i][n]) == value)
+				x->ctrl[search_j][i] = n;
+	}
+	search.reset();
+	if (cj > 0)
+		ctrl->update(cj - 1);
+	pixmap_update(g_si);
+}
+
+// one at a time variations around the current config (2-4), ranked next to the sliders
+void x265_layout::sensitivity_start()
+{
+	auto x = static_cast<x265_ctrl*>(ctrl.get());
+	sensitivity = std::make_unique<x265_sensitivity>(*x, std::max(cj, 1) - 1);
+	sensitivity->submit(ctrl->e.get(), pool.get(), g_buf, g_sof);
+	sensitivity_done = 0;
+	for (QLabel* _ : x->impact)
+		_->setText(QString());
+}
+
+void x265_layout::sensitivity_update()
+{
+	if (!sensitivity || sensitivity_done)
+		return;
+	sensitivity_done = sensitivity->done();
+	auto x = static_cast<x265_ctrl*>(ctrl.get());
+	std::vector<x265_sensitivity::impact> rank = sensitivity->ranking();
+	for (size_t n = 0; n < rank.size(); n++)
+	{
+		const auto& _ = rank[n];
+		char tmp[128];
+		sprintf(tmp, "#%zu%s psnr %.3lf, br %.1lf%%, fps %.1lf%%", n + 1, _.done ? "" : "?", _.psnr, _.bitrate, _.fps);
+		x->impact[_.i]->setText(tmp);
+	}
+}
+
+// configs 2-4 at every value of the bitrate list, compared in the ladder tab
+void x265_layout::ladder_start()
+{
+	ladder = std::make_unique<x265_ladder>(*static_cast<x265_ctrl*>(ctrl.get()));
+	ladder->submit(ctrl->e.get(), pool.get(), g_buf, g_sof);
+	ladder_done = 0;
+}
+
+void x265_layout::ladder_update()
+{
+	if (!ladder || ladder_done)
+		return;
+	ladder_done = ladder->done();
+	QString text = QString::fromStdString(ladder->report());
+	if (text != ladder_report->toPlainText())
+		ladder_report->setPlainText(text);
+}
+
+// bitrate at which configs 2-4 reach the target psnr
+void x265_layout::match_start()
+{
+	match_stop();
+	match = std::make_unique<x265_match>(*static_cast<x265_ctrl*>(ctrl.get()), std::vector<size_t>{ 0, 1, 2 }, target_box->value());
+	match_done = 0;
+	match_thread = std::thread([this, in = g_buf]
+	{
+		match->run(ctrl->e.get(), pool.get(), in);
+		match_done = 1;
+	});
+}
+
+void x265_layout::match_stop()
+{
+	if (!match)
+		return;
+	match->stop();
+	if (match_thread.joinable())
+		match_thread.join();
+	match.reset();
+}
+
+void x265_layout::match_update()
+{
+	if (!match)
+		return;
+	QString text = QString::fromStdString(match->report());
+	if (text != match_report->toPlainText())
+		match_report->setPlainText(text);
+	if (match_done)
+	{
+		match_thread.join();
+		match.reset();
+	}
+}
+
+void x265_layout::chunked_start()
+{
+	chunked_stop();
+	auto pk = ctrl->keygen(cj - 1);
+	const x265_key& k = *static_cast<x265_key*>(pk.get());
+	chunked_ref = q.find(k);
+	if (chunked_ref && !chunked_ref->get_stats())
+		chunked_ref.reset();
+	std::shared_ptr<res> r = q.replace(k);
+	heat_reset();
+	chunked = std::make_unique<x265_chunked>(k);
+	chunked_done = 0;
+	chunked_thread = std::thread([this, in = g_buf, r]
+	{
+		chunked->run(ctrl->e.get(), pool.get(), in, r, chunked_ref ? chunked_ref->get_stats() : 0);
+		chunked_done = 1;
+	});
+	pixmap_update(g_si);
+}
+
+void x265_layout::chunked_stop()
+{
+	if (!chunked)
+		return;
+	chunked->stop();
+	if (chunked_thread.joinable())
+		chunked_thread.join();
+	chunked.reset();
+	chunked_ref.reset();
+}
+
+void x265_layout::chunked_update()
+{
+	if (!chunked || !chunked_done)
+		return;
+	chunked_thread.join();
+	chunked.reset();
+	chunked_ref.reset();
+}
+
+}
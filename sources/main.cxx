@@ -1,5 +1,488 @@
+#include "enqu.h"
+#include "enqu_quality.h"
 #include "main.h"
 
+namespace enqu {
+
+/* input & output */
+format g_f, g_of;
+int g_nf = 0;
+
+/* slider (io) */
+int g_si = 0;
+
+/**/
+std::vector<int> g_sof;
+
+std::shared_ptr<video_buf_map> g_buf;
+static std::shared_ptr<video_buf_map> g_clip; // as opened, g_buf is built on it
+static std::vector<int> g_proxy; // frames of the proxy while on
+crop_t g_crop;
+static QGraphicsRectItem* g_crop_item;
+static QPointF g_crop_from;
+static bool g_cropping = 0;
+std::unique_ptr<layout> g_layout;
+QSlider* g_slider;
+QGraphicsView* g_view;
+QGraphicsPixmapItem* g_pixmap, * g_overlay; // overlay drawn over the frame, by the layout
+QLabel* g_stats;
+QLabel* g_resources; // process metrics, next to g_stats
+timeline* g_timeline;
+
+void close_input()
+{
+	g_slider->setMaximum(0);
+	if (g_buf)
+	{
+		g_pixmap->setPixmap(QPixmap());
+		g_overlay->setPixmap(QPixmap());
+	}
+	g_sof.clear();
+	g_buf.reset();
+	g_clip.reset();
+	g_proxy.clear();
+	g_crop = {};
+	g_crop_item->setVisible(false);
+	g_timeline->set(nullptr);
+}
+
+static void crop_item_update(const crop_t& c)
+{
+	g_crop_item->setVisible(c.w != 0);
+	if (c.w)
+		g_crop_item->setRect(QRectF((double)c.x * g_of.w / g_f.w, (double)c.y * g_of.h / g_f.h, (double)c.w * g_of.w / g_f.w, (double)c.h * g_of.h / g_f.h));
+}
+
+void out_changed()
+{
+	g_view->setSceneRect(0, 0, g_of.w, g_of.h);
+	if (g_of.w > 1280 || g_of.h > 720)
+		g_view->setDragMode(QGraphicsView::ScrollHandDrag);
+	else
+		g_view->setDragMode(QGraphicsView::NoDrag);
+	crop_item_update(g_crop);
+}
+
+timeline::timeline(QWidget* parent)
+	: QWidget(parent)
+{
+	setFixedHeight(80);
+}
+
+void timeline::set(std::shared_ptr<res> r_)
+{
+	r = std::move(r_);
+	update();
+}
+
+void timeline::paintEvent(QPaintEvent*)
+{
+	QPainter p(this);
+	int w = width(), h = height();
+	p.fillRect(0, 0, w, h, QColor(32, 32, 32));
+	const stats* st = r ? r->get_stats() : 0;
+	if (!st || st->info.empty())
+		return;
+	size_t nf = st->info.size();
+	uint32_t max_bits = 1;
+	float max_time = 1e-3f;
+	for (auto& _ : st->info)
+	{
+		max_bits = std::max(max_bits, _.bits);
+		max_time = std::max(max_time, _.time);
+	}
+	auto x = [&](size_t n) { return (int)(n * w / nf); };
+	int top = 16, span = h - top;
+	for (size_t n = 0; n < nf; n++)
+	{
+		const frame_info& _ = st->info[n];
+		QColor c = _.type == 'I' || _.type == 'i' ? QColor(220, 60, 60) : _.type == 'P' ? QColor(60, 180, 60)
+			: _.type == 'B' ? QColor(60, 100, 220) : QColor(120, 150, 230);
+		int bar = (int)((double)_.bits / max_bits * span);
+		p.fillRect(x(n), h - bar, std::max(1, x(n + 1) - x(n)), bar, c);
+	}
+	// qp over 0-51, time over its max, psnr over 20-60 db
+	std::vector<QPointF> qp(nf), time(nf), psnr;
+	for (size_t n = 0; n < nf; n++)
+	{
+		double cx = x(n) + .5 * std::max(1, x(n + 1) - x(n));
+		qp[n] = QPointF(cx, h - st->info[n].qp / 51. * span);
+		time[n] = QPointF(cx, h - st->info[n].time / max_time * span);
+		if (n < st->frame.size() && st->frame[n].valid)
+			psnr.push_back(QPointF(cx, h - std::clamp((frame_psnr(r->f, st->frame[n]) - 20) / 40, 0., 1.) * span));
+	}
+	p.setPen(QColor(Qt::white));
+	p.drawPolyline(qp.data(), (int)qp.size());
+	p.setPen(QColor(240, 160, 40));
+	p.drawPolyline(time.data(), (int)time.size());
+	p.setPen(QColor(Qt::cyan));
+	p.drawPolyline(psnr.data(), (int)psnr.size());
+	if (g_si < 0 || g_si >= (int)nf)
+		return;
+	p.setPen(QColor(Qt::yellow));
+	p.drawLine(x(g_si), top, x(g_si), h);
+	const frame_info& _ = st->info[g_si];
+	char text[256];
+	int n = snprintf(text, sizeof(text), "%d: poc %d %c, %u bits, qp %.2f, %.1f ms", g_si, _.poc, _.type ? _.type : '-', _.bits, _.qp, _.time);
+	if (g_si < (int)st->frame.size() && st->frame[g_si].valid)
+		snprintf(text + n, sizeof(text) - n, ", psnr %.3f, ssim %.5f", frame_psnr(r->f, st->frame[g_si]), st->frame[g_si].ssim);
+	p.setPen(QColor(Qt::lightGray));
+	p.drawText(4, 12, QString(text));
+}
+
+void timeline::seek(int x)
+{
+	int nf = g_slider->maximum() + 1;
+	if (width() > 0)
+		g_slider->setValue(std::clamp(x * nf / width(), 0, nf - 1));
+}
+
+void timeline::mousePressEvent(QMouseEvent* event)
+{
+	seek(event->pos().x());
+}
+
+void timeline::mouseMoveEvent(QMouseEvent* event)
+{
+	seek(event->pos().x());
+}
+
+// gauges as they are, counters with their rate since the last call, histograms by count and mean
+static void resources_update()
+{
+	static std::map<const metric*, std::pair<uint64_t, std::chrono::steady_clock::time_point>> last;
+	auto now = std::chrono::steady_clock::now();
+	std::string text;
+	char tmp[256];
+	for (metric* m : metric::all())
+	{
+		std::string name = m->name;
+		if (name.starts_with("enqu_"))
+			name.erase(0, 5);
+		switch (m->type)
+		{
+		case metric::gauge:
+		{
+			int64_t v = static_cast<metric_gauge*>(m)->get();
+			if (name.ends_with("_bytes"))
+				sprintf(tmp, "%s %.1lf MiB\n", name.substr(0, name.size() - 6).c_str(), v / 1048576.);
+			else
+				sprintf(tmp, "%s %lld\n", name.c_str(), (long long)v);
+			break;
+		}
+		case metric::counter:
+		{
+			uint64_t v = static_cast<metric_counter*>(m)->get();
+			auto it = last.find(m);
+			double rate = 0;
+			if (it != last.end())
+				rate = (v - it->second.first) / std::max(1e-3, std::chrono::duration<double>(now - it->second.second).count());
+			last[m] = { v, now };
+			sprintf(tmp, "%s %llu (%.1lf/s)\n", name.c_str(), (unsigned long long)v, rate);
+			break;
+		}
+		case metric::histogram:
+		{
+			std::vector<uint64_t> bucket;
+			uint64_t count;
+			double sum;
+			static_cast<metric_histogram*>(m)->get(&bucket, &count, &sum);
+			sprintf(tmp, "%s %llu, mean %.2lf\n", name.c_str(), (unsigned long long)count, count ? sum / count : 0.);
+			break;
+		}
+		}
+		text += tmp;
+	}
+	g_resources->setText(QString::fromStdString(text));
+}
+
+int pixmap_update(int si)
+{
+	if (!g_buf)
+		return -1;
+	trace_span span("render", si);
+	int w = g_of.w, h = g_of.h;
+	g_pixmap->setPixmap(QPixmap::fromImage(QImage((const uchar*)g_buf->out(si, h, w), w, h, QImage::Format_RGB32)));
+	return 0;
+}
+
+/* g_buf is the clip, or a proxy of about a twelfth of it for quick exploration, cropped to
+ * g_crop if set; results go with the input they were encoded on, so they are dropped */
+static void input_update(QWidget* window)
+{
+	if (!g_clip)
+		return;
+	g_buf = g_clip;
+	if (!g_proxy.empty())
+		g_buf = make_proxy_map(g_buf, g_proxy);
+	if (g_crop.w)
+		g_buf = make_crop_map(g_buf, g_crop.x, g_crop.y, g_crop.w, g_crop.h);
+	g_nf = g_buf->nf;
+	g_sof.clear();
+	for (int i = 0; i < g_nf; i++)
+		g_sof.push_back(i);
+	g_slider->setMaximum(g_sof.size() - 1);
+	if (g_layout)
+		g_layout->input_changed();
+	g_si = std::clamp(g_si, 0, g_nf - 1);
+	pixmap_update(g_si);
+	crop_item_update(g_crop);
+	std::string title = "enqu";
+	if (!g_proxy.empty())
+		title += ", proxy of " + std::to_string(g_nf) + " / " + std::to_string(g_clip->nf) + " frames";
+	if (g_crop.w)
+		title += ", crop " + std::to_string(g_crop.w) + 'x' + std::to_string(g_crop.h) + '+' + std::to_string(g_crop.x) + '+' + std::to_string(g_crop.y);
+	window->setWindowTitle(QString::fromStdString(title));
+}
+
+static void proxy_toggle(QWidget* window)
+{
+	if (!g_clip)
+		return;
+	if (!g_proxy.empty())
+		g_proxy.clear();
+	else
+		g_proxy = proxy_frames(g_clip.get(), 12);
+	input_update(window);
+}
+
+/* the selection between two scene points in g_f pixels, widened to whole ctus (64) or to the
+ * frame edge; w 0 if it covers the frame */
+static crop_t crop_snap(QPointF a, QPointF b)
+{
+	double sx = (double)g_f.w / g_of.w, sy = (double)g_f.h / g_of.h;
+	int x0 = std::clamp((int)(std::min(a.x(), b.x()) * sx), 0, g_f.w), x1 = std::clamp((int)std::ceil(std::max(a.x(), b.x()) * sx), 0, g_f.w);
+	int y0 = std::clamp((int)(std::min(a.y(), b.y()) * sy), 0, g_f.h), y1 = std::clamp((int)std::ceil(std::max(a.y(), b.y()) * sy), 0, g_f.h);
+	x0 = std::min(x0 / 64 * 64, std::max(g_f.w - 64, 0) & ~1);
+	y0 = std::min(y0 / 64 * 64, std::max(g_f.h - 64, 0) & ~1);
+	x1 = std::min(std::max((x1 + 63) / 64 * 64, x0 + 64), g_f.w);
+	y1 = std::min(std::max((y1 + 63) / 64 * 64, y0 + 64), g_f.h);
+	if (x0 == 0 && y0 == 0 && x1 == g_f.w && y1 == g_f.h)
+		return {};
+	return { x0, y0, x1 - x0, y1 - y0 };
+}
+
+void open()
+{
+	QString ret = QFileDialog::getOpenFileName(0, QObject::tr(""), QObject::tr(""), QObject::tr("(*.vpy *.mkv);;(*)"), 0, 0);
+	if (ret.isEmpty())
+		return;
+	close_input();
+	std::string path = ret.toStdString();
+	VSNodeRef* node = 0;
+	do
+	{
+		if (path.ends_with(".vpy"))
+		{
+			if (vsscript_evaluateFile(&se, path.c_str(), efSetWorkingDir))
+				break;
+			node = vsscript_getOutput(se, 0);
+		}
+		if (!node)
+			break;
+		g_buf = make_video_buf_map(node);
+		node = 0;
+		if (!g_buf)
+			break;
+		if (getenv("ENQU_NUMA"))
+			g_buf = make_numa_map(g_buf);
+		g_clip = g_buf;
+		g_f = g_buf->f;
+		g_nf = g_buf->nf;
+		g_of = g_f;
+		for (int i = 0; i < g_nf; i++)
+			g_sof.push_back(i);
+		g_slider->setMaximum(g_sof.size() - 1);
+		if (g_layout)
+			g_layout->input_changed();
+		out_changed();
+		g_si = std::clamp(g_si, 0, g_nf);
+		pixmap_update(g_si);
+		return;
+	} while (0);
+	if (node)
+		vsapi->freeNode(node);
+}
+
+main_window::main_window()
+{
+	try
+	{
+		vs_init();
+	}
+	catch (const char* msg)
+	{
+		vs_finalize();
+		QMessageBox::warning(this, QObject::tr(""), msg);
+	}
+	resize(1800, 900);
+	QWidget* center = new QWidget;
+	setCentralWidget(center);
+	QVBoxLayout* box = new QVBoxLayout(center);
+	QTabWidget* tab = new QTabWidget;
+	QMenu* menu0 = menuBar()->addMenu(tr("&File"));
+	menu0->addAction(tr("..."), [] { open(); });
+	menu0->addSeparator();
+	QMenu* menu1 = menuBar()->addMenu(tr("&Tools"));
+	QActionGroup* group = new QActionGroup(this);
+	group->setExclusive(true);
+	{
+		QAction* _;
+		_ = menu1->addAction(tr("x265"), this, [=]
+		{
+			if (g_layout)
+				g_layout.reset();
+			g_layout = make_x265_layout(tab);
+		});
+		_->setCheckable(true);
+		group->addAction(_);
+	}
+	menu1->addSeparator();
+	g_slider = new QSlider(Qt::Orientation::Horizontal);
+	box->addWidget(g_slider);
+	g_slider->setTickPosition(QSlider::TickPosition::TicksBothSides);
+	g_slider->setFixedWidth(100);
+	g_slider->setRange(0, 0);
+	connect(g_slider, &QSlider::valueChanged,
+		[=](int n)
+	{
+		g_si = n;
+		if (g_layout)
+			g_layout->pixmap_update(n);
+		else
+			pixmap_update(n);
+		g_timeline->update();
+	});
+	g_timeline = new timeline;
+	box->addWidget(g_timeline);
+	box->addWidget(tab);
+	QDockWidget* view_dock = new QDockWidget;
+	QGraphicsScene* scene = new QGraphicsScene(QRect(0, 0, 1280, 720));
+	g_pixmap = scene->addPixmap(QPixmap());
+	g_overlay = scene->addPixmap(QPixmap());
+	g_overlay->setZValue(1);
+	g_view = new QGraphicsView;
+	g_view->setAlignment(Qt::AlignLeft | Qt::AlignTop);
+	g_view->setInteractive(false);
+	g_view->setScene(scene);
+	g_view->viewport()->installEventFilter(this);
+	g_crop_item = scene->addRect(QRectF(), QPen(QColor(255, 220, 0)));
+	g_crop_item->setZValue(2);
+	g_crop_item->setVisible(false);
+	view_dock->setWidget(g_view);
+	addDockWidget(Qt::RightDockWidgetArea, view_dock);
+	QDockWidget* stat_dock = new QDockWidget;
+	g_stats = new QLabel;
+	stat_dock->setWidget(g_stats);
+	addDockWidget(Qt::RightDockWidgetArea, stat_dock);
+	QDockWidget* resource_dock = new QDockWidget;
+	g_resources = new QLabel;
+	resource_dock->setWidget(g_resources);
+	addDockWidget(Qt::RightDockWidgetArea, resource_dock);
+	QTimer* timer = new QTimer(this);
+	connect(timer, &QTimer::timeout, [] { resources_update(); });
+	timer->start(1000);
+	// ENQU_METRICS: port or file, as enqu-cli -M
+	if (const char* to = getenv("ENQU_METRICS"); to && exporter.start(to))
+		QMessageBox::warning(this, QObject::tr(""), QString("cannot export metrics to ") + to);
+	installEventFilter(this);
+}
+
+main_window::~main_window()
+{
+	g_layout.reset();
+	g_buf.reset();
+	// the clip frees its node, so before vsapi goes
+	g_clip.reset();
+	g_proxy.clear();
+	vs_finalize();
+}
+
+bool main_window::eventFilter(QObject* obj, QEvent* event)
+{
+	switch (event->type())
+	{
+	case QEvent::KeyPress:
+	{
+		QKeyEvent* key_event = static_cast<QKeyEvent*>(event);
+		int key = key_event->key(), modifiers = key_event->modifiers();
+		switch (key)
+		{
+		case Qt::Key_Q:
+			QApplication::quit();
+			return 1;
+		case Qt::Key_Plus:
+			g_of.w = std::clamp(g_of.w * 2, 1280, g_f.w * 4);
+			g_of.h = std::clamp(g_of.h * 2, 720, g_f.h * 4);
+			out_changed();
+			return 1;
+		case Qt::Key_Minus:
+			g_of.w = std::clamp(g_of.w / 2, 1280, g_f.w * 4);
+			g_of.h = std::clamp(g_of.h / 2, 720, g_f.h * 4);
+			out_changed();
+			return 1;
+		case Qt::Key_P:
+			proxy_toggle(this);
+			return 1;
+		case Qt::Key_C:
+			if (!g_crop.w)
+				break;
+			g_crop = {};
+			input_update(this);
+			return 1;
+		case Qt::Key_F12:
+			if (!trace::on)
+				trace::enable(1);
+			else
+			{
+				trace::enable(0);
+				std::string path = QDir::tempPath().toStdString() + "/enqu_trace.json";
+				if (trace::dump(path))
+					QMessageBox::warning(0, QObject::tr(""), QString::fromStdString("cannot write " + path));
+				else
+					QMessageBox::information(0, QObject::tr(""), QString::fromStdString("trace written to " + path));
+			}
+			return 1;
+		}
+		break;
+	}
+	// shift + drag on the frame selects the crop window, encodes are then on that region
+	case QEvent::MouseButtonPress:
+	case QEvent::MouseMove:
+	case QEvent::MouseButtonRelease:
+	{
+		if (obj != g_view->viewport() || !g_clip)
+			break;
+		QMouseEvent* mouse_event = static_cast<QMouseEvent*>(event);
+		if (event->type() == QEvent::MouseButtonPress)
+		{
+			if (mouse_event->button() != Qt::LeftButton || !(mouse_event->modifiers() & Qt::ShiftModifier))
+				break;
+			g_crop_from = g_view->mapToScene(mouse_event->pos());
+			g_cropping = 1;
+			return 1;
+		}
+		if (!g_cropping)
+			break;
+		crop_t c = crop_snap(g_crop_from, g_view->mapToScene(mouse_event->pos()));
+		if (event->type() == QEvent::MouseMove)
+		{
+			crop_item_update(c);
+			return 1;
+		}
+		g_cropping = 0;
+		g_crop = c;
+		input_update(this);
+		return 1;
+	}
+	}
+	if (g_layout && g_layout->event(obj, event))
+		return 1;
+	return QObject::eventFilter(obj, event);
+}
+
+}
+
 int main(int argc, char** argv)
 {
 	QApplication a(argc, argv);
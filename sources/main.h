@@ -1,8 +1,76 @@
+#include <QtWidgets>
 #include <QApplication>
 #include <QMainWindow>
 
 namespace enqu {
 
+extern std::vector<int> g_sof;
+extern int g_si, g_nf;
+extern QGraphicsPixmapItem* g_pixmap, * g_overlay;
+extern QLabel* g_stats, * g_resources;
+extern QGraphicsView* g_view;
+
+int pixmap_update(int si);
+
+class layout
+{
+	QTabWidget* stack;
+public:
+	layout(QTabWidget* stack) : stack(stack) {}
+	virtual int pixmap_update(int) = 0;
+	virtual void input_changed() = 0;
+	virtual bool event(QObject*, QEvent*) = 0;
+	virtual ~layout() { clear(); }
+	void clear()
+	{
+		while (stack->count())
+			delete stack->widget(0);
+	}
+};
+
+class elabel : public QLabel
+{
+	Q_OBJECT
+public:
+	elabel(QWidget* parent = nullptr)
+		: QLabel(parent)
+	{
+	}
+Q_SIGNALS:
+	void pressed();
+protected:
+	void mousePressEvent(QMouseEvent*) override
+	{
+		Q_EMIT pressed();
+	}
+};
+
+/* per frame bits (bars by slice type), qp, encode time and psnr of the shown result
+ * under the slider, follows g_si; pressing seeks */
+class timeline : public QWidget
+{
+	std::shared_ptr<res> r; // pinned while drawn
+public:
+	timeline(QWidget* parent = nullptr);
+	void set(std::shared_ptr<res>);
+protected:
+	void paintEvent(QPaintEvent*) override;
+	void mousePressEvent(QMouseEvent*) override;
+	void mouseMoveEvent(QMouseEvent*) override;
+	void seek(int x);
+};
+
+extern timeline* g_timeline;
+
+extern format g_f, g_of;
+// crop window of the input in g_f pixels, w 0 for the whole frame
+struct crop_t { int x = 0, y = 0, w = 0, h = 0; };
+extern crop_t g_crop;
+extern std::shared_ptr<video_buf_map> g_buf;
+extern std::unique_ptr<layout> g_layout;
+
+std::unique_ptr<layout> make_x265_layout(QTabWidget*);
+
 class main_window : public QMainWindow
 {
 	Q_OBJECT
@@ -10,6 +78,7 @@ public:
 	main_window();
 	~main_window();
 protected:
+	metrics_exporter exporter;
 	bool eventFilter(QObject*, QEvent*) override;
 };
 